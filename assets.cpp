@@ -0,0 +1,363 @@
+#include "assets.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+#include <glad/glad.h>
+#include <rw_math.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <tiny_obj_loader.h>
+
+#include "bench.h"
+#include "gl_state.h"
+
+TinyObjMesh tinyobj_load(std::string path) {
+  TinyObjMesh result;
+  std::string warn;
+  std::string err;
+
+  printf("tinyobj: Loading obj: %s\n", path.c_str());
+  bool ret = tinyobj::LoadObj(&result.attrib, &result.shapes, &result.materials, &warn, &err, path.c_str());
+
+  if (!warn.empty()) {
+    printf("%s\n", warn.c_str());
+  }
+
+  if (!err.empty()) {
+    printf("%s\n", err.c_str());
+  }
+
+  if (!ret) {
+    exit(1);
+  }
+
+  // Don't deal with multiple things in an obj file for now
+  assert(result.shapes.size() == 1);
+
+  result.total_vertices = 0;
+  for (size_t f = 0; f < result.shapes[0].mesh.num_face_vertices.size(); f++) {
+    int fv = result.shapes[0].mesh.num_face_vertices[f];
+    result.total_vertices += fv;
+  }
+
+  // Pack the data
+  result.packed.reserve(NUM_PACKED_ELEMENTS * result.total_vertices);
+  size_t index_offset = 0;
+  for (size_t f = 0; f < result.shapes[0].mesh.num_face_vertices.size(); f++) {
+    int fv = result.shapes[0].mesh.num_face_vertices[f];
+    for (size_t v = 0; v < fv; v++) {
+      tinyobj::index_t idx = result.shapes[0].mesh.indices[index_offset + v];
+      result.packed.push_back(result.attrib.vertices[3*idx.vertex_index+0]);
+      result.packed.push_back(result.attrib.vertices[3*idx.vertex_index+1]);
+      result.packed.push_back(result.attrib.vertices[3*idx.vertex_index+2]);
+      result.packed.push_back(result.attrib.texcoords[2*idx.texcoord_index+0]);
+      result.packed.push_back(result.attrib.texcoords[2*idx.texcoord_index+1]);
+      result.packed.push_back(result.attrib.normals[3*idx.normal_index+0]);
+      result.packed.push_back(result.attrib.normals[3*idx.normal_index+1]);
+      result.packed.push_back(result.attrib.normals[3*idx.normal_index+2]);
+      result.packed.push_back(0.0f);
+    }
+    index_offset += fv;
+  }
+  compute_tangents(result.packed.data(), result.total_vertices, NULL, 0);
+  result.bounds = compute_bounds(result.packed.data(), result.total_vertices, NUM_PACKED_ELEMENTS);
+
+  return result;
+}
+
+uint32_t load_texture(const char *path) {
+  stbi_set_flip_vertically_on_load(true);
+  uint32_t tid = 0;
+  int w, h, num_components;
+  unsigned char *data = stbi_load(path, &w, &h, &num_components, 0);
+  if (data) {
+    glGenTextures(1, &tid);
+    GLenum format = GL_RED;
+    if (num_components == 1) {
+      format = GL_RED;
+    } else if (num_components == 3) {
+      format = GL_RGB;
+    } else if (num_components == 4) {
+      format = GL_RGBA;
+    }
+    gl_bind_texture(GL_TEXTURE_2D, tid);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, w, h, 0, format, GL_UNSIGNED_BYTE, data);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    printf("Loaded texture: %s as tid %d\n", path, tid);
+  } else {
+    printf("ERROR: Texture could not be not loaded %s\n", path);
+  }
+  stbi_image_free(data);
+  return tid;
+}
+
+void sphere_geometry(uint32_t segments, std::vector<float> &packed, std::vector<uint32_t> &indices) {
+  const float pi = 3.14159265359;
+  packed.clear();
+  indices.clear();
+  for (uint32_t y = 0; y <= segments; y++) {
+    for (uint32_t x = 0; x <= segments; x++) {
+      float x_seg = (float)x/(float)segments;
+      float y_seg = (float)y/(float)segments;
+      float x_pos = std::cos(x_seg * 2.0f * pi) * std::sin(y_seg * pi);
+      float y_pos = std::cos(y_seg * pi);
+      float z_pos = std::sin(x_seg * 2.0f * pi) * std::sin(y_seg * pi);
+      packed.push_back(x_pos);
+      packed.push_back(y_pos);
+      packed.push_back(z_pos);
+      packed.push_back(x_seg);
+      packed.push_back(y_seg);
+      packed.push_back(x_pos);
+      packed.push_back(y_pos);
+      packed.push_back(z_pos);
+      // Around the equator with u, cross(normal, tangent) points down the sphere with v
+      Vec3 tangent = rwm_v3_init(-std::sin(x_seg * 2.0f * pi), 0.0f, std::cos(x_seg * 2.0f * pi));
+      uint32_t tangent_bits = pack_tangent(tangent, 1.0f);
+      float tangent_slot;
+      memcpy(&tangent_slot, &tangent_bits, sizeof(float));
+      packed.push_back(tangent_slot);
+    }
+  }
+
+  bool is_odd_row = false;
+  for (int y = 0; y < (int) segments; y++) {
+    if (!is_odd_row) {
+      for (int x = 0; x <= (int) segments; x++) {
+        indices.push_back(y * (segments+1) + x);
+        indices.push_back((y+1) * (segments+1) + x);
+      }
+    } else {
+      for (int x = segments; x >= 0; x--) {
+        indices.push_back((y+1) * (segments+1) + x);
+        indices.push_back(y * (segments+1) + x);
+      }
+    }
+    is_odd_row = !is_odd_row;
+  }
+}
+
+GpuMesh upload_mesh(const float *packed, uint32_t num_vertices, const uint32_t *indices, uint32_t num_indices, uint32_t mode) {
+  GpuMesh result = {};
+  result.mode = mode;
+  glGenVertexArrays(1, &result.vao);
+  gl_bind_vertex_array(result.vao);
+  glGenBuffers(1, &result.vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, result.vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(float) * NUM_PACKED_ELEMENTS * num_vertices, packed, GL_STATIC_DRAW);
+  if (indices) {
+    glGenBuffers(1, &result.ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, result.ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * num_indices, indices, GL_STATIC_DRAW);
+    result.count = num_indices;
+  } else {
+    result.count = num_vertices;
+  }
+  constexpr size_t stride = NUM_PACKED_ELEMENTS * sizeof(float);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)(5 * sizeof(float)));
+  // 3 is the draw id of the GPU driven passes
+  glEnableVertexAttribArray(4);
+  glVertexAttribPointer(4, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)(PACKED_TANGENT_OFFSET * sizeof(float)));
+  gl_bind_vertex_array(0);
+  return result;
+}
+
+void draw_gpu_mesh(GpuMesh &m) {
+  gl_bind_vertex_array(m.vao);
+  if (m.ebo) {
+    glDrawElementsBaseVertex(m.mode, m.count, GL_UNSIGNED_INT, (void *) (sizeof(uint32_t) * m.first), m.base_vertex);
+  } else {
+    glDrawArrays(m.mode, m.first, m.count);
+  }
+  stats_count_draw(m.mode, m.count);
+}
+
+void strip_to_triangles(const uint32_t *strip, uint32_t num_indices, std::vector<uint32_t> &out) {
+  for (uint32_t i = 0; i + 2 < num_indices; i++) {
+    uint32_t a = strip[i], b = strip[i+1], c = strip[i+2];
+    if (a == b || b == c || a == c) {
+      continue;
+    }
+    if (i & 1) {
+      uint32_t tmp = a;
+      a = b;
+      b = tmp;
+    }
+    out.push_back(a);
+    out.push_back(b);
+    out.push_back(c);
+  }
+}
+
+void sphere_triangles(uint32_t segments, std::vector<float> &packed, std::vector<uint32_t> &triangles) {
+  std::vector<uint32_t> strip;
+  sphere_geometry(segments, packed, strip);
+  // The strip starts out clockwise seen from outside
+  strip_to_triangles(strip.data(), strip.size(), triangles);
+  for (size_t i = 0; i < triangles.size(); i += 3) {
+    uint32_t t = triangles[i+1];
+    triangles[i+1] = triangles[i+2];
+    triangles[i+2] = t;
+  }
+}
+
+// Round trips through a scratch buffer so the name, and the vao pointing at it, stay valid
+static void grow_buffer(uint32_t buffer, size_t old_size, size_t new_size) {
+  uint32_t scratch;
+  glGenBuffers(1, &scratch);
+  glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, scratch);
+  glBufferData(GL_COPY_WRITE_BUFFER, old_size, NULL, GL_STREAM_COPY);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, old_size);
+  glBufferData(GL_COPY_READ_BUFFER, new_size, NULL, GL_STATIC_DRAW);
+  glCopyBufferSubData(GL_COPY_WRITE_BUFFER, GL_COPY_READ_BUFFER, 0, 0, old_size);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  glDeleteBuffers(1, &scratch);
+}
+
+static uint32_t grown_capacity(uint32_t capacity, uint32_t needed) {
+  while (capacity < needed) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+GpuMesh arena_add(MeshArena *arena, const float *packed, uint32_t num_vertices, const uint32_t *indices, uint32_t num_indices) {
+  constexpr size_t vertex_size = NUM_PACKED_ELEMENTS * sizeof(float);
+  if (arena->vao == 0) {
+    arena->vertex_capacity = 1 << 16;
+    arena->index_capacity = 1 << 18;
+    glGenVertexArrays(1, &arena->vao);
+    gl_bind_vertex_array(arena->vao);
+    glGenBuffers(1, &arena->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, arena->vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertex_size * arena->vertex_capacity, NULL, GL_STATIC_DRAW);
+    glGenBuffers(1, &arena->ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena->ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * arena->index_capacity, NULL, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, vertex_size, (void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, vertex_size, (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, vertex_size, (void*)(5 * sizeof(float)));
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(4, 4, GL_INT_2_10_10_10_REV, GL_TRUE, vertex_size, (void*)(PACKED_TANGENT_OFFSET * sizeof(float)));
+    gl_bind_vertex_array(0);
+  }
+
+  std::vector<uint32_t> sequential;
+  if (!indices) {
+    sequential.resize(num_vertices);
+    for (uint32_t i = 0; i < num_vertices; i++) {
+      sequential[i] = i;
+    }
+    indices = sequential.data();
+    num_indices = num_vertices;
+  }
+
+  if (arena->num_vertices + num_vertices > arena->vertex_capacity) {
+    uint32_t capacity = grown_capacity(arena->vertex_capacity, arena->num_vertices + num_vertices);
+    grow_buffer(arena->vbo, vertex_size * arena->num_vertices, vertex_size * capacity);
+    arena->vertex_capacity = capacity;
+  }
+  if (arena->num_indices + num_indices > arena->index_capacity) {
+    uint32_t capacity = grown_capacity(arena->index_capacity, arena->num_indices + num_indices);
+    grow_buffer(arena->ebo, sizeof(uint32_t) * arena->num_indices, sizeof(uint32_t) * capacity);
+    arena->index_capacity = capacity;
+  }
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, arena->vbo);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, vertex_size * arena->num_vertices, vertex_size * num_vertices, packed);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, arena->ebo);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(uint32_t) * arena->num_indices, sizeof(uint32_t) * num_indices, indices);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  GpuMesh result = {};
+  result.vao = arena->vao;
+  result.vbo = arena->vbo;
+  result.ebo = arena->ebo;
+  result.mode = GL_TRIANGLES;
+  result.count = num_indices;
+  result.first = arena->num_indices;
+  result.base_vertex = (int32_t) arena->num_vertices;
+  arena->num_vertices += num_vertices;
+  arena->num_indices += num_indices;
+  return result;
+}
+
+void arena_destroy(MeshArena *arena) {
+  gl_delete_vertex_arrays(1, &arena->vao);
+  glDeleteBuffers(1, &arena->vbo);
+  glDeleteBuffers(1, &arena->ebo);
+  *arena = {};
+}
+
+OccluderMesh load_occluder(const std::string &path) {
+  OccluderMesh result;
+  if (path == "builtin:sphere") {
+    // Counter-clockwise, the rasterizer drops back faces
+    std::vector<float> packed;
+    std::vector<uint32_t> triangles;
+    sphere_triangles(8, packed, triangles);
+    for (uint32_t idx : triangles) {
+      const float *p = &packed[idx * NUM_PACKED_ELEMENTS];
+      result.positions.push_back(rwm_v3_init(p[0], p[1], p[2]));
+    }
+  } else {
+    TinyObjMesh to_mesh = tinyobj_load(path);
+    for (uint32_t i = 0; i < to_mesh.total_vertices; i++) {
+      const float *p = &to_mesh.packed[i * NUM_PACKED_ELEMENTS];
+      result.positions.push_back(rwm_v3_init(p[0], p[1], p[2]));
+    }
+  }
+  return result;
+}
+
+uint32_t cache_texture(AssetCache *cache, const std::string &path) {
+  auto it = cache->textures.find(path);
+  if (it != cache->textures.end()) {
+    return it->second;
+  }
+  uint32_t tid = load_texture(path.c_str());
+  cache->textures[path] = tid;
+  return tid;
+}
+
+uint32_t cache_mesh(AssetCache *cache, const std::string &path) {
+  auto it = cache->mesh_ids.find(path);
+  if (it != cache->mesh_ids.end()) {
+    return it->second;
+  }
+  GpuMesh mesh;
+  if (path == "builtin:sphere") {
+    std::vector<float> packed;
+    std::vector<uint32_t> triangles;
+    sphere_triangles(64, packed, triangles);
+    mesh = arena_add(&cache->arena, packed.data(), packed.size() / NUM_PACKED_ELEMENTS, triangles.data(), triangles.size());
+    mesh.bounds = compute_bounds(packed.data(), packed.size() / NUM_PACKED_ELEMENTS, NUM_PACKED_ELEMENTS);
+  } else {
+    // The CPU copy isn't needed once it's uploaded
+    TinyObjMesh to_mesh = tinyobj_load(path);
+    mesh = arena_add(&cache->arena, to_mesh.packed.data(), to_mesh.total_vertices, NULL, 0);
+    mesh.bounds = to_mesh.bounds;
+  }
+  uint32_t id = (uint32_t) cache->meshes.size();
+  cache->meshes.push_back(mesh);
+  cache->mesh_ids[path] = id;
+  return id;
+}
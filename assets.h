@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <tiny_obj_loader.h>
+#include "mesh.h"
+#include "soft_occlusion.h"
+
+struct PBRTextures {
+  uint32_t albedo_tid;
+  uint32_t metallic_tid;
+  uint32_t roughness_tid;
+  uint32_t normal_tid;
+  uint32_t ao_tid;
+};
+
+struct TinyObjMesh {
+  tinyobj::attrib_t attrib;
+  std::vector<tinyobj::shape_t> shapes;
+  std::vector<tinyobj::material_t> materials;
+  //float *packed;
+  std::vector<float> packed;
+  uint32_t total_vertices;
+  Bounds bounds;
+};
+
+// Mesh that lives on the GPU for good. Vertices are packed position/uv/normal/tangent
+// like NUM_PACKED_ELEMENTS. count is the number of indices if there's an ebo,
+// otherwise the number of vertices. Meshes in a MeshArena share the vao and
+// start at index first, with base_vertex added to every index.
+struct GpuMesh {
+  uint32_t vao;
+  uint32_t vbo;
+  uint32_t ebo;
+  uint32_t mode;
+  uint32_t count;
+  uint32_t first;
+  int32_t base_vertex;
+  Bounds bounds;
+};
+
+// One vao/vbo/ebo for every cached mesh, so a whole pass can go out as a single
+// glMultiDrawElementsIndirect. Everything in it is an indexed triangle list.
+// The buffers grow in place, their names (and the vao) never change.
+struct MeshArena {
+  uint32_t vao;
+  uint32_t vbo;
+  uint32_t ebo;
+  uint32_t num_vertices;
+  uint32_t num_indices;
+  uint32_t vertex_capacity;
+  uint32_t index_capacity;
+};
+
+// Everything loaded through here is keyed by path, so a texture or mesh that
+// several materials/instances reference is only loaded once
+struct AssetCache {
+  std::unordered_map<std::string, uint32_t> textures;
+  std::unordered_map<std::string, uint32_t> mesh_ids;
+  std::vector<GpuMesh> meshes;
+  MeshArena arena = {};
+};
+
+uint32_t load_texture(const char *path);
+TinyObjMesh tinyobj_load(std::string path);
+// Interleaved, indexed triangle strip of a unit sphere
+void sphere_geometry(uint32_t segments, std::vector<float> &packed, std::vector<uint32_t> &indices);
+
+// Indexed strip to an indexed list, keeping the winding of every other triangle like GL does
+void strip_to_triangles(const uint32_t *strip, uint32_t num_indices, std::vector<uint32_t> &out);
+// The same sphere as an indexed triangle list, counter-clockwise seen from outside
+void sphere_triangles(uint32_t segments, std::vector<float> &packed, std::vector<uint32_t> &triangles);
+
+GpuMesh upload_mesh(const float *packed, uint32_t num_vertices, const uint32_t *indices, uint32_t num_indices, uint32_t mode);
+void draw_gpu_mesh(GpuMesh &m);
+// Appends an indexed triangle list to the arena. indices can be NULL for a plain list of vertices.
+GpuMesh arena_add(MeshArena *arena, const float *packed, uint32_t num_vertices, const uint32_t *indices, uint32_t num_indices);
+void arena_destroy(MeshArena *arena);
+
+// CPU only triangle list for the software occlusion rasterizer. builtin:sphere is a
+// coarse sphere whose faces are chords, so it stays inside the rendered sphere.
+OccluderMesh load_occluder(const std::string &path);
+
+uint32_t cache_texture(AssetCache *cache, const std::string &path);
+// Paths starting with "builtin:" are generated, currently only builtin:sphere
+uint32_t cache_mesh(AssetCache *cache, const std::string &path);
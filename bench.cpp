@@ -0,0 +1,348 @@
+#include "bench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <unordered_map>
+#include <glad/glad.h>
+#include <rw_math.h>
+
+RenderStats g_render_stats;
+
+static const char *pass_names[BENCH_PASS_COUNT] = {
+  "shadows",
+  "geometry",
+  "local_lights",
+  "lighting",
+  "skybox",
+  "present",
+};
+
+void stats_count_draw(uint32_t gl_mode, uint32_t count) {
+  g_render_stats.draw_calls++;
+  switch (gl_mode) {
+    case GL_TRIANGLES:
+      g_render_stats.triangles += count / 3;
+      break;
+    case GL_TRIANGLE_STRIP:
+    case GL_TRIANGLE_FAN:
+      g_render_stats.triangles += count > 2 ? count - 2 : 0;
+      break;
+    default:
+      break;
+  }
+}
+
+// Camera path file format, one key per line:
+//   key <time in seconds> <pos x y z> <target x y z>
+// Lines starting with # are ignored.
+bool camera_path_load(CameraPath *path, const char *file_path) {
+  FILE *f = fopen(file_path, "r");
+  if (!f) {
+    printf("ERROR: Camera path could not be loaded %s\n", file_path);
+    return false;
+  }
+  path->keys.clear();
+  char line[256];
+  while (fgets(line, sizeof(line), f)) {
+    CameraKey k;
+    if (sscanf(line, "key %f %f %f %f %f %f %f", &k.time,
+          &k.pos.x, &k.pos.y, &k.pos.z, &k.target.x, &k.target.y, &k.target.z) == 7) {
+      path->keys.push_back(k);
+    }
+  }
+  fclose(f);
+  printf("Loaded camera path: %s with %d keys\n", file_path, (int) path->keys.size());
+  return path->keys.size() > 0;
+}
+
+bool camera_path_save(CameraPath *path, const char *file_path) {
+  FILE *f = fopen(file_path, "w");
+  if (!f) {
+    printf("ERROR: Camera path could not be saved %s\n", file_path);
+    return false;
+  }
+  fprintf(f, "# key <time> <pos x y z> <target x y z>\n");
+  for (CameraKey &k : path->keys) {
+    fprintf(f, "key %f %f %f %f %f %f %f\n", k.time,
+        k.pos.x, k.pos.y, k.pos.z, k.target.x, k.target.y, k.target.z);
+  }
+  fclose(f);
+  printf("Saved camera path: %s with %d keys\n", file_path, (int) path->keys.size());
+  return true;
+}
+
+static Vec3 catmull_rom(Vec3 p0, Vec3 p1, Vec3 p2, Vec3 p3, float t) {
+  float t2 = t * t;
+  float t3 = t2 * t;
+  return 0.5f * ((2.0f * p1) +
+      (t * (p2 - p0)) +
+      (t2 * ((2.0f * p0) - (5.0f * p1) + (4.0f * p2) - p3)) +
+      (t3 * ((3.0f * p1) - p0 - (3.0f * p2) + p3)));
+}
+
+// Loops once the end of the path is reached
+void camera_path_sample(CameraPath *path, float time, Vec3 *out_pos, Vec3 *out_target) {
+  std::vector<CameraKey> &keys = path->keys;
+  int n = (int) keys.size();
+  if (n == 1) {
+    *out_pos = keys[0].pos;
+    *out_target = keys[0].target;
+    return;
+  }
+  float duration = keys[n-1].time;
+  if (duration > 0.0f) {
+    time = fmodf(time, duration);
+  }
+  int i = 0;
+  while (i < n - 2 && keys[i+1].time <= time) {
+    i++;
+  }
+  float span = keys[i+1].time - keys[i].time;
+  float t = span > 0.0f ? rwm_clamp((time - keys[i].time) / span, 0.0f, 1.0f) : 0.0f;
+  CameraKey &k0 = keys[i > 0 ? i - 1 : i];
+  CameraKey &k1 = keys[i];
+  CameraKey &k2 = keys[i+1];
+  CameraKey &k3 = keys[i + 2 < n ? i + 2 : i + 1];
+  *out_pos = catmull_rom(k0.pos, k1.pos, k2.pos, k3.pos, t);
+  *out_target = catmull_rom(k0.target, k1.target, k2.target, k3.target, t);
+}
+
+void gpu_timers_init(GpuTimers *timers) {
+  glGenQueries(BENCH_QUERY_LATENCY * BENCH_PASS_COUNT, &timers->queries[0][0]);
+  memset(timers->issued, 0, sizeof(timers->issued));
+  memset(timers->pass_ms, 0, sizeof(timers->pass_ms));
+  timers->frame = 0;
+}
+
+void gpu_timers_begin(GpuTimers *timers, BenchPass pass) {
+  uint32_t slot = timers->frame % BENCH_QUERY_LATENCY;
+  glBeginQuery(GL_TIME_ELAPSED, timers->queries[slot][pass]);
+  timers->issued[slot][pass] = true;
+}
+
+void gpu_timers_end(GpuTimers *timers) {
+  glEndQuery(GL_TIME_ELAPSED);
+}
+
+void gpu_timers_next_frame(GpuTimers *timers) {
+  timers->frame++;
+  // The slot we're about to reuse was issued BENCH_QUERY_LATENCY frames ago,
+  // so this should almost never have to wait on the GPU
+  uint32_t slot = timers->frame % BENCH_QUERY_LATENCY;
+  for (int i = 0; i < BENCH_PASS_COUNT; i++) {
+    timers->pass_ms[i] = 0.0f;
+    if (timers->issued[slot][i]) {
+      GLuint64 ns = 0;
+      glGetQueryObjectui64v(timers->queries[slot][i], GL_QUERY_RESULT, &ns);
+      timers->pass_ms[i] = (float) ((double) ns / 1000000.0);
+      timers->issued[slot][i] = false;
+    }
+  }
+}
+
+void bench_record_frame(BenchRun *run, float cpu_ms, GpuTimers *timers) {
+  BenchFrame frame;
+  frame.cpu_ms = cpu_ms;
+  frame.gpu_ms = 0.0f;
+  for (int i = 0; i < BENCH_PASS_COUNT; i++) {
+    frame.pass_ms[i] = timers->pass_ms[i];
+    frame.gpu_ms += timers->pass_ms[i];
+  }
+  frame.draw_calls = g_render_stats.draw_calls;
+  frame.triangles = g_render_stats.triangles;
+  frame.instances_visible = g_render_stats.instances_visible;
+  frame.state_calls = g_render_stats.state_calls;
+  frame.state_calls_dropped = g_render_stats.state_calls_dropped;
+  run->frames.push_back(frame);
+}
+
+struct Summary {
+  double mean;
+  double p50;
+  double p95;
+  double p99;
+};
+
+static Summary summarize(std::vector<double> &values) {
+  Summary result = {};
+  if (values.empty()) {
+    return result;
+  }
+  std::sort(values.begin(), values.end());
+  double sum = 0.0;
+  for (double v : values) {
+    sum += v;
+  }
+  size_t n = values.size();
+  // Nearest rank percentiles
+  auto percentile = [&](double p) {
+    size_t rank = (size_t) ceil(p * n);
+    return values[rank > 0 ? rank - 1 : 0];
+  };
+  result.mean = sum / n;
+  result.p50 = percentile(0.50);
+  result.p95 = percentile(0.95);
+  result.p99 = percentile(0.99);
+  return result;
+}
+
+static void write_summary(FILE *f, const char *name, Summary s, bool trailing_comma) {
+  fprintf(f, "  \"%s\": { \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f }%s\n",
+      name, s.mean, s.p50, s.p95, s.p99, trailing_comma ? "," : "");
+}
+
+bool bench_write_report(BenchRun *run, const char *prefix) {
+  std::string json_path = std::string(prefix) + ".json";
+  std::string csv_path = std::string(prefix) + ".csv";
+
+  size_t first = run->frames.size() > BENCH_WARMUP_FRAMES ? BENCH_WARMUP_FRAMES : 0;
+  std::vector<double> cpu, gpu, draws, tris, visible, state, dropped;
+  std::vector<double> passes[BENCH_PASS_COUNT];
+  for (size_t i = first; i < run->frames.size(); i++) {
+    BenchFrame &fr = run->frames[i];
+    cpu.push_back(fr.cpu_ms);
+    gpu.push_back(fr.gpu_ms);
+    draws.push_back(fr.draw_calls);
+    tris.push_back((double) fr.triangles);
+    visible.push_back(fr.instances_visible);
+    state.push_back(fr.state_calls);
+    dropped.push_back(fr.state_calls_dropped);
+    for (int p = 0; p < BENCH_PASS_COUNT; p++) {
+      passes[p].push_back(fr.pass_ms[p]);
+    }
+  }
+
+  FILE *f = fopen(json_path.c_str(), "w");
+  if (!f) {
+    printf("ERROR: Benchmark report could not be written %s\n", json_path.c_str());
+    return false;
+  }
+  fprintf(f, "{\n");
+  fprintf(f, "  \"path\": \"%s\",\n", run->path_name.c_str());
+  fprintf(f, "  \"frames\": %d,\n", (int) cpu.size());
+  fprintf(f, "  \"dt_ms\": %.4f,\n", run->dt_ms);
+  write_summary(f, "frame_ms", summarize(cpu), true);
+  write_summary(f, "gpu_ms", summarize(gpu), true);
+  for (int p = 0; p < BENCH_PASS_COUNT; p++) {
+    std::string name = std::string("pass_") + pass_names[p] + "_ms";
+    write_summary(f, name.c_str(), summarize(passes[p]), true);
+  }
+  write_summary(f, "draw_calls", summarize(draws), true);
+  write_summary(f, "triangles", summarize(tris), true);
+  write_summary(f, "instances_visible", summarize(visible), true);
+  write_summary(f, "state_calls", summarize(state), true);
+  write_summary(f, "state_calls_dropped", summarize(dropped), false);
+  fprintf(f, "}\n");
+  fclose(f);
+
+  f = fopen(csv_path.c_str(), "w");
+  if (!f) {
+    printf("ERROR: Benchmark report could not be written %s\n", csv_path.c_str());
+    return false;
+  }
+  fprintf(f, "frame,cpu_ms,gpu_ms");
+  for (int p = 0; p < BENCH_PASS_COUNT; p++) {
+    fprintf(f, ",%s_ms", pass_names[p]);
+  }
+  fprintf(f, ",draw_calls,triangles,instances_visible,state_calls,state_calls_dropped\n");
+  for (size_t i = 0; i < run->frames.size(); i++) {
+    BenchFrame &fr = run->frames[i];
+    fprintf(f, "%d,%.4f,%.4f", (int) i, fr.cpu_ms, fr.gpu_ms);
+    for (int p = 0; p < BENCH_PASS_COUNT; p++) {
+      fprintf(f, ",%.4f", fr.pass_ms[p]);
+    }
+    fprintf(f, ",%u,%llu,%u,%u,%u\n", fr.draw_calls, (unsigned long long) fr.triangles, fr.instances_visible,
+        fr.state_calls, fr.state_calls_dropped);
+  }
+  fclose(f);
+
+  Summary s = summarize(cpu);
+  printf("Benchmark: %d frames, mean %.3f ms, p50 %.3f ms, p95 %.3f ms, p99 %.3f ms\n",
+      (int) cpu.size(), s.mean, s.p50, s.p95, s.p99);
+  printf("Wrote %s and %s\n", json_path.c_str(), csv_path.c_str());
+  return true;
+}
+
+// NOTE(ray): This only understands the flat object-of-objects that bench_write_report emits.
+// Every number ends up under "<outer key>.<inner key>".
+static bool load_report(const char *path, std::unordered_map<std::string, double> &out) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    printf("ERROR: Benchmark report could not be loaded %s\n", path);
+    return false;
+  }
+  std::string src;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    src.append(buf, n);
+  }
+  fclose(f);
+
+  std::string outer, key;
+  int depth = 0;
+  for (size_t i = 0; i < src.size(); i++) {
+    char c = src[i];
+    if (c == '{') {
+      depth++;
+    } else if (c == '}') {
+      depth--;
+    } else if (c == '"') {
+      size_t end = src.find('"', i + 1);
+      if (end == std::string::npos) {
+        break;
+      }
+      key = src.substr(i + 1, end - i - 1);
+      if (depth == 1) {
+        outer = key;
+      }
+      i = end;
+    } else if (c == '-' || (c >= '0' && c <= '9')) {
+      char *end;
+      double v = strtod(src.c_str() + i, &end);
+      out[depth == 1 ? outer : outer + "." + key] = v;
+      i = (end - src.c_str()) - 1;
+    }
+  }
+  return true;
+}
+
+int bench_compare(const char *baseline_path, const char *current_path, float threshold_pct) {
+  std::unordered_map<std::string, double> baseline, current;
+  if (!load_report(baseline_path, baseline) || !load_report(current_path, current)) {
+    return -1;
+  }
+  // Only the percentiles and means are compared. Timings are lower is better and can
+  // regress, the counters have no good direction (fewer draws can be worse culling,
+  // more dropped state calls is better) so they're printed for reference only.
+  std::vector<std::string> keys;
+  for (auto &it : baseline) {
+    if (it.first.find('.') != std::string::npos) {
+      keys.push_back(it.first);
+    }
+  }
+  std::sort(keys.begin(), keys.end());
+
+  int num_regressions = 0;
+  printf("%-28s %12s %12s %9s\n", "metric", "baseline", "current", "change");
+  for (std::string &k : keys) {
+    auto it = current.find(k);
+    if (it == current.end()) {
+      continue;
+    }
+    double b = baseline[k];
+    double c = it->second;
+    double change = b > 0.0 ? (c - b) / b * 100.0 : 0.0;
+    bool is_timing = k.find("_ms.") != std::string::npos;
+    // Near empty passes (a cached shadow pass) swing by large percentages from noise
+    bool regressed = is_timing && change > threshold_pct && c - b > BENCH_COMPARE_MIN_MS;
+    printf("%-28s %12.4f %12.4f %+8.2f%%%s\n", k.c_str(), b, c, change, regressed ? "  REGRESSION" : "");
+    if (regressed) {
+      num_regressions++;
+    }
+  }
+  printf("%d regression(s) over %.1f%%\n", num_regressions, threshold_pct);
+  return num_regressions;
+}
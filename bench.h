@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <rw_math.h>
+
+// Number of frames a GPU timer query is given before we read it back
+#define BENCH_QUERY_LATENCY 3
+// Frames at the start of a run that are left out of the statistics
+#define BENCH_WARMUP_FRAMES 30
+// Timings that grow by less than this are never a regression, whatever the percentage
+#define BENCH_COMPARE_MIN_MS 0.05
+
+enum BenchPass {
+  BENCH_PASS_SHADOWS,
+  BENCH_PASS_GEOMETRY,
+  BENCH_PASS_LOCAL_LIGHTS,
+  BENCH_PASS_LIGHTING,
+  BENCH_PASS_SKYBOX,
+  BENCH_PASS_PRESENT,
+  BENCH_PASS_COUNT
+};
+
+struct RenderStats {
+  uint32_t draw_calls;
+  uint64_t triangles;
+  uint32_t instances_visible;
+  uint32_t instances_total;
+  // Binds and enables that went through the GlState cache, and how many it dropped
+  uint32_t state_calls;
+  uint32_t state_calls_dropped;
+};
+
+// Reset at the start of every frame, incremented by the render_* functions
+extern RenderStats g_render_stats;
+void stats_count_draw(uint32_t gl_mode, uint32_t count);
+
+struct CameraKey {
+  float time;
+  Vec3 pos;
+  Vec3 target;
+};
+
+// Either a handful of hand placed keys or a dense recording, sampled as a Catmull-Rom spline
+struct CameraPath {
+  std::vector<CameraKey> keys;
+};
+
+bool camera_path_load(CameraPath *path, const char *file_path);
+bool camera_path_save(CameraPath *path, const char *file_path);
+void camera_path_sample(CameraPath *path, float time, Vec3 *out_pos, Vec3 *out_target);
+
+struct GpuTimers {
+  uint32_t queries[BENCH_QUERY_LATENCY][BENCH_PASS_COUNT];
+  bool issued[BENCH_QUERY_LATENCY][BENCH_PASS_COUNT];
+  uint32_t frame;
+  // Results of the frame that was just read back, in ms
+  float pass_ms[BENCH_PASS_COUNT];
+};
+
+void gpu_timers_init(GpuTimers *timers);
+void gpu_timers_begin(GpuTimers *timers, BenchPass pass);
+void gpu_timers_end(GpuTimers *timers);
+// Reads back the oldest frame in flight into pass_ms and advances to the next frame
+void gpu_timers_next_frame(GpuTimers *timers);
+
+struct BenchFrame {
+  float cpu_ms;
+  float gpu_ms;
+  float pass_ms[BENCH_PASS_COUNT];
+  uint32_t draw_calls;
+  uint64_t triangles;
+  uint32_t instances_visible;
+  uint32_t state_calls;
+  uint32_t state_calls_dropped;
+};
+
+struct BenchRun {
+  std::string path_name;
+  uint32_t num_frames;
+  float dt_ms;
+  std::vector<BenchFrame> frames;
+};
+
+void bench_record_frame(BenchRun *run, float cpu_ms, GpuTimers *timers);
+// Writes <prefix>.json with the summary and <prefix>.csv with every frame
+bool bench_write_report(BenchRun *run, const char *prefix);
+// Returns the number of timings in current that are slower than baseline by more than
+// threshold_pct and BENCH_COMPARE_MIN_MS. Counters are printed but never counted.
+int bench_compare(const char *baseline_path, const char *current_path, float threshold_pct);
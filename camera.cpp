@@ -10,6 +10,9 @@ Camera::Camera(Vec3 pos, Vec3 target, Vec3 up, float fov_y, float near_z, float
   this->pos = pos;
   this->target = target;
   this->up = up;
+  this->prev_pos = pos;
+  this->prev_target = target;
+  this->render_pos = pos;
   this->fov_y = fov_y;
   this->near_z = near_z;
   this->far_z = far_z;
@@ -43,7 +46,6 @@ Mat4 get_view_mat(Vec3 *position, Vec3 *target, Vec3 *up) {
   );
 }
 
-
 Mat4 perspective(float fov_y, float near, float far, float aspect) {
   float top = tan(rwm_to_radians(fov_y)/2.0f) * near;
   float bottom = -top;
@@ -58,6 +60,36 @@ Mat4 perspective(float fov_y, float near, float far, float aspect) {
   return result;
 }
 
+// Places the camera directly, used when it's driven by something other than input
+void Camera::look_at(Vec3 pos, Vec3 target) {
+  this->pos = pos;
+  this->target = target;
+  Vec3 camera_dir = rwm_v3_normalize(rwm_v3_subtract(this->target, this->pos));
+  this->right = rwm_v3_normalize(rwm_v3_cross(camera_dir, this->up));
+  this->view_mat = get_view_mat(&this->pos, &this->target, &this->up);
+  // Nothing to interpolate between
+  this->prev_pos = pos;
+  this->prev_target = target;
+  this->render_pos = pos;
+}
+
+void Camera::begin_tick() {
+  this->prev_pos = this->pos;
+  this->prev_target = this->target;
+}
+
+// Blend between the last two simulation ticks so rendering at a different rate
+// than the fixed update doesn't judder. Overwrites view_mat with the blended view.
+void Camera::interpolate(float alpha) {
+  this->render_pos = this->prev_pos + alpha * (this->pos - this->prev_pos);
+  Vec3 render_target = this->prev_target + alpha * (this->target - this->prev_target);
+  this->view_mat = get_view_mat(&this->render_pos, &render_target, &this->up);
+}
+
+void Camera::set_aspect(float aspect) {
+  this->persp_mat = perspective(this->fov_y, this->near_z, this->far_z, aspect);
+}
+
 void Camera::update(float dt) {
   // pos->z = sin(dt*0.05);
   bool has_moved = false;
@@ -65,7 +97,7 @@ void Camera::update(float dt) {
 
   if (is_mouse_down(SDL_BUTTON_LEFT)) {
     int x, y;
-    SDL_GetMouseState(&x, &y);
+    get_mouse_pos(&x, &y);
     //SDL_GetGlobalMouseState(&x, &y);
     Vec2 mouse_delta = rwm_v2_init((float) x - this->mouse_pos.x, (float) y - this->mouse_pos.y);
     // rwm_v2_puts(&mouse_delta);
@@ -13,6 +13,10 @@ struct Camera {
   Vec2 mouse_pos;
   Vec3 pos;
   Vec3 target;
+  // State at the start of the current simulation tick, and the interpolated position used for rendering
+  Vec3 prev_pos;
+  Vec3 prev_target;
+  Vec3 render_pos;
   Vec3 up;
   Vec3 right;
   Mat4 view_mat;
@@ -21,6 +25,11 @@ struct Camera {
   Camera() : Camera(rwm_v3_init(0, 0, 0), rwm_v3_init(0, 0, -1.0f), rwm_v3_init(0, 1, 0), 43.0f, 0.1f, 1000.0f, ASPECT_RATIO) {}
   Camera(Vec3 pos, Vec3 target, Vec3 up, float fov_y, float near_z, float far_z, float aspect);
   void update(float dt_ms);
+  void look_at(Vec3 pos, Vec3 target);
+  void begin_tick();
+  void interpolate(float alpha);
+  // Rebuilds the projection, e.g. after the window was resized
+  void set_aspect(float aspect);
 };
 
 Mat4 get_view_mat(Vec3 *position, Vec3 *target, Vec3 *up);
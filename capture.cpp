@@ -0,0 +1,242 @@
+#include "capture.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glad/glad.h>
+#include <TaskScheduler_c.h>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include "gl_state.h"
+
+static uint32_t bytes_per_pixel(CaptureFormat format) {
+  return format == CaptureFormat::HDR ? 3 * sizeof(float) : 3;
+}
+
+static void raw_path(char *out, size_t n, const char *prefix) {
+  snprintf(out, n, "%s.rgb", prefix);
+}
+
+// Raw captures pass 2 GB quickly, which long can't address on Windows
+static int seek_64(FILE *f, int64_t offset) {
+#ifdef _MSC_VER
+  return _fseeki64(f, offset, SEEK_SET);
+#else
+  return fseeko(f, (off_t) offset, SEEK_SET);
+#endif
+}
+
+// Runs on an enkiTS worker. GL reads back bottom-up so the rows get flipped here
+// rather than on the main thread.
+static void encode_task(uint32_t start, uint32_t end, uint32_t threadnum, void *args) {
+  CaptureJob *job = (CaptureJob *) args;
+  uint32_t row_size = job->w * bytes_per_pixel(job->format);
+  uint8_t *tmp = (uint8_t *) malloc(row_size);
+  for (int y = 0; y < job->h / 2; y++) {
+    uint8_t *a = job->pixels + y * row_size;
+    uint8_t *b = job->pixels + (job->h - 1 - y) * row_size;
+    memcpy(tmp, a, row_size);
+    memcpy(a, b, row_size);
+    memcpy(b, tmp, row_size);
+  }
+  free(tmp);
+
+  char path[512];
+  switch (job->format) {
+    case CaptureFormat::PNG:
+      snprintf(path, sizeof(path), "%s_%05d.png", job->prefix, job->frame_index);
+      stbi_write_png(path, job->w, job->h, 3, job->pixels, row_size);
+      break;
+    case CaptureFormat::HDR:
+      snprintf(path, sizeof(path), "%s_%05d.hdr", job->prefix, job->frame_index);
+      stbi_write_hdr(path, job->w, job->h, 3, (float *) job->pixels);
+      break;
+    case CaptureFormat::RAW: {
+      // Every frame has a fixed slot in the file so the tasks can finish in any order
+      raw_path(path, sizeof(path), job->prefix);
+      FILE *f = fopen(path, "r+b");
+      if (f) {
+        if (seek_64(f, (int64_t) job->frame_index * job->size) == 0) {
+          fwrite(job->pixels, 1, job->size, f);
+        } else {
+          printf("ERROR: Could not seek to frame %d in %s\n", job->frame_index, path);
+        }
+        fclose(f);
+      }
+    } break;
+  }
+}
+
+void capture_init(FrameCapture *cap, enkiTaskScheduler *ts, int w, int h, const char *prefix) {
+  cap->ts = ts;
+  cap->w = w;
+  cap->h = h;
+  cap->prefix = prefix;
+  cap->is_recording = false;
+  cap->format = CaptureFormat::PNG;
+  cap->next_slot = 0;
+  cap->next_job = 0;
+  cap->frame_index = 0;
+
+  // Size the PBOs for the largest format so switching formats never reallocates
+  uint32_t max_size = w * h * bytes_per_pixel(CaptureFormat::HDR);
+  for (int i = 0; i < CAPTURE_RING_SIZE; i++) {
+    CaptureSlot *slot = &cap->slots[i];
+    glGenBuffers(1, &slot->pbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, max_size, NULL, GL_STREAM_READ);
+    slot->fence = 0;
+    slot->pending = false;
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  for (int i = 0; i < CAPTURE_MAX_JOBS; i++) {
+    CaptureJob *job = &cap->jobs[i];
+    job->task = enkiCreateTaskSet(ts, encode_task);
+    job->pixels = NULL;
+    job->size = 0;
+  }
+}
+
+// Copies a finished readback out of its PBO and kicks off the encoder. Returns
+// false if the GPU or the next encoder job isn't done yet and we're not waiting.
+static bool collect_slot(FrameCapture *cap, CaptureSlot *slot, bool wait) {
+  CaptureJob *job = &cap->jobs[cap->next_job];
+  if (!wait && !enkiIsTaskSetComplete(cap->ts, job->task)) {
+    return false;
+  }
+  GLenum status = glClientWaitSync(slot->fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000ull : 0);
+  if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED) {
+    if (!wait) {
+      return false;
+    }
+    printf("ERROR: Capture readback for frame %d timed out\n", slot->frame_index);
+  }
+  glDeleteSync(slot->fence);
+  slot->fence = 0;
+  slot->pending = false;
+
+  // Only blocks when waiting and all the jobs are still encoding
+  cap->next_job = (cap->next_job + 1) % CAPTURE_MAX_JOBS;
+  enkiWaitForTaskSet(cap->ts, job->task);
+
+  uint32_t size = cap->w * cap->h * bytes_per_pixel(slot->format);
+  if (job->size != size) {
+    job->pixels = (uint8_t *) realloc(job->pixels, size);
+    job->size = size;
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+  void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+  if (mapped) {
+    memcpy(job->pixels, mapped, size);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  job->w = cap->w;
+  job->h = cap->h;
+  job->frame_index = slot->frame_index;
+  job->format = slot->format;
+  job->prefix = cap->prefix;
+  enkiAddTaskSetToPipe(cap->ts, job->task, job, 1);
+  return true;
+}
+
+void capture_resize(FrameCapture *cap, int w, int h) {
+  for (int i = 0; i < CAPTURE_RING_SIZE; i++) {
+    CaptureSlot *slot = &cap->slots[(cap->next_slot + i) % CAPTURE_RING_SIZE];
+    if (slot->pending) {
+      collect_slot(cap, slot, true);
+    }
+  }
+  cap->w = w;
+  cap->h = h;
+  uint32_t max_size = w * h * bytes_per_pixel(CaptureFormat::HDR);
+  for (int i = 0; i < CAPTURE_RING_SIZE; i++) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, cap->slots[i].pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, max_size, NULL, GL_STREAM_READ);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void capture_begin(FrameCapture *cap, CaptureFormat format) {
+  cap->format = format;
+  cap->frame_index = 0;
+  cap->is_recording = true;
+  if (format == CaptureFormat::RAW) {
+    // Truncate, the encoder tasks open it for update
+    char path[512];
+    raw_path(path, sizeof(path), cap->prefix);
+    FILE *f = fopen(path, "wb");
+    if (f) {
+      fclose(f);
+    }
+  }
+  printf("Capture started\n");
+}
+
+void capture_frame(FrameCapture *cap, uint32_t fbo, uint32_t attachment) {
+  if (!cap->is_recording) {
+    return;
+  }
+  CaptureSlot *slot = &cap->slots[cap->next_slot];
+  if (slot->pending) {
+    // The GPU is a full ring behind, we have no choice but to wait
+    collect_slot(cap, slot, true);
+  }
+
+  bool is_float = cap->format == CaptureFormat::HDR;
+  gl_bind_framebuffer(GL_READ_FRAMEBUFFER, fbo);
+  if (fbo != 0) {
+    glReadBuffer(attachment);
+  }
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+  glReadPixels(0, 0, cap->w, cap->h, GL_RGB, is_float ? GL_FLOAT : GL_UNSIGNED_BYTE, 0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  gl_bind_framebuffer(GL_READ_FRAMEBUFFER, 0);
+
+  slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  slot->frame_index = cap->frame_index++;
+  slot->format = cap->format;
+  slot->pending = true;
+  cap->next_slot = (cap->next_slot + 1) % CAPTURE_RING_SIZE;
+}
+
+void capture_poll(FrameCapture *cap) {
+  // next_slot is the oldest readback, go in order so frames are handed out in sequence
+  for (int i = 0; i < CAPTURE_RING_SIZE; i++) {
+    CaptureSlot *slot = &cap->slots[(cap->next_slot + i) % CAPTURE_RING_SIZE];
+    if (slot->pending && !collect_slot(cap, slot, false)) {
+      break;
+    }
+  }
+}
+
+void capture_end(FrameCapture *cap) {
+  for (int i = 0; i < CAPTURE_RING_SIZE; i++) {
+    CaptureSlot *slot = &cap->slots[(cap->next_slot + i) % CAPTURE_RING_SIZE];
+    if (slot->pending) {
+      collect_slot(cap, slot, true);
+    }
+  }
+  for (int i = 0; i < CAPTURE_MAX_JOBS; i++) {
+    enkiWaitForTaskSet(cap->ts, cap->jobs[i].task);
+  }
+  cap->is_recording = false;
+  printf("Capture finished, wrote %d frames\n", cap->frame_index);
+}
+
+void capture_shutdown(FrameCapture *cap) {
+  if (cap->is_recording) {
+    capture_end(cap);
+  }
+  for (int i = 0; i < CAPTURE_RING_SIZE; i++) {
+    glDeleteBuffers(1, &cap->slots[i].pbo);
+  }
+  for (int i = 0; i < CAPTURE_MAX_JOBS; i++) {
+    enkiDeleteTaskSet(cap->jobs[i].task);
+    free(cap->jobs[i].pixels);
+  }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include <glad/glad.h>
+#include <TaskScheduler_c.h>
+
+// Number of PBOs in flight. Readbacks are only mapped once their fence has
+// signalled, so the GPU can be this many frames ahead before we ever block.
+#define CAPTURE_RING_SIZE 3
+// Number of frames that can be encoding on the worker threads at once
+#define CAPTURE_MAX_JOBS 8
+
+enum class CaptureFormat {
+  PNG, // 8-bit RGB, one file per frame. Used for tex_color_buf.
+  HDR, // 32-bit float RGB, one Radiance file per frame. Used for G-buffer attachments.
+  RAW  // 8-bit RGB frames written into one file, e.g. for ffmpeg -f rawvideo
+};
+
+struct CaptureSlot {
+  uint32_t pbo;
+  GLsync fence;
+  uint32_t frame_index;
+  CaptureFormat format;
+  bool pending;
+};
+
+struct CaptureJob {
+  enkiTaskSet *task;
+  uint8_t *pixels;
+  uint32_t size;
+  int w;
+  int h;
+  uint32_t frame_index;
+  CaptureFormat format;
+  const char *prefix;
+};
+
+struct FrameCapture {
+  enkiTaskScheduler *ts;
+  int w;
+  int h;
+  const char *prefix;
+  bool is_recording;
+  CaptureFormat format;
+  uint32_t next_slot;
+  uint32_t next_job;
+  uint32_t frame_index;
+  CaptureSlot slots[CAPTURE_RING_SIZE];
+  CaptureJob jobs[CAPTURE_MAX_JOBS];
+};
+
+void capture_init(FrameCapture *cap, enkiTaskScheduler *ts, int w, int h, const char *prefix);
+// Finishes any readbacks in flight at the old size and resizes the PBOs
+void capture_resize(FrameCapture *cap, int w, int h);
+void capture_begin(FrameCapture *cap, CaptureFormat format);
+void capture_end(FrameCapture *cap);
+// Issue an asynchronous readback of an FBO colour attachment into the next PBO
+void capture_frame(FrameCapture *cap, uint32_t fbo, uint32_t attachment);
+// Hand any finished readbacks over to the encoder tasks, never blocks. Readbacks
+// stay in their PBOs while every encoder job is busy.
+void capture_poll(FrameCapture *cap);
+void capture_shutdown(FrameCapture *cap);
@@ -0,0 +1,215 @@
+#include "cull.h"
+#include <math.h>
+#include <algorithm>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+// How many instances ahead aabb_transform_indexed prefetches the world matrix
+#define AABB_PREFETCH_AHEAD 4
+
+enum CullResult {
+  CULL_OUTSIDE,
+  CULL_INTERSECTS,
+  CULL_INSIDE
+};
+
+// Gribb/Hartmann: each plane is the last row of the clip matrix plus or minus one of the others
+Frustum frustum_from_matrix(Mat4 *view_proj) {
+  __m128 r0 = _mm_loadu_ps(view_proj->e[0]);
+  __m128 r1 = _mm_loadu_ps(view_proj->e[1]);
+  __m128 r2 = _mm_loadu_ps(view_proj->e[2]);
+  __m128 r3 = _mm_loadu_ps(view_proj->e[3]);
+  __m128 p[8] = {
+    _mm_add_ps(r3, r0), _mm_sub_ps(r3, r0),
+    _mm_add_ps(r3, r1), _mm_sub_ps(r3, r1),
+    _mm_add_ps(r3, r2), _mm_sub_ps(r3, r2),
+  };
+  // The last two lanes repeat the far plane
+  p[6] = p[5];
+  p[7] = p[5];
+  // Four planes to a column layout at a time, then divided by the normals' lengths
+  Frustum result;
+  for (int i = 0; i < 8; i += 4) {
+    _MM_TRANSPOSE4_PS(p[i], p[i+1], p[i+2], p[i+3]);
+    __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(p[i], p[i]), _mm_mul_ps(p[i+1], p[i+1])), _mm_mul_ps(p[i+2], p[i+2])));
+    __m128 inv_len = _mm_div_ps(_mm_set1_ps(1.0f), len);
+    _mm_store_ps(result.nx + i, _mm_mul_ps(p[i], inv_len));
+    _mm_store_ps(result.ny + i, _mm_mul_ps(p[i+1], inv_len));
+    _mm_store_ps(result.nz + i, _mm_mul_ps(p[i+2], inv_len));
+    _mm_store_ps(result.d + i, _mm_mul_ps(p[i+3], inv_len));
+  }
+  return result;
+}
+
+// Arvo's method: the centre goes through the full matrix, the extents through |M|.
+// Transposed, the rows are the columns the box's coordinates scale.
+static inline void transform_box(const Bounds *bounds, const Mat4 *world, __m128 *lo, __m128 *hi) {
+  __m128 c0 = _mm_loadu_ps(world->e[0]);
+  __m128 c1 = _mm_loadu_ps(world->e[1]);
+  __m128 c2 = _mm_loadu_ps(world->e[2]);
+  __m128 c3 = _mm_loadu_ps(world->e[3]);
+  _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+  const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  const __m128 half = _mm_set1_ps(0.5f);
+  // The 4th lanes are the next field of Bounds, they only reach the 4th lanes of lo and hi
+  __m128 bmin = _mm_loadu_ps(bounds->min.e);
+  __m128 bmax = _mm_loadu_ps(bounds->max.e);
+  __m128 c = _mm_mul_ps(half, _mm_add_ps(bmin, bmax));
+  __m128 e = _mm_mul_ps(half, _mm_sub_ps(bmax, bmin));
+  __m128 wc = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_shuffle_ps(c, c, 0x00)), _mm_mul_ps(c1, _mm_shuffle_ps(c, c, 0x55))),
+                         _mm_add_ps(_mm_mul_ps(c2, _mm_shuffle_ps(c, c, 0xaa)), c3));
+  __m128 we = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_and_ps(c0, abs_mask), _mm_shuffle_ps(e, e, 0x00)),
+                                    _mm_mul_ps(_mm_and_ps(c1, abs_mask), _mm_shuffle_ps(e, e, 0x55))),
+                         _mm_mul_ps(_mm_and_ps(c2, abs_mask), _mm_shuffle_ps(e, e, 0xaa)));
+  *lo = _mm_sub_ps(wc, we);
+  *hi = _mm_add_ps(wc, we);
+}
+
+Aabb aabb_transform(Bounds *bounds, Mat4 *world) {
+  __m128 lo, hi;
+  transform_box(bounds, world, &lo, &hi);
+  alignas(16) float l[4];
+  alignas(16) float h[4];
+  _mm_store_ps(l, lo);
+  _mm_store_ps(h, hi);
+  return { rwm_v3_init(l[0], l[1], l[2]), rwm_v3_init(h[0], h[1], h[2]) };
+}
+
+void aabb_transform_indexed(const Bounds *bounds, const Mat4 *world, const uint32_t *world_index, Aabb *out,
+                            const uint32_t *indices, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    if (i + AABB_PREFETCH_AHEAD < count) {
+      _mm_prefetch((const char *) &world[world_index[indices[i + AABB_PREFETCH_AHEAD]]], _MM_HINT_T0);
+    }
+    uint32_t j = indices[i];
+    __m128 lo, hi;
+    transform_box(&bounds[j], &world[world_index[j]], &lo, &hi);
+    // An Aabb is 6 packed floats: min.xyz and max.x in one store, max.yz in another
+    __m128 t = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(0, 0, 2, 2));
+    _mm_storeu_ps(out[j].min.e, _mm_shuffle_ps(lo, t, _MM_SHUFFLE(2, 0, 1, 0)));
+    _mm_storel_pi((__m64 *) &out[j].max.y, _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(3, 3, 2, 1)));
+  }
+}
+
+static CullResult test_aabb(Frustum *f, Aabb *box) {
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  __m128 cx = _mm_set1_ps(0.5f * (box->min.x + box->max.x));
+  __m128 cy = _mm_set1_ps(0.5f * (box->min.y + box->max.y));
+  __m128 cz = _mm_set1_ps(0.5f * (box->min.z + box->max.z));
+  __m128 ex = _mm_mul_ps(half, _mm_set1_ps(box->max.x - box->min.x));
+  __m128 ey = _mm_mul_ps(half, _mm_set1_ps(box->max.y - box->min.y));
+  __m128 ez = _mm_mul_ps(half, _mm_set1_ps(box->max.z - box->min.z));
+
+  int outside = 0;
+  int inside = 0xff;
+  for (int i = 0; i < 8; i += 4) {
+    __m128 nx = _mm_load_ps(f->nx + i);
+    __m128 ny = _mm_load_ps(f->ny + i);
+    __m128 nz = _mm_load_ps(f->nz + i);
+    __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)),
+                             _mm_add_ps(_mm_mul_ps(nz, cz), _mm_load_ps(f->d + i)));
+    __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_and_ps(nx, abs_mask), ex), _mm_mul_ps(_mm_and_ps(ny, abs_mask), ey)),
+                               _mm_mul_ps(_mm_and_ps(nz, abs_mask), ez));
+    outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(dist, radius), _mm_setzero_ps())) << i;
+    inside &= ~(_mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(dist, radius), _mm_setzero_ps())) << i);
+  }
+  if (outside) {
+    return CULL_OUTSIDE;
+  }
+  return inside == 0xff ? CULL_INSIDE : CULL_INTERSECTS;
+}
+
+static Aabb merge(Aabb a, Aabb b) {
+  Aabb result;
+  for (int k = 0; k < 3; k++) {
+    result.min.e[k] = a.min.e[k] < b.min.e[k] ? a.min.e[k] : b.min.e[k];
+    result.max.e[k] = a.max.e[k] > b.max.e[k] ? a.max.e[k] : b.max.e[k];
+  }
+  return result;
+}
+
+// Median split on the longest axis of the centroids. Children are allocated as a
+// pair so the right child is always left + 1.
+static void build_node(InstanceBvh *bvh, uint32_t node_idx, uint32_t first, uint32_t count) {
+  Aabb box = bvh->boxes[bvh->order[first]];
+  Aabb centroids = { 0.5f * (box.min + box.max), 0.5f * (box.min + box.max) };
+  for (uint32_t i = 1; i < count; i++) {
+    Aabb &b = bvh->boxes[bvh->order[first + i]];
+    Vec3 c = 0.5f * (b.min + b.max);
+    box = merge(box, b);
+    centroids = merge(centroids, { c, c });
+  }
+  BvhNode &node = bvh->nodes[node_idx];
+  node.box = box;
+  node.first = first;
+  node.count = count;
+  node.left = 0;
+  if (count <= BVH_LEAF_SIZE) {
+    return;
+  }
+
+  Vec3 size = centroids.max - centroids.min;
+  int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+  uint32_t half = count / 2;
+  uint32_t *begin = bvh->order.data() + first;
+  std::vector<Aabb> &boxes = bvh->boxes;
+  std::nth_element(begin, begin + half, begin + count, [&](uint32_t a, uint32_t b) {
+    return boxes[a].min.e[axis] + boxes[a].max.e[axis] < boxes[b].min.e[axis] + boxes[b].max.e[axis];
+  });
+
+  uint32_t left = (uint32_t) bvh->nodes.size();
+  bvh->nodes.push_back({});
+  bvh->nodes.push_back({});
+  // push_back may have moved the nodes, don't use the reference from above
+  bvh->nodes[node_idx].left = left;
+  build_node(bvh, left, first, half);
+  build_node(bvh, left + 1, first + half, count - half);
+}
+
+void bvh_build(InstanceBvh *bvh, const Aabb *boxes, uint32_t count) {
+  bvh->boxes.assign(boxes, boxes + count);
+  bvh->order.resize(count);
+  for (uint32_t i = 0; i < count; i++) {
+    bvh->order[i] = i;
+  }
+  bvh->nodes.clear();
+  if (count == 0) {
+    return;
+  }
+  bvh->nodes.reserve(2 * (count / BVH_LEAF_SIZE + 1));
+  bvh->nodes.push_back({});
+  build_node(bvh, 0, 0, count);
+}
+
+uint32_t bvh_cull(InstanceBvh *bvh, Frustum *frustum, std::vector<uint32_t> &visible) {
+  if (bvh->nodes.empty()) {
+    return 0;
+  }
+  size_t start_size = visible.size();
+  // Median splits keep the depth at log2(n / BVH_LEAF_SIZE), 64 is plenty
+  uint32_t stack[64];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    BvhNode &node = bvh->nodes[stack[--top]];
+    CullResult result = test_aabb(frustum, &node.box);
+    if (result == CULL_OUTSIDE) {
+      continue;
+    }
+    if (result == CULL_INSIDE) {
+      visible.insert(visible.end(), bvh->order.begin() + node.first, bvh->order.begin() + node.first + node.count);
+    } else if (node.left == 0) {
+      for (uint32_t i = node.first; i < node.first + node.count; i++) {
+        uint32_t inst = bvh->order[i];
+        if (test_aabb(frustum, &bvh->boxes[inst]) != CULL_OUTSIDE) {
+          visible.push_back(inst);
+        }
+      }
+    } else {
+      stack[top++] = node.left;
+      stack[top++] = node.left + 1;
+    }
+  }
+  return (uint32_t) (visible.size() - start_size);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <rw_math.h>
+#include "mesh.h"
+
+// Instances per BVH leaf
+#define BVH_LEAF_SIZE 4
+
+struct Aabb {
+  Vec3 min;
+  Vec3 max;
+};
+
+// The six planes stored as columns so four planes are tested per SSE op. The
+// last two lanes repeat the far plane so the padding can never reject anything new.
+// A point p is inside a plane when nx*p.x + ny*p.y + nz*p.z + d >= 0.
+struct Frustum {
+  alignas(16) float nx[8];
+  alignas(16) float ny[8];
+  alignas(16) float nz[8];
+  alignas(16) float d[8];
+};
+
+// Every subtree covers a contiguous range of InstanceBvh::order, so a node that's
+// entirely inside the frustum can be accepted without visiting its children
+struct BvhNode {
+  Aabb box;
+  // Index of the left child, the right child follows it. Zero for leaves.
+  uint32_t left;
+  uint32_t first;
+  uint32_t count;
+};
+
+struct InstanceBvh {
+  std::vector<BvhNode> nodes;
+  // Instance indices, reordered so every leaf is a contiguous range
+  std::vector<uint32_t> order;
+  std::vector<Aabb> boxes;
+};
+
+// view_proj is persp_mat * view_mat (row-major, clip = view_proj * p)
+Frustum frustum_from_matrix(Mat4 *view_proj);
+// Object space bounds into a world space box that encloses them
+Aabb aabb_transform(Bounds *bounds, Mat4 *world);
+// out[j] = aabb_transform(bounds[j], world[world_index[j]]) for each j in indices
+void aabb_transform_indexed(const Bounds *bounds, const Mat4 *world, const uint32_t *world_index, Aabb *out,
+                            const uint32_t *indices, uint32_t count);
+
+void bvh_build(InstanceBvh *bvh, const Aabb *boxes, uint32_t count);
+// Appends the indices of every instance whose box touches the frustum. Returns the number appended.
+uint32_t bvh_cull(InstanceBvh *bvh, Frustum *frustum, std::vector<uint32_t> &visible);
@@ -0,0 +1,51 @@
+#include "dynamic_resolution.h"
+#include <math.h>
+#include "bench.h"
+
+void dynres_init(DynamicResolution *dr, float budget_ms) {
+  dr->enabled = budget_ms > 0.0f;
+  dr->budget_ms = budget_ms;
+  dr->scale = DYNRES_MAX_SCALE;
+  dr->gpu_ms = 0.0f;
+  dr->cooldown = 0;
+}
+
+void dynres_update(DynamicResolution *dr, float gpu_ms) {
+  if (!dr->enabled || gpu_ms <= 0.0f) {
+    return;
+  }
+  if (dr->gpu_ms == 0.0f) {
+    dr->gpu_ms = gpu_ms;
+  } else {
+    float rate = gpu_ms > dr->gpu_ms ? 0.5f : 0.1f;
+    dr->gpu_ms += rate * (gpu_ms - dr->gpu_ms);
+  }
+  if (dr->cooldown > 0) {
+    dr->cooldown--;
+    return;
+  }
+
+  float target = dr->scale * sqrtf(DYNRES_HEADROOM * dr->budget_ms / dr->gpu_ms);
+  // Dead band so the resolution doesn't wobble around the budget
+  if (fabsf(target - dr->scale) < 0.02f) {
+    return;
+  }
+  // Down as far as it takes, up a step at a time
+  if (target > dr->scale + 0.05f) {
+    target = dr->scale + 0.05f;
+  }
+  target = target < DYNRES_MIN_SCALE ? DYNRES_MIN_SCALE : target;
+  target = target > DYNRES_MAX_SCALE ? DYNRES_MAX_SCALE : target;
+  if (target != dr->scale) {
+    dr->scale = target;
+    dr->cooldown = BENCH_QUERY_LATENCY + 1;
+  }
+}
+
+void dynres_size(DynamicResolution *dr, int max_w, int max_h, int *w, int *h) {
+  float scale = dr->enabled ? dr->scale : 1.0f;
+  *w = (int) (max_w * scale + 0.5f);
+  *h = (int) (max_h * scale + 0.5f);
+  *w = *w < 1 ? 1 : (*w > max_w ? max_w : *w);
+  *h = *h < 1 ? 1 : (*h > max_h ? max_h : *h);
+}
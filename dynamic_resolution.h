@@ -0,0 +1,23 @@
+#pragma once
+
+#define DYNRES_MIN_SCALE 0.5f
+#define DYNRES_MAX_SCALE 1.0f
+// Aim a bit under the budget so a small spike doesn't go over it
+#define DYNRES_HEADROOM 0.9f
+
+// Picks the fraction of the window the G-buffer, lighting and sky passes render
+// at, from the GPU frame time. Cost is taken to scale with the pixel count. The
+// timers are a few frames old, so after every change it waits for them to see it.
+struct DynamicResolution {
+  bool enabled;
+  float budget_ms;
+  float scale;
+  // Rises fast and falls slowly, so spikes are acted on at once
+  float gpu_ms;
+  int cooldown;
+};
+
+void dynres_init(DynamicResolution *dr, float budget_ms);
+void dynres_update(DynamicResolution *dr, float gpu_ms);
+// Render size for a max_w x max_h target, at least 1x1
+void dynres_size(DynamicResolution *dr, int max_w, int max_h, int *w, int *h);
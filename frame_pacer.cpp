@@ -0,0 +1,58 @@
+#include "frame_pacer.h"
+#include <stdio.h>
+#include <SDL.h>
+
+// Time left to the deadline below which we stop sleeping and spin instead.
+// NOTE(ray): SDL asks for a 1ms timer resolution on Windows, but SDL_Delay can still
+// overshoot by about that much.
+#define PACER_SPIN_MS 2.0
+
+void pacer_init(FramePacer *pacer, PacingMode mode, float target_fps) {
+  pacer->mode = mode;
+  pacer->target_ms = target_fps > 0.0f ? 1000.0 / target_fps : 0.0;
+  pacer->freq = SDL_GetPerformanceFrequency();
+  pacer->next_deadline = 0;
+
+  switch (mode) {
+    case PacingMode::UNCAPPED:
+    case PacingMode::LIMIT:
+      SDL_GL_SetSwapInterval(0);
+      break;
+    case PacingMode::VSYNC:
+      SDL_GL_SetSwapInterval(1);
+      break;
+    case PacingMode::ADAPTIVE_VSYNC:
+      if (SDL_GL_SetSwapInterval(-1) != 0) {
+        puts("Adaptive vsync not supported, falling back to vsync");
+        SDL_GL_SetSwapInterval(1);
+        pacer->mode = PacingMode::VSYNC;
+      }
+      break;
+  }
+}
+
+void pacer_wait(FramePacer *pacer) {
+  if (pacer->mode != PacingMode::LIMIT || pacer->target_ms <= 0.0) {
+    return;
+  }
+  uint64_t period = (uint64_t) (pacer->target_ms * pacer->freq / 1000.0);
+  uint64_t now = SDL_GetPerformanceCounter();
+  if (pacer->next_deadline == 0 || now > pacer->next_deadline + period) {
+    // First frame, or we fell more than a frame behind. Don't try to catch up with a burst.
+    pacer->next_deadline = now + period;
+    return;
+  }
+
+  for (;;) {
+    now = SDL_GetPerformanceCounter();
+    if (now >= pacer->next_deadline) {
+      break;
+    }
+    double remaining_ms = (double) (pacer->next_deadline - now) * 1000.0 / pacer->freq;
+    if (remaining_ms > PACER_SPIN_MS) {
+      SDL_Delay((uint32_t) (remaining_ms - PACER_SPIN_MS));
+    }
+  }
+  // Step from the deadline rather than from now so the error doesn't accumulate
+  pacer->next_deadline += period;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+enum class PacingMode {
+  UNCAPPED,       // Swap as fast as possible
+  LIMIT,          // Sleep then spin until the next frame deadline
+  VSYNC,          // Let the swap block on the display
+  ADAPTIVE_VSYNC  // Late swaps tear instead of waiting a whole extra refresh
+};
+
+struct FramePacer {
+  PacingMode mode;
+  double target_ms;
+  uint64_t freq;
+  uint64_t next_deadline;
+};
+
+void pacer_init(FramePacer *pacer, PacingMode mode, float target_fps);
+// Call right before SDL_GL_SwapWindow. Only does anything in LIMIT mode.
+void pacer_wait(FramePacer *pacer);
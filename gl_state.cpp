@@ -0,0 +1,188 @@
+#include "gl_state.h"
+#include <glad/glad.h>
+#include "bench.h"
+
+#define UNKNOWN 0xffffffffu
+
+GlState g_gl_state;
+
+static int texture_target_slot(uint32_t target) {
+  switch (target) {
+    case GL_TEXTURE_2D: return 0;
+    case GL_TEXTURE_CUBE_MAP: return 1;
+    case GL_TEXTURE_2D_ARRAY: return 2;
+    default: return -1;
+  }
+}
+
+static int cap_slot(uint32_t cap) {
+  switch (cap) {
+    case GL_DEPTH_TEST: return 0;
+    case GL_STENCIL_TEST: return 1;
+    case GL_BLEND: return 2;
+    case GL_CULL_FACE: return 3;
+    default: return -1;
+  }
+}
+
+// True if the call has to go to GL. Every tracked call is counted either way.
+static bool changed(uint32_t &cached, uint32_t value) {
+  g_render_stats.state_calls++;
+  if (cached == value) {
+    g_render_stats.state_calls_dropped++;
+    return false;
+  }
+  cached = value;
+  return true;
+}
+
+void gl_state_invalidate() {
+  GlState &s = g_gl_state;
+  s.program = UNKNOWN;
+  s.vao = UNKNOWN;
+  s.read_fbo = UNKNOWN;
+  s.draw_fbo = UNKNOWN;
+  s.active_unit = UNKNOWN;
+  for (int u = 0; u < GL_STATE_MAX_UNITS; u++) {
+    for (int t = 0; t < 3; t++) {
+      s.textures[u][t] = UNKNOWN;
+    }
+  }
+  for (int c = 0; c < 4; c++) {
+    s.caps[c] = 2;
+  }
+  s.depth_func = UNKNOWN;
+  s.depth_mask = UNKNOWN;
+  s.polygon_mode = UNKNOWN;
+}
+
+void gl_use_program(uint32_t program) {
+  if (changed(g_gl_state.program, program)) {
+    glUseProgram(program);
+  }
+}
+
+void gl_bind_vertex_array(uint32_t vao) {
+  if (changed(g_gl_state.vao, vao)) {
+    glBindVertexArray(vao);
+  }
+}
+
+void gl_bind_framebuffer(uint32_t target, uint32_t fbo) {
+  GlState &s = g_gl_state;
+  if (target == GL_FRAMEBUFFER) {
+    g_render_stats.state_calls++;
+    if (s.read_fbo == fbo && s.draw_fbo == fbo) {
+      g_render_stats.state_calls_dropped++;
+      return;
+    }
+    s.read_fbo = fbo;
+    s.draw_fbo = fbo;
+    glBindFramebuffer(target, fbo);
+  } else if (changed(target == GL_READ_FRAMEBUFFER ? s.read_fbo : s.draw_fbo, fbo)) {
+    glBindFramebuffer(target, fbo);
+  }
+}
+
+void gl_active_texture(uint32_t unit) {
+  if (changed(g_gl_state.active_unit, unit)) {
+    glActiveTexture(unit);
+  }
+}
+
+void gl_bind_texture(uint32_t target, uint32_t tid) {
+  GlState &s = g_gl_state;
+  uint32_t unit = s.active_unit - GL_TEXTURE0;
+  int slot = texture_target_slot(target);
+  if (s.active_unit == UNKNOWN || unit >= GL_STATE_MAX_UNITS || slot < 0) {
+    glBindTexture(target, tid);
+  } else if (changed(s.textures[unit][slot], tid)) {
+    glBindTexture(target, tid);
+  }
+}
+
+static void set_cap(uint32_t cap, bool on) {
+  int slot = cap_slot(cap);
+  if (slot >= 0) {
+    g_render_stats.state_calls++;
+    if (g_gl_state.caps[slot] == (on ? 1 : 0)) {
+      g_render_stats.state_calls_dropped++;
+      return;
+    }
+    g_gl_state.caps[slot] = on ? 1 : 0;
+  }
+  if (on) {
+    glEnable(cap);
+  } else {
+    glDisable(cap);
+  }
+}
+
+void gl_enable(uint32_t cap) {
+  set_cap(cap, true);
+}
+
+void gl_disable(uint32_t cap) {
+  set_cap(cap, false);
+}
+
+void gl_depth_func(uint32_t func) {
+  if (changed(g_gl_state.depth_func, func)) {
+    glDepthFunc(func);
+  }
+}
+
+void gl_depth_mask(bool write) {
+  if (changed(g_gl_state.depth_mask, write ? 1 : 0)) {
+    glDepthMask(write ? GL_TRUE : GL_FALSE);
+  }
+}
+
+void gl_polygon_mode(uint32_t mode) {
+  if (changed(g_gl_state.polygon_mode, mode)) {
+    glPolygonMode(GL_FRONT_AND_BACK, mode);
+  }
+}
+
+void gl_delete_program(uint32_t program) {
+  if (g_gl_state.program == program) {
+    g_gl_state.program = UNKNOWN;
+  }
+  glDeleteProgram(program);
+}
+
+void gl_delete_vertex_arrays(int n, const uint32_t *vaos) {
+  for (int i = 0; i < n; i++) {
+    if (g_gl_state.vao == vaos[i]) {
+      g_gl_state.vao = UNKNOWN;
+    }
+  }
+  glDeleteVertexArrays(n, vaos);
+}
+
+void gl_delete_framebuffers(int n, const uint32_t *fbos) {
+  GlState &s = g_gl_state;
+  for (int i = 0; i < n; i++) {
+    if (s.read_fbo == fbos[i]) {
+      s.read_fbo = UNKNOWN;
+    }
+    if (s.draw_fbo == fbos[i]) {
+      s.draw_fbo = UNKNOWN;
+    }
+  }
+  glDeleteFramebuffers(n, fbos);
+}
+
+void gl_delete_textures(int n, const uint32_t *tids) {
+  GlState &s = g_gl_state;
+  for (int i = 0; i < n; i++) {
+    for (int u = 0; u < GL_STATE_MAX_UNITS; u++) {
+      for (int t = 0; t < 3; t++) {
+        if (s.textures[u][t] == tids[i]) {
+          s.textures[u][t] = UNKNOWN;
+        }
+      }
+    }
+  }
+  glDeleteTextures(n, tids);
+}
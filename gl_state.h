@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+
+#define GL_STATE_MAX_UNITS 16
+
+// Last value given to GL for the state the frame loop keeps setting. Every
+// tracked bind/enable goes through here, so a call that wouldn't change
+// anything is dropped. State that isn't tracked (buffers, image units, blend
+// functions, ...) is set with plain GL calls as before.
+// Draws leave their vao bound so the next draw of the same vao costs nothing.
+// Anything binding GL_ELEMENT_ARRAY_BUFFER has to bind its own vao first.
+struct GlState {
+  uint32_t program;
+  uint32_t vao;
+  uint32_t read_fbo;
+  uint32_t draw_fbo;
+  uint32_t active_unit;
+  // Per unit, indexed by texture_target_slot()
+  uint32_t textures[GL_STATE_MAX_UNITS][3];
+  // Indexed by cap_slot(), 0 off, 1 on, 2 unknown
+  uint8_t caps[4];
+  uint32_t depth_func;
+  uint32_t depth_mask;
+  uint32_t polygon_mode;
+};
+
+extern GlState g_gl_state;
+
+// Forgets everything, the next call of each kind goes to GL
+void gl_state_invalidate();
+
+void gl_use_program(uint32_t program);
+void gl_bind_vertex_array(uint32_t vao);
+// GL_FRAMEBUFFER binds both the read and draw framebuffer like glBindFramebuffer
+void gl_bind_framebuffer(uint32_t target, uint32_t fbo);
+void gl_active_texture(uint32_t unit);
+// Binds to the active unit. Targets other than 2D, cube map and 2D array aren't cached.
+void gl_bind_texture(uint32_t target, uint32_t tid);
+// Only depth test, stencil test, blend and cull face are cached
+void gl_enable(uint32_t cap);
+void gl_disable(uint32_t cap);
+void gl_depth_func(uint32_t func);
+void gl_depth_mask(bool write);
+// Always GL_FRONT_AND_BACK, the only face core profile takes
+void gl_polygon_mode(uint32_t mode);
+
+// Deleting a bound object unbinds it in GL, these keep the cache in sync
+void gl_delete_program(uint32_t program);
+void gl_delete_vertex_arrays(int n, const uint32_t *vaos);
+void gl_delete_framebuffers(int n, const uint32_t *fbos);
+void gl_delete_textures(int n, const uint32_t *tids);
@@ -0,0 +1,132 @@
+#include "gpu_scene.h"
+#include <math.h>
+#include <string.h>
+#include <glad/glad.h>
+#include "bench.h"
+#include "gl_state.h"
+#include "simd_math.h"
+
+struct QueueArgs {
+  GpuScene *gs;
+  const uint32_t *instances;
+  uint32_t program;
+  Vec3 cam_pos;
+  float inv_far_z;
+};
+
+void gpu_scene_build(GpuScene *gs, Scene *scene, AssetCache *cache, OcclusionCuller *oc) {
+  uint32_t num_draws = (uint32_t) scene->instances.size();
+  gs->vao = cache->arena.vao;
+  gs->draw_commands.resize(num_draws);
+  gs->draw_materials.resize(num_draws);
+  for (uint32_t draw = 0; draw < num_draws; draw++) {
+    SceneInstance &inst = scene->instances[draw];
+    GpuMesh &m = cache->meshes[inst.mesh];
+    gs->draw_commands[draw] = { m.count, 1, m.first, (uint32_t) m.base_vertex, draw };
+    gs->draw_materials[draw] = inst.material;
+  }
+  gs->draw_data.resize(num_draws);
+  gs->draw_boxes.resize(num_draws);
+  gs->frame_commands.reserve(num_draws);
+  gs->visible_indices = 0;
+  gs->needs_upload = false;
+  occlusion_set_num_draws(oc, num_draws);
+
+  gs->frame_draw_data = {};
+
+  std::vector<uint32_t> ids(num_draws);
+  for (uint32_t i = 0; i < num_draws; i++) {
+    ids[i] = i;
+  }
+  gl_bind_vertex_array(gs->vao);
+  glGenBuffers(1, &gs->draw_id_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, gs->draw_id_vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(uint32_t) * num_draws, ids.data(), GL_STATIC_DRAW);
+  glEnableVertexAttribArray(GPU_SCENE_DRAW_ID_LOCATION);
+  glVertexAttribIPointer(GPU_SCENE_DRAW_ID_LOCATION, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (void*)0);
+  glVertexAttribDivisor(GPU_SCENE_DRAW_ID_LOCATION, 1);
+  gl_bind_vertex_array(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void gpu_scene_update(GpuScene *gs, Scene *scene, const Aabb *instance_boxes, const uint32_t *changed, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t draw = changed[i];
+    SceneInstance &inst = scene->instances[draw];
+    Mat4 &world = scene->graph.world[inst.node];
+    DrawData &d = gs->draw_data[draw];
+    d.model = world;
+    // Once per transform change here instead of an inverse per vertex
+    mat4_normal_matrix_simd(&world, d.normal);
+    d.material = inst.material;
+    gs->draw_boxes[draw] = instance_boxes[draw];
+  }
+  gs->needs_upload = true;
+}
+
+void gpu_scene_upload(GpuScene *gs, OcclusionCuller *oc) {
+  if (!gs->needs_upload) {
+    return;
+  }
+  occlusion_set_bounds(oc, gs->draw_boxes.data(), (uint32_t) gs->draw_boxes.size());
+  gs->needs_upload = false;
+}
+
+void gpu_scene_write_draws(GpuScene *gs, RingBuffer *rb) {
+  uint32_t size = (uint32_t) (sizeof(DrawData) * gs->draw_data.size());
+  gs->frame_draw_data = ring_buffer_alloc(rb, size);
+  if (gs->frame_draw_data.ptr) {
+    memcpy(gs->frame_draw_data.ptr, gs->draw_data.data(), size);
+  }
+}
+
+static void generate_packets(uint32_t start, uint32_t end, void *args, std::vector<DrawPacket> &out) {
+  QueueArgs *qa = (QueueArgs *) args;
+  GpuScene *gs = qa->gs;
+  for (uint32_t i = start; i < end; i++) {
+    uint32_t draw = qa->instances[i];
+    Aabb &box = gs->draw_boxes[draw];
+    Vec3 d = 0.5f * (box.min + box.max) - qa->cam_pos;
+    float depth = sqrtf(rwm_v3_dot(d, d)) * qa->inv_far_z;
+    DrawPacket p = {};
+    p.key = render_key(RENDER_PASS_GEOMETRY, qa->program, gs->draw_materials[draw], gs->vao, depth);
+    p.index = draw;
+    out.push_back(p);
+  }
+}
+
+void gpu_scene_queue(GpuScene *gs, RenderQueue *q, std::vector<uint32_t> &visible_instances, uint32_t program, Vec3 cam_pos, float far_z) {
+  QueueArgs args = { gs, visible_instances.data(), program, cam_pos, 1.0f / far_z };
+  render_queue_generate(q, (uint32_t) visible_instances.size(), generate_packets, &args);
+}
+
+void gpu_scene_submit(GpuScene *gs, RenderQueue *q, OcclusionCuller *oc) {
+  gs->frame_commands.clear();
+  gs->visible_indices = 0;
+  for (DrawPacket &p : q->packets) {
+    if ((p.key >> RENDER_KEY_PASS_SHIFT) != RENDER_PASS_GEOMETRY) {
+      continue;
+    }
+    DrawCommand &cmd = gs->draw_commands[p.index];
+    gs->frame_commands.push_back(cmd);
+    gs->visible_indices += cmd.count;
+  }
+  occlusion_set_commands(oc, gs->frame_commands.data(), gs->frame_commands.size());
+}
+
+void gpu_scene_draw(GpuScene *gs, OcclusionCuller *oc) {
+  if (oc->num_commands == 0 || !gs->frame_draw_data.ptr) {
+    return;
+  }
+  gl_bind_vertex_array(gs->vao);
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, GPU_SCENE_DRAW_BINDING, gs->frame_draw_data.buffer, gs->frame_draw_data.offset, gs->frame_draw_data.size);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, oc->command_buffer);
+  glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, oc->num_commands, sizeof(DrawCommand));
+  // NOTE(ray): Counted as if they were all drawn, the CPU never finds out what the GPU culled
+  stats_count_draw(GL_TRIANGLES, gs->visible_indices);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void gpu_scene_destroy(GpuScene *gs) {
+  glDeleteBuffers(1, &gs->draw_id_vbo);
+}
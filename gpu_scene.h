@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <rw_math.h>
+#include "assets.h"
+#include "scene.h"
+#include "cull.h"
+#include "occlusion.h"
+#include "render_queue.h"
+#include "ring_buffer.h"
+
+// SSBO binding of the per-draw data, read by shaders/gpu_driven.vert
+#define GPU_SCENE_DRAW_BINDING 4
+// Vertex attribute carrying the draw id. It's instanced and every command's
+// base_instance is its draw id, so instance 0 of a command reads its draw id.
+#define GPU_SCENE_DRAW_ID_LOCATION 3
+
+// std430 layout of DrawData in shaders/gpu_driven.vert
+struct DrawData {
+  // Row-major as it is everywhere else, the shaders declare the block row_major
+  Mat4 model;
+  // Inverse transpose of the model's 3x3, see mat4_normal_matrix_simd
+  float normal[3][4];
+  uint32_t material;
+  uint32_t pad[3];
+};
+
+// Every scene instance as one draw out of the mesh arena, the draw id is the
+// instance index. Each frame the frustum survivors go through the render queue
+// and come out as the indirect commands of one glMultiDrawElementsIndirect, in
+// key order. Materials come from the MaterialTable.
+struct GpuScene {
+  uint32_t vao;
+  uint32_t draw_id_vbo;
+  // The command of every draw, instance_count set to 1
+  std::vector<DrawCommand> draw_commands;
+  std::vector<uint32_t> draw_materials;
+  std::vector<DrawData> draw_data;
+  // This frame's copy of draw_data in the ring buffer
+  RingAlloc frame_draw_data;
+  // draw_boxes changed since the last upload
+  bool needs_upload;
+  // World space boxes, their centres give the packet depth
+  std::vector<Aabb> draw_boxes;
+  // This frame's commands in submission order, and how many indices they add up to
+  std::vector<DrawCommand> frame_commands;
+  uint32_t visible_indices;
+};
+
+// Builds the draws, the scene's meshes must all be in the arena
+void gpu_scene_build(GpuScene *gs, Scene *scene, AssetCache *cache, OcclusionCuller *oc);
+// Copies the world transforms and boxes (instance order) of the instances that moved.
+// No GL calls, it runs on the frame prep workers.
+void gpu_scene_update(GpuScene *gs, Scene *scene, const Aabb *instance_boxes, const uint32_t *changed, uint32_t count);
+// Uploads the boxes gpu_scene_update changed to the culler, on the GL thread
+void gpu_scene_upload(GpuScene *gs, OcclusionCuller *oc);
+// Copies draw_data into this frame's section of the ring, any thread
+void gpu_scene_write_draws(GpuScene *gs, RingBuffer *rb);
+// Geometry pass packets for the visible instances, keyed by material and distance to cam_pos
+void gpu_scene_queue(GpuScene *gs, RenderQueue *q, std::vector<uint32_t> &visible_instances, uint32_t program, Vec3 cam_pos, float far_z);
+// Writes the sorted geometry packets as this frame's commands for the culler
+void gpu_scene_submit(GpuScene *gs, RenderQueue *q, OcclusionCuller *oc);
+// Every command in one glMultiDrawElementsIndirect, the material table has to be bound
+void gpu_scene_draw(GpuScene *gs, OcclusionCuller *oc);
+void gpu_scene_destroy(GpuScene *gs);
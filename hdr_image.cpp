@@ -0,0 +1,306 @@
+#include "hdr_image.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <emmintrin.h>
+// F16C comes with every AVX2 CPU, but only MSVC's /arch:AVX2 lets us use it without -mf16c
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define HDR_USE_F16C
+#include <immintrin.h>
+#endif
+
+struct HdrCacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t w;
+  uint32_t h;
+  // Of the .hdr the cache was made from
+  uint64_t source_size;
+  int64_t source_mtime;
+};
+
+struct HdrDecode {
+  const uint8_t *data;
+  // Start of every scanline in data, top to bottom like the file
+  std::vector<size_t> rows;
+  HdrImage *out;
+};
+
+// New style RLE scanlines start with 2, 2 and the width, anything else is flat RGBE
+static bool is_rle_scanline(const uint8_t *p, size_t left, uint32_t w) {
+  return w >= 8 && w < 32768 && left >= 4 && p[0] == 2 && p[1] == 2 && (p[2] & 0x80) == 0;
+}
+
+// Walks over a scanline without decoding it, checking it stays inside the file
+// and that its runs add up to the width
+static bool skip_scanline(const uint8_t *data, size_t size, size_t *pos, uint32_t w) {
+  size_t p = *pos;
+  if (is_rle_scanline(data + p, size - p, w)) {
+    if ((uint32_t) ((data[p+2] << 8) | data[p+3]) != w) {
+      return false;
+    }
+    p += 4;
+    for (int c = 0; c < 4; c++) {
+      uint32_t x = 0;
+      while (x < w) {
+        if (p >= size) {
+          return false;
+        }
+        uint32_t count = data[p++];
+        if (count > 128) {
+          count -= 128;
+          p += 1;
+        } else {
+          p += count;
+        }
+        x += count;
+        if (count == 0 || x > w || p > size) {
+          return false;
+        }
+      }
+    }
+  } else {
+    p += 4 * (size_t) w;
+    if (p > size) {
+      return false;
+    }
+  }
+  *pos = p;
+  return true;
+}
+
+// Scanline to interleaved RGBE, already checked by skip_scanline
+static void decode_scanline(const uint8_t *p, uint32_t w, uint8_t *rgbe) {
+  if (!is_rle_scanline(p, 4, w)) {
+    memcpy(rgbe, p, 4 * (size_t) w);
+    return;
+  }
+  p += 4;
+  for (int c = 0; c < 4; c++) {
+    uint32_t x = 0;
+    while (x < w) {
+      uint32_t count = *p++;
+      if (count > 128) {
+        count -= 128;
+        uint8_t v = *p++;
+        for (uint32_t i = 0; i < count; i++) {
+          rgbe[4 * (x + i) + c] = v;
+        }
+      } else {
+        for (uint32_t i = 0; i < count; i++) {
+          rgbe[4 * (x + i) + c] = *p++;
+        }
+      }
+      x += count;
+    }
+  }
+}
+
+// One pixel, RGBE in the 4 lanes, to 4 halves in the low 64 bits. The 4th is junk.
+static inline __m128i rgbe_to_half(__m128i p) {
+  // Same as stb_image: channel * 2^(e - 136). Exponents under 10 would need a
+  // denormal scale, anything that dark is black like e = 0 is.
+  __m128i e = _mm_shuffle_epi32(p, _MM_SHUFFLE(3, 3, 3, 3));
+  __m128i valid = _mm_cmpgt_epi32(e, _mm_set1_epi32(9));
+  __m128 scale = _mm_castsi128_ps(_mm_and_si128(_mm_slli_epi32(_mm_sub_epi32(e, _mm_set1_epi32(9)), 23), valid));
+  __m128 f = _mm_min_ps(_mm_mul_ps(_mm_cvtepi32_ps(p), scale), _mm_set1_ps(65504.0f));
+#ifdef HDR_USE_F16C
+  return _mm_cvtps_ph(f, _MM_FROUND_TO_NEAREST_INT);
+#else
+  // Rebiased by 2^-112 the float's top bits are the half, denormals included.
+  // Rounds half up, and values under the smallest half are lost with FTZ on.
+  __m128i bits = _mm_castps_si128(_mm_mul_ps(f, _mm_castsi128_ps(_mm_set1_epi32(15 << 23))));
+  bits = _mm_srli_epi32(_mm_add_epi32(bits, _mm_set1_epi32(0x1000)), 13);
+  return _mm_packs_epi32(bits, bits);
+#endif
+}
+
+static void convert_row(const uint8_t *rgbe, uint32_t w, uint16_t *out) {
+  const __m128i zero = _mm_setzero_si128();
+  // Each store's 4th half is overwritten by the next pixel's red, the row's last
+  // pixel is the only one that can't spill over
+  uint32_t x = 0;
+  for (; x + 4 < w; x += 4) {
+    __m128i px = _mm_loadu_si128((const __m128i *) (rgbe + 4 * x));
+    __m128i lo = _mm_unpacklo_epi8(px, zero);
+    __m128i hi = _mm_unpackhi_epi8(px, zero);
+    _mm_storel_epi64((__m128i *) (out + 3 * x), rgbe_to_half(_mm_unpacklo_epi16(lo, zero)));
+    _mm_storel_epi64((__m128i *) (out + 3 * x + 3), rgbe_to_half(_mm_unpackhi_epi16(lo, zero)));
+    _mm_storel_epi64((__m128i *) (out + 3 * x + 6), rgbe_to_half(_mm_unpacklo_epi16(hi, zero)));
+    _mm_storel_epi64((__m128i *) (out + 3 * x + 9), rgbe_to_half(_mm_unpackhi_epi16(hi, zero)));
+  }
+  for (; x < w; x++) {
+    int32_t v;
+    memcpy(&v, rgbe + 4 * x, 4);
+    __m128i px = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero);
+    __m128i half = rgbe_to_half(_mm_unpacklo_epi16(px, zero));
+    if (x + 1 < w) {
+      _mm_storel_epi64((__m128i *) (out + 3 * x), half);
+    } else {
+      uint16_t last[8];
+      _mm_storeu_si128((__m128i *) last, half);
+      memcpy(out + 3 * x, last, 3 * sizeof(uint16_t));
+    }
+  }
+}
+
+static void decode_rows(uint32_t start, uint32_t end, uint32_t threadnum, void *args) {
+  HdrDecode *d = (HdrDecode *) args;
+  uint32_t w = d->out->w;
+  std::vector<uint8_t> rgbe(4 * (size_t) w);
+  for (uint32_t y = start; y < end; y++) {
+    decode_scanline(d->data + d->rows[y], w, rgbe.data());
+    // Flipped, the file's first row is the top
+    uint32_t out_y = d->out->h - 1 - y;
+    convert_row(rgbe.data(), w, d->out->pixels.data() + 3 * (size_t) w * out_y);
+  }
+}
+
+static std::string cache_path(const char *path) {
+  return std::string(path) + ".half";
+}
+
+static bool load_cache(HdrImage *out, const char *path, struct stat *source) {
+  std::string half_path = cache_path(path);
+  FILE *f = fopen(half_path.c_str(), "rb");
+  if (!f) {
+    return false;
+  }
+  HdrCacheHeader header;
+  bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+            memcmp(header.magic, HDR_CACHE_MAGIC, 4) == 0 &&
+            header.version == HDR_CACHE_VERSION &&
+            header.source_size == (uint64_t) source->st_size &&
+            header.source_mtime == (int64_t) source->st_mtime;
+  if (ok) {
+    // The size comes from the file, check it against the file before allocating
+    uint64_t count = 3 * (uint64_t) header.w * header.h;
+    struct stat cache;
+    ok = stat(half_path.c_str(), &cache) == 0 && (uint64_t) cache.st_size == sizeof(header) + count * sizeof(uint16_t);
+    if (ok) {
+      out->w = header.w;
+      out->h = header.h;
+      out->pixels.resize((size_t) count);
+      ok = fread(out->pixels.data(), sizeof(uint16_t), (size_t) count, f) == count;
+    }
+    if (!ok) {
+      printf("ERROR: HDR cache %s is truncated or corrupt\n", half_path.c_str());
+    }
+  }
+  fclose(f);
+  return ok;
+}
+
+static void write_cache(HdrImage *img, const char *path, struct stat *source) {
+  std::string half_path = cache_path(path);
+  FILE *f = fopen(half_path.c_str(), "wb");
+  if (!f) {
+    printf("ERROR: HDR cache could not be opened for writing %s\n", half_path.c_str());
+    return;
+  }
+  HdrCacheHeader header;
+  memcpy(header.magic, HDR_CACHE_MAGIC, 4);
+  header.version = HDR_CACHE_VERSION;
+  header.w = img->w;
+  header.h = img->h;
+  header.source_size = (uint64_t) source->st_size;
+  header.source_mtime = (int64_t) source->st_mtime;
+  fwrite(&header, sizeof(header), 1, f);
+  fwrite(img->pixels.data(), sizeof(uint16_t), 3 * (size_t) img->w * img->h, f);
+  fclose(f);
+}
+
+// Header lines up to the blank one, then the resolution. Returns the offset of the pixels.
+static size_t parse_header(const uint8_t *data, size_t size, uint32_t *w, uint32_t *h) {
+  size_t p = 0;
+  bool first = true;
+  while (true) {
+    size_t end = p;
+    while (end < size && data[end] != '\n') {
+      end++;
+    }
+    if (end >= size) {
+      return 0;
+    }
+    std::string line((const char *) data + p, end - p);
+    p = end + 1;
+    if (first) {
+      if (line != "#?RADIANCE" && line != "#?RGBE") {
+        return 0;
+      }
+      first = false;
+    } else if (line.empty()) {
+      break;
+    } else if (line.compare(0, 7, "FORMAT=") == 0 && line != "FORMAT=32-bit_rle_rgbe") {
+      return 0;
+    }
+  }
+  size_t end = p;
+  while (end < size && data[end] != '\n') {
+    end++;
+  }
+  if (end >= size) {
+    return 0;
+  }
+  // Only the usual orientation, top to bottom and left to right
+  std::string line((const char *) data + p, end - p);
+  int iw, ih;
+  if (sscanf(line.c_str(), "-Y %d +X %d", &ih, &iw) != 2 || iw <= 0 || ih <= 0) {
+    return 0;
+  }
+  *w = (uint32_t) iw;
+  *h = (uint32_t) ih;
+  return end + 1;
+}
+
+bool hdr_load(HdrImage *out, const char *path, enkiTaskScheduler *ts) {
+  struct stat source;
+  if (stat(path, &source) != 0) {
+    printf("ERROR: HDR image could not be opened %s\n", path);
+    return false;
+  }
+  if (load_cache(out, path, &source)) {
+    return true;
+  }
+
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    printf("ERROR: HDR image could not be opened %s\n", path);
+    return false;
+  }
+  std::vector<uint8_t> data((size_t) source.st_size);
+  bool read_ok = !data.empty() && fread(data.data(), 1, data.size(), f) == data.size();
+  fclose(f);
+  if (!read_ok) {
+    printf("ERROR: HDR image could not be read %s\n", path);
+    return false;
+  }
+
+  HdrDecode d;
+  d.data = data.data();
+  d.out = out;
+  size_t pos = parse_header(data.data(), data.size(), &out->w, &out->h);
+  if (pos == 0) {
+    printf("ERROR: %s is not a Radiance HDR image we can read\n", path);
+    return false;
+  }
+  // Scanlines are variable length, so finding them is serial. It only reads the run headers.
+  d.rows.resize(out->h);
+  for (uint32_t y = 0; y < out->h; y++) {
+    d.rows[y] = pos;
+    if (!skip_scanline(data.data(), data.size(), &pos, out->w)) {
+      printf("ERROR: HDR image %s is truncated or corrupt at scanline %u\n", path, y);
+      return false;
+    }
+  }
+
+  out->pixels.resize(3 * (size_t) out->w * out->h);
+  enkiTaskSet *task = enkiCreateTaskSet(ts, decode_rows);
+  enkiAddTaskSetToPipe(ts, task, &d, out->h);
+  enkiWaitForTaskSet(ts, task);
+  enkiDeleteTaskSet(task);
+
+  write_cache(out, path, &source);
+  return true;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <TaskScheduler_c.h>
+
+#define HDR_CACHE_MAGIC "HDRH"
+#define HDR_CACHE_VERSION 1
+
+// Radiance .hdr as RGB half floats, ready for a GL_HALF_FLOAT upload. Rows go
+// bottom to top like GL textures.
+struct HdrImage {
+  uint32_t w;
+  uint32_t h;
+  std::vector<uint16_t> pixels;
+};
+
+// The RLE scanlines are found on the calling thread, then decoded and converted
+// RGBE to half across ts. The result is also written to <path>.half, which is
+// loaded instead for as long as the .hdr's size and modification time match.
+bool hdr_load(HdrImage *out, const char *path, enkiTaskScheduler *ts);
@@ -1,68 +1,240 @@
 #include "input.h"
 #include <SDL.h>
-#include <unordered_map>
+#include <stdio.h>
+#include <string.h>
 
-std::unordered_map<SDL_Scancode, bool> held_state;
-std::unordered_map<SDL_Scancode, bool> already_pressed_state;
-std::unordered_map<Uint8, bool> mouse_held_state;
-std::unordered_map<Uint8, bool> mouse_already_pressed_state;
+// Input log file format, all little endian:
+//   header: "R3DI", uint32 version
+//   per frame: float dt_ms, int16 mouse x, int16 mouse y, uint16 num events, InputEvent[num events]
+// Only the events are stored, the held state is rebuilt from them on replay.
+#define INPUT_LOG_MAGIC "R3DI"
+#define INPUT_LOG_VERSION 2
+
+#define KEY_WORDS (SDL_NUM_SCANCODES / 64)
+
+// One bit per scancode/button. pressed and released are edges seen during the
+// current frame, so a key that goes down and up between two frames still reports is_pressed.
+uint64_t key_held[KEY_WORDS];
+uint64_t key_pressed[KEY_WORDS];
+uint64_t key_released[KEY_WORDS];
+uint32_t mouse_held = 0;
+uint32_t mouse_pressed = 0;
+uint32_t mouse_released = 0;
 int scroll_dir = 0;
+int mouse_x = 0;
+int mouse_y = 0;
+bool window_resized = false;
 
-bool is_pressed(SDL_Scancode scancode) {
-  if (already_pressed_state[scancode] == false && held_state[scancode] == true) {
-    return true;
+InputEvent event_ring[INPUT_EVENT_RING_SIZE];
+uint32_t event_head = 0;
+uint32_t event_count = 0;
+// Linear copy of the current frame's events for get_frame_events and the recorder
+InputEvent frame_events[INPUT_EVENT_RING_SIZE];
+int num_frame_events = 0;
+
+FILE *record_file = NULL;
+FILE *replay_file = NULL;
+
+static inline bool test_bit(const uint64_t *bits, uint32_t i) {
+  return (bits[i >> 6] >> (i & 63)) & 1;
+}
+
+static inline void set_bit(uint64_t *bits, uint32_t i) {
+  bits[i >> 6] |= 1ull << (i & 63);
+}
+
+static inline void clear_bit(uint64_t *bits, uint32_t i) {
+  bits[i >> 6] &= ~(1ull << (i & 63));
+}
+
+static void push_event(uint32_t timestamp, uint8_t type, uint16_t code, int8_t value) {
+  if (event_count == INPUT_EVENT_RING_SIZE) {
+    // Drop the oldest
+    event_head = (event_head + 1) % INPUT_EVENT_RING_SIZE;
+    event_count--;
   }
-  return false;
+  InputEvent *e = &event_ring[(event_head + event_count) % INPUT_EVENT_RING_SIZE];
+  e->timestamp = timestamp;
+  e->type = type;
+  e->code = code;
+  e->value = value;
+  event_count++;
+}
+
+bool is_pressed(SDL_Scancode scancode) {
+  return test_bit(key_pressed, scancode);
 }
 
 bool is_down(SDL_Scancode scancode) {
-  return held_state[scancode];
+  return test_bit(key_held, scancode);
 }
 
 bool is_up(SDL_Scancode scancode) {
-  return !held_state[scancode];
+  return !test_bit(key_held, scancode);
+}
+
+bool is_released(SDL_Scancode scancode) {
+  return test_bit(key_released, scancode);
 }
 
 bool is_mouse_pressed(Uint8 event) {
-  if (mouse_already_pressed_state[event] == false && mouse_held_state[event] == true) {
-    return true;
-  }
-  return false;
+  return (mouse_pressed & SDL_BUTTON(event)) != 0;
 }
 
 bool is_mouse_down(Uint8 event) {
-  return mouse_held_state[event];
+  return (mouse_held & SDL_BUTTON(event)) != 0;
 }
 
 bool is_mouse_up(Uint8 event) {
-  return !mouse_held_state[event];
+  return (mouse_held & SDL_BUTTON(event)) == 0;
+}
+
+bool is_mouse_released(Uint8 event) {
+  return (mouse_released & SDL_BUTTON(event)) != 0;
 }
 
 int is_mouse_scrolling() {
   return scroll_dir;
 }
 
-void process_raw_input(bool *quit) {
+bool is_window_resized() {
+  return window_resized;
+}
+
+void get_mouse_pos(int *x, int *y) {
+  *x = mouse_x;
+  *y = mouse_y;
+}
+
+const InputEvent *get_frame_events(int *count) {
+  *count = num_frame_events;
+  return frame_events;
+}
+
+bool input_record_begin(const char *path) {
+  record_file = fopen(path, "wb");
+  if (!record_file) {
+    printf("ERROR: Input log could not be opened for writing %s\n", path);
+    return false;
+  }
+  uint32_t version = INPUT_LOG_VERSION;
+  fwrite(INPUT_LOG_MAGIC, 1, 4, record_file);
+  fwrite(&version, sizeof(version), 1, record_file);
+  printf("Recording input to %s\n", path);
+  return true;
+}
+
+void input_record_end() {
+  if (record_file) {
+    fclose(record_file);
+    record_file = NULL;
+  }
+}
+
+bool input_replay_begin(const char *path) {
+  replay_file = fopen(path, "rb");
+  if (!replay_file) {
+    printf("ERROR: Input log could not be opened %s\n", path);
+    return false;
+  }
+  char magic[4];
+  uint32_t version = 0;
+  if (fread(magic, 1, 4, replay_file) != 4 || memcmp(magic, INPUT_LOG_MAGIC, 4) != 0 ||
+      fread(&version, sizeof(version), 1, replay_file) != 1 || version != INPUT_LOG_VERSION) {
+    printf("ERROR: %s is not an input log or has the wrong version\n", path);
+    fclose(replay_file);
+    replay_file = NULL;
+    return false;
+  }
+  printf("Replaying input from %s\n", path);
+  return true;
+}
+
+bool is_input_replaying() {
+  return replay_file != NULL;
+}
+
+static void write_frame(float dt_ms) {
+  int16_t mx = (int16_t) mouse_x;
+  int16_t my = (int16_t) mouse_y;
+  uint16_t num = (uint16_t) num_frame_events;
+  fwrite(&dt_ms, sizeof(dt_ms), 1, record_file);
+  fwrite(&mx, sizeof(mx), 1, record_file);
+  fwrite(&my, sizeof(my), 1, record_file);
+  fwrite(&num, sizeof(num), 1, record_file);
+  fwrite(frame_events, sizeof(InputEvent), num, record_file);
+}
+
+// Pushes the logged events into the ring as if they came from SDL. Returns false at the end of the log.
+static bool read_frame(float *dt_ms) {
+  int16_t mx, my;
+  uint16_t num;
+  if (fread(dt_ms, sizeof(*dt_ms), 1, replay_file) != 1 ||
+      fread(&mx, sizeof(mx), 1, replay_file) != 1 ||
+      fread(&my, sizeof(my), 1, replay_file) != 1 ||
+      fread(&num, sizeof(num), 1, replay_file) != 1) {
+    return false;
+  }
+  for (int i = 0; i < num; i++) {
+    InputEvent e;
+    if (fread(&e, sizeof(e), 1, replay_file) != 1) {
+      return false;
+    }
+    push_event(e.timestamp, e.type, e.code, e.value);
+  }
+  mouse_x = mx;
+  mouse_y = my;
+  return true;
+}
+
+void process_raw_input(bool *quit, float *dt_ms) {
   scroll_dir = 0;
+  memset(key_pressed, 0, sizeof(key_pressed));
+  memset(key_released, 0, sizeof(key_released));
+  mouse_pressed = 0;
+  mouse_released = 0;
+  window_resized = false;
+
   SDL_Event e;
   while (SDL_PollEvent(&e)) {
+    // Keep the window responsive while replaying, but only let it be closed or resized
+    if (replay_file && e.type != SDL_QUIT && e.type != SDL_WINDOWEVENT) {
+      continue;
+    }
     switch (e.type) {
       case SDL_QUIT:
         *quit = true;
         break;
+      case SDL_KEYDOWN:
+        if (!e.key.repeat && e.key.keysym.scancode < SDL_NUM_SCANCODES) {
+          push_event(e.key.timestamp, INPUT_KEY_DOWN, e.key.keysym.scancode, 0);
+        }
+        break;
+      case SDL_KEYUP:
+        if (e.key.keysym.scancode < SDL_NUM_SCANCODES) {
+          push_event(e.key.timestamp, INPUT_KEY_UP, e.key.keysym.scancode, 0);
+        }
+        break;
+      case SDL_MOUSEBUTTONDOWN:
+        push_event(e.button.timestamp, INPUT_MOUSE_DOWN, e.button.button, 0);
+        break;
+      case SDL_MOUSEBUTTONUP:
+        push_event(e.button.timestamp, INPUT_MOUSE_UP, e.button.button, 0);
+        break;
       case SDL_MOUSEMOTION:
+        mouse_x = e.motion.x;
+        mouse_y = e.motion.y;
         break;
       case SDL_MOUSEWHEEL:
-        if (e.wheel.y > 0) {
-          scroll_dir = 1;
-        } else if (e.wheel.y < 0) {
-          scroll_dir = -1;
+        if (e.wheel.y != 0) {
+          push_event(e.wheel.timestamp, INPUT_MOUSE_WHEEL, 0, e.wheel.y > 0 ? 1 : -1);
         }
         break;
       case SDL_WINDOWEVENT:
         switch (e.window.event) {
-          case SDL_WINDOWEVENT_RESIZED:
-            puts("window resized");
+          // Also sent for fullscreen toggles and resizes from SDL_SetWindowSize
+          case SDL_WINDOWEVENT_SIZE_CHANGED:
+            window_resized = true;
             break;
         }
         break;
@@ -70,33 +242,44 @@ void process_raw_input(bool *quit) {
         break;
     }
   }
-  // Preprocess the keyboard state
-  int num_keys;
-  const Uint8 *key_state = SDL_GetKeyboardState(&num_keys);
-  for (int i = 0; i < num_keys; i++) {
-    SDL_Scancode scancode = (SDL_Scancode) i;
-    // printf("scancode %d\n", scancode);
-    if (key_state[scancode]) {
-      // Check if we're already pressing
-      if (!already_pressed_state[scancode] && held_state[scancode]) {
-        already_pressed_state[scancode] = true;
-      }
-      held_state[scancode] = true;
-    } else if (!key_state[scancode]) {
-      held_state[scancode] = false;
-      already_pressed_state[scancode] = false;
-    }
+
+  if (replay_file && !read_frame(dt_ms)) {
+    puts("Input replay finished");
+    fclose(replay_file);
+    replay_file = NULL;
   }
-  // Go through all the mouse buttons that SDL supports
-  for (int i = 1; i <= 5; i++) {
-    if (SDL_GetMouseState(NULL, NULL) & SDL_BUTTON(i)) {
-      if (!mouse_already_pressed_state[i] && mouse_held_state[i]) {
-        mouse_already_pressed_state[i] = true;
-      }
-      mouse_held_state[e.button.button] = true;
-    } else if (!(SDL_GetMouseState(NULL, NULL) & SDL_BUTTON(i))) {
-      mouse_held_state[i] = false;
-      mouse_already_pressed_state[i] = false;
+
+  // Drain the ring and update the edge and held bits
+  num_frame_events = 0;
+  while (event_count > 0) {
+    InputEvent ev = event_ring[event_head];
+    event_head = (event_head + 1) % INPUT_EVENT_RING_SIZE;
+    event_count--;
+    frame_events[num_frame_events++] = ev;
+    switch (ev.type) {
+      case INPUT_KEY_DOWN:
+        set_bit(key_held, ev.code);
+        set_bit(key_pressed, ev.code);
+        break;
+      case INPUT_KEY_UP:
+        clear_bit(key_held, ev.code);
+        set_bit(key_released, ev.code);
+        break;
+      case INPUT_MOUSE_DOWN:
+        mouse_held |= SDL_BUTTON(ev.code);
+        mouse_pressed |= SDL_BUTTON(ev.code);
+        break;
+      case INPUT_MOUSE_UP:
+        mouse_held &= ~SDL_BUTTON(ev.code);
+        mouse_released |= SDL_BUTTON(ev.code);
+        break;
+      case INPUT_MOUSE_WHEEL:
+        scroll_dir = ev.value;
+        break;
     }
   }
-}
\ No newline at end of file
+
+  if (record_file) {
+    write_frame(*dt_ms);
+  }
+}
@@ -1,12 +1,45 @@
 #pragma once
 
 #include <SDL.h>
+#include <stdint.h>
+
+// Size of the event ring, more events than this in a single frame drops the oldest
+#define INPUT_EVENT_RING_SIZE 256
+
+enum InputEventType : uint8_t {
+  INPUT_KEY_DOWN,
+  INPUT_KEY_UP,
+  INPUT_MOUSE_DOWN,
+  INPUT_MOUSE_UP,
+  INPUT_MOUSE_WHEEL
+};
+
+// SDL timestamp in ms, scancode or mouse button, and the wheel direction for INPUT_MOUSE_WHEEL
+struct InputEvent {
+  uint32_t timestamp;
+  uint16_t code;
+  uint8_t type;
+  int8_t value;
+};
 
 bool is_pressed(SDL_Scancode scancode);
 bool is_down(SDL_Scancode scancode);
 bool is_up(SDL_Scancode scancode);
+bool is_released(SDL_Scancode scancode);
 bool is_mouse_pressed(Uint8 event);
 bool is_mouse_down(Uint8 event);
 bool is_mouse_up(Uint8 event);
+bool is_mouse_released(Uint8 event);
 int is_mouse_scrolling();
-void process_raw_input(bool *quit);
+void get_mouse_pos(int *x, int *y);
+// The window changed size since the last process_raw_input, the new size comes from SDL
+bool is_window_resized();
+// Events processed this frame, in order. Valid until the next process_raw_input.
+const InputEvent *get_frame_events(int *count);
+// When recording, dt_ms is logged with the frame. When replaying, it's replaced with the logged dt.
+void process_raw_input(bool *quit, float *dt_ms);
+
+bool input_record_begin(const char *path);
+bool input_replay_begin(const char *path);
+bool is_input_replaying();
+void input_record_end();
@@ -0,0 +1,71 @@
+#include "job_graph.h"
+#include <stdio.h>
+
+void job_graph_init(JobGraph *g, enkiTaskScheduler *ts) {
+  g->ts = ts;
+  g->jobs.clear();
+  g->waves.clear();
+}
+
+void job_graph_destroy(JobGraph *g) {
+  for (Job &job : g->jobs) {
+    enkiDeleteTaskSet(job.task);
+  }
+  g->jobs.clear();
+  g->waves.clear();
+}
+
+uint32_t job_graph_add(JobGraph *g, const char *name, enkiTaskExecuteRange fn, void *args, std::initializer_list<uint32_t> deps) {
+  uint32_t id = (uint32_t) g->jobs.size();
+  if (id == JOB_GRAPH_MAX_JOBS) {
+    printf("ERROR: Job graph is full, %s is not added\n", name);
+    return id;
+  }
+  Job job;
+  job.name = name;
+  job.fn = fn;
+  job.args = args;
+  job.count = 1;
+  job.wave = 0;
+  for (uint32_t dep : deps) {
+    if (dep >= id) {
+      printf("ERROR: Job %s depends on job %u, which doesn't exist yet\n", name, dep);
+      continue;
+    }
+    job.deps.push_back(dep);
+    if (g->jobs[dep].wave + 1 > job.wave) {
+      job.wave = g->jobs[dep].wave + 1;
+    }
+  }
+  job.task = enkiCreateTaskSet(g->ts, fn);
+  g->jobs.push_back(job);
+  if (job.wave >= g->waves.size()) {
+    g->waves.resize(job.wave + 1);
+  }
+  g->waves[job.wave].push_back(id);
+  return id;
+}
+
+void job_graph_set_count(JobGraph *g, uint32_t job, uint32_t count) {
+  if (job < g->jobs.size()) {
+    g->jobs[job].count = count;
+  }
+}
+
+void job_graph_run(JobGraph *g) {
+  for (std::vector<uint32_t> &wave : g->waves) {
+    for (uint32_t id : wave) {
+      Job &job = g->jobs[id];
+      if (job.count > 0) {
+        enkiAddTaskSetToPipe(g->ts, job.task, job.args, job.count);
+      }
+    }
+    // The calling thread runs tasks too while it waits
+    for (uint32_t id : wave) {
+      Job &job = g->jobs[id];
+      if (job.count > 0) {
+        enkiWaitForTaskSet(g->ts, job.task);
+      }
+    }
+  }
+}
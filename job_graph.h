@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <initializer_list>
+#include <TaskScheduler_c.h>
+
+#define JOB_GRAPH_MAX_JOBS 32
+
+struct Job {
+  const char *name;
+  enkiTaskExecuteRange fn;
+  void *args;
+  // Set size handed to enkiTS, 1 runs the job as a single task
+  uint32_t count;
+  std::vector<uint32_t> deps;
+  enkiTaskSet *task;
+  uint32_t wave;
+};
+
+// Jobs with dependencies, run once per frame. The enkiTS C API has no task
+// dependencies, so the graph is flattened into waves: a job runs in the wave
+// after its last dependency, every job of a wave runs at the same time and the
+// next wave starts when they're all done.
+struct JobGraph {
+  enkiTaskScheduler *ts;
+  std::vector<Job> jobs;
+  std::vector<std::vector<uint32_t>> waves;
+};
+
+void job_graph_init(JobGraph *g, enkiTaskScheduler *ts);
+void job_graph_destroy(JobGraph *g);
+// Dependencies are ids returned by earlier calls, so the graph can't have cycles
+uint32_t job_graph_add(JobGraph *g, const char *name, enkiTaskExecuteRange fn, void *args, std::initializer_list<uint32_t> deps);
+void job_graph_set_count(JobGraph *g, uint32_t job, uint32_t count);
+// Returns when every job has finished
+void job_graph_run(JobGraph *g);
@@ -0,0 +1,167 @@
+#include "light_volumes.h"
+#include <math.h>
+#include <glad/glad.h>
+#include "gl_state.h"
+#include "shadows.h"
+
+static void push_vertex(std::vector<float> &packed, float x, float y, float z) {
+  float v[NUM_PACKED_ELEMENTS] = { x, y, z };
+  packed.insert(packed.end(), v, v + NUM_PACKED_ELEMENTS);
+}
+
+void light_volumes_init(LightVolumes *lv) {
+  const float pi = 3.14159265359f;
+  const uint32_t n = LIGHT_VOLUME_SEGMENTS;
+  // The faces cut inside the sphere through their vertices, by up to half a step in
+  // latitude and in longitude. Pushed out so the mesh contains the whole sphere.
+  float sphere_scale = 1.0f / (cosf(pi / n) * cosf(pi / n));
+  std::vector<float> packed;
+  std::vector<uint32_t> triangles;
+  sphere_triangles(n, packed, triangles);
+  for (size_t i = 0; i < packed.size(); i += NUM_PACKED_ELEMENTS) {
+    packed[i] *= sphere_scale;
+    packed[i+1] *= sphere_scale;
+    packed[i+2] *= sphere_scale;
+  }
+  lv->sphere = upload_mesh(packed.data(), packed.size() / NUM_PACKED_ELEMENTS, triangles.data(), triangles.size(), GL_TRIANGLES);
+
+  // Same for the base, its edges cut inside the circle
+  float ring_scale = 1.0f / cosf(pi / n);
+  packed.clear();
+  triangles.clear();
+  push_vertex(packed, 0.0f, 0.0f, 0.0f);
+  push_vertex(packed, 0.0f, 0.0f, 1.0f);
+  for (uint32_t i = 0; i < n; i++) {
+    float a = 2.0f * pi * i / n;
+    push_vertex(packed, cosf(a) * ring_scale, sinf(a) * ring_scale, 1.0f);
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t a = 2 + i;
+    uint32_t b = 2 + (i + 1) % n;
+    uint32_t side[3] = { 0, b, a };
+    uint32_t base[3] = { 1, a, b };
+    triangles.insert(triangles.end(), side, side + 3);
+    triangles.insert(triangles.end(), base, base + 3);
+  }
+  lv->cone = upload_mesh(packed.data(), packed.size() / NUM_PACKED_ELEMENTS, triangles.data(), triangles.size(), GL_TRIANGLES);
+  lv->num_drawn = 0;
+}
+
+void light_volumes_destroy(LightVolumes *lv) {
+  GpuMesh *meshes[2] = { &lv->sphere, &lv->cone };
+  for (GpuMesh *m : meshes) {
+    gl_delete_vertex_arrays(1, &m->vao);
+    glDeleteBuffers(1, &m->vbo);
+    glDeleteBuffers(1, &m->ebo);
+  }
+  *lv = {};
+}
+
+static bool sphere_visible(Frustum *f, Vec3 c, float r) {
+  for (int i = 0; i < 6; i++) {
+    if (f->nx[i] * c.x + f->ny[i] * c.y + f->nz[i] * c.z + f->d[i] < -r) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Narrow spots get a cone, wide ones (where the cone would be mostly base) the sphere
+static bool use_cone(const SceneLightDesc &l) {
+  return l.cos_outer > 0.5f;
+}
+
+static Mat4 volume_world(const SceneLightDesc &l) {
+  Mat4 m = rwm_m4_identity();
+  if (!use_cone(l)) {
+    m.e[0][0] = l.range;
+    m.e[1][1] = l.range;
+    m.e[2][2] = l.range;
+  } else {
+    // Columns are the cone's x, y and z axes, z down the spot
+    Vec3 z = l.dir;
+    Vec3 up = fabsf(z.y) < 0.99f ? rwm_v3_init(0.0f, 1.0f, 0.0f) : rwm_v3_init(1.0f, 0.0f, 0.0f);
+    Vec3 x = rwm_v3_normalize(rwm_v3_cross(up, z));
+    Vec3 y = rwm_v3_cross(z, x);
+    // Anything within range along the axis is also within it across, so the flat base
+    // at the full range covers the spherical cap of the spot
+    float radius = l.range * sqrtf(1.0f - l.cos_outer * l.cos_outer) / l.cos_outer;
+    for (int r = 0; r < 3; r++) {
+      m.e[r][0] = x.e[r] * radius;
+      m.e[r][1] = y.e[r] * radius;
+      m.e[r][2] = z.e[r] * l.range;
+    }
+  }
+  m.e[0][3] = l.pos.x;
+  m.e[1][3] = l.pos.y;
+  m.e[2][3] = l.pos.z;
+  return m;
+}
+
+void light_volumes_render(LightVolumes *lv, Shader *stencil_s, Shader *light_s,
+                          const std::vector<SceneLightDesc> &lights, const int32_t *light_cube,
+                          Frustum *frustum) {
+  lv->num_drawn = 0;
+  // Without near and far clipping no part of a volume goes missing, the camera
+  // being inside a light or a volume reaching past the far plane needs no special case
+  glEnable(GL_DEPTH_CLAMP);
+  gl_depth_mask(false);
+  // A back face clamped onto the far plane doesn't mark the background
+  gl_depth_func(GL_LEQUAL);
+  gl_enable(GL_STENCIL_TEST);
+  glBlendFunc(GL_ONE, GL_ONE);
+  glCullFace(GL_FRONT);
+  light_s->use();
+  light_s->set_unif_1f("u_shadow_near", SHADOW_CUBE_NEAR);
+  for (uint32_t i = 0; i < lights.size(); i++) {
+    const SceneLightDesc &l = lights[i];
+    if (!sphere_visible(frustum, l.pos, l.range)) {
+      continue;
+    }
+    Mat4 world = volume_world(l);
+    GpuMesh &mesh = use_cone(l) ? lv->cone : lv->sphere;
+
+    // Back faces behind the surface count up, front faces behind it count down,
+    // what's left non-zero has the surface between the two
+    stencil_s->use();
+    stencil_s->set_unif_mat4("u_model", &world);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    gl_enable(GL_DEPTH_TEST);
+    gl_disable(GL_CULL_FACE);
+    gl_disable(GL_BLEND);
+    glStencilFunc(GL_ALWAYS, 0, 0xff);
+    glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+    glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+    draw_gpu_mesh(mesh);
+
+    // Back faces cover every marked pixel exactly once. Shading zeroes the stencil
+    // again, so the next light starts from a clear one.
+    light_s->use();
+    light_s->set_unif_mat4("u_model", &world);
+    Vec3 pos = l.pos;
+    Vec3 color = l.color;
+    Vec3 dir = l.dir;
+    light_s->set_unif_3fv("u_light_pos", &pos);
+    light_s->set_unif_3fv("u_light_color", &color);
+    light_s->set_unif_1f("u_light_range", l.range);
+    light_s->set_unif_3fv("u_light_dir", &dir);
+    light_s->set_unif_2f("u_spot_cos", l.cos_inner, l.cos_outer);
+    light_s->set_unif_1i("u_shadow_cube", light_cube[i]);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    gl_disable(GL_DEPTH_TEST);
+    gl_enable(GL_CULL_FACE);
+    gl_enable(GL_BLEND);
+    glStencilFunc(GL_NOTEQUAL, 0, 0xff);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+    draw_gpu_mesh(mesh);
+    lv->num_drawn++;
+  }
+  glCullFace(GL_BACK);
+  gl_disable(GL_CULL_FACE);
+  gl_disable(GL_BLEND);
+  gl_disable(GL_STENCIL_TEST);
+  gl_enable(GL_DEPTH_TEST);
+  gl_depth_func(GL_LESS);
+  gl_depth_mask(true);
+  glDisable(GL_DEPTH_CLAMP);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <rw_math.h>
+#include "assets.h"
+#include "cull.h"
+#include "scene.h"
+#include "shader.h"
+
+#define LIGHT_VOLUME_SEGMENTS 16
+
+// Local lights drawn as bounding volumes over the G-buffer, summed into an HDR
+// target the full screen lighting pass adds to the ambient term. A stencil pass
+// per light leaves only the pixels whose surface is inside the volume, so a light
+// costs its screen coverage instead of the whole screen.
+// The meshes are triangle lists wound counter-clockwise seen from outside.
+struct LightVolumes {
+  // Unit sphere
+  GpuMesh sphere;
+  // Apex at the origin, opening down +z to a base of radius 1 at z = 1
+  GpuMesh cone;
+  uint32_t num_drawn;
+};
+
+void light_volumes_init(LightVolumes *lv);
+void light_volumes_destroy(LightVolumes *lv);
+// Expects the G-buffer bound for light_s, the accumulation target and the G-buffer
+// depth/stencil attached and the stencil cleared. Leaves the stencil cleared.
+// light_cube is the shadow cube of each light, -1 for none (Shadows::light_cube).
+void light_volumes_render(LightVolumes *lv, Shader *stencil_s, Shader *light_s,
+                          const std::vector<SceneLightDesc> &lights, const int32_t *light_cube,
+                          Frustum *frustum);
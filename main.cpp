@@ -14,26 +14,44 @@
 #define RWTM_IMPLEMENTATION
 #include <rw_time.h>
 
-#define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
 #include <TaskScheduler_c.h>
 
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
-
 #include "shader.h"
 #include "camera.h"
 #include "input.h"
 #include "global.h"
 #include "mesh.h"
-
+#include "capture.h"
+#include "bench.h"
+#include "frame_pacer.h"
+#include "scene_graph.h"
+#include "assets.h"
+#include "scene.h"
+#include "cull.h"
+#include "occlusion.h"
+#include "soft_occlusion.h"
+#include "gpu_scene.h"
+#include "material_table.h"
+#include "render_queue.h"
+#include "gl_state.h"
+#include "job_graph.h"
+#include "ring_buffer.h"
+#include "render_target_pool.h"
+#include "render_graph.h"
+#include "dynamic_resolution.h"
+#include "light_volumes.h"
+#include "shadows.h"
+#include "simd_math.h"
+#include "hdr_image.h"
+
+// Simulation runs at a fixed rate, rendering interpolates between the last two ticks
 constexpr int TICKS_PER_SECOND = 60;
-constexpr int SKIP_TICKS = 1000 / TICKS_PER_SECOND;
+constexpr float SKIP_TICKS = 1000.0f / TICKS_PER_SECOND;
 constexpr int MAX_FRAMESKIP = 10;
 
 enkiTaskScheduler *g_pTS;
-enkiTaskSet *pTask;
 
 bool quit = false;
 bool is_next_state_wire = true;
@@ -46,9 +64,7 @@ uint32_t skybox_vao = 0;
 uint32_t plane_vao = 0;
 uint32_t plane_vbo = 0;
 
-uint32_t sphere_vao = 0;
-uint32_t sphere_vbo = 0;
-uint32_t sphere_ebo = 0;
+GpuMesh sphere_mesh = {};
 
 uint32_t mesh_vao = 0;
 uint32_t mesh_vbo = 0;
@@ -60,8 +76,6 @@ uint32_t to_mesh_n_vbo = 0;
 uint32_t to_mesh_t_vbo = 0;
 uint32_t to_mesh_ebo = 0;
 
-uint32_t idx_count = 0;
-
 // These are globals for cubemap capturing
 Mat4 capture_persp_mat = perspective(90.0f, 0.1f, 10.0f, 1.0f);
 Vec3 capture_pos = rwm_v3_zero();
@@ -82,38 +96,58 @@ Vec3 capture_ups[6] = {
   rwm_v3_init(0.0, -1.0, 0.0),
 };
 
-struct PBRTextures {
-  uint32_t albedo_tid;
-  uint32_t metallic_tid;
-  uint32_t roughness_tid;
-  uint32_t normal_tid;
-  uint32_t ao_tid;
+// Hi-Z in compute shaders, or the software rasterizer for when the GPU is too weak
+// or the readback too slow (llvmpipe, integrated parts)
+enum class OcclusionMode {
+  GPU,
+  CPU,
+  OFF
 };
 
-struct TinyObjMesh {
-  tinyobj::attrib_t attrib;
-  std::vector<tinyobj::shape_t> shapes;
-  std::vector<tinyobj::material_t> materials;
-  //float *packed;
-  std::vector<float> packed;
-  uint32_t total_vertices;
+// std140 FrameUniforms block of shaders/gpu_driven.vert and shaders/deferred_pbr.frag.
+// The block is row_major, so matrices are copied as they are.
+#define FRAME_UNIFORMS_BINDING 0
+struct FrameUniforms {
+  Mat4 view;
+  Mat4 projection;
+  float cam_pos[4];
+  float render_scale[4];
 };
 
-struct MeshFull {
-  Mesh mesh;
-  TinyObjMesh to_mesh;
-  PBRTextures textures;
-};
-
-struct GBuffer {
-  uint32_t fbo;
-  uint32_t rbo;
-  uint32_t g_pos;
-  uint32_t g_normal;
-  uint32_t g_albedo;
-  uint32_t g_metallic;
-  uint32_t g_roughness;
-  uint32_t g_ao;
+// Everything the frame prep jobs read and write. The main thread handles events
+// and fills in the inputs, runs the graph, and the GL work only reads the results.
+struct FramePrep {
+  // Camera
+  Camera *camera;
+  CameraPath *camera_path;
+  float dt_ms;
+  float bench_dt_ms;
+  float tick_accumulator;
+  float path_time;
+  bool is_bench;
+  bool is_recording_path;
+  Mat4 view_proj;
+  // Per-frame uniforms and instance data are written straight into the ring
+  RingBuffer *frame_ring;
+  RingAlloc frame_uniforms;
+  // Render size over target size, see DynamicResolution
+  float render_scale[2];
+  // Transforms
+  Scene *scene;
+  AssetCache *asset_cache;
+  std::vector<Aabb> *instance_boxes;
+  // Instances whose node scene_update recomputed this frame
+  std::vector<uint32_t> *changed_instances;
+  InstanceBvh *instance_bvh;
+  GpuScene *gpu_scene;
+  Shadows *shadows;
+  // Culling
+  OcclusionMode occlusion_mode;
+  SoftOcclusion *soft_occlusion;
+  std::vector<uint32_t> *visible_instances;
+  // Packets
+  RenderQueue *render_queue;
+  uint32_t geometry_program;
 };
 
 void render_plane();
@@ -123,117 +157,35 @@ void render_quad();
 void render_to_quad(Shader &quad_shader, uint32_t tex_color_buffer);
 void render_skybox(Shader &skybox_shader, Camera &camera, uint32_t skybox_tid);
 void render_mesh(Mesh &m);
-void render_mesh_full(MeshFull &m);
-
-
-TinyObjMesh tinyobj_load(std::string path) {
-  TinyObjMesh result;
-  std::string warn;
-  std::string err;
-
-  printf("tinyobj: Loading obj: %s\n", path.c_str());
-  bool ret = tinyobj::LoadObj(&result.attrib, &result.shapes, &result.materials, &warn, &err, path.c_str());
-
-  if (!warn.empty()) {
-    printf("%s\n", warn.c_str());
-  }
-
-  if (!err.empty()) {
-    printf("%s\n", err.c_str());
-  }
-
-  if (!ret) {
-    exit(1);
-  }
-
-  // Don't deal with multiple things in an obj file for now
-  assert(result.shapes.size() == 1);
-
-  result.total_vertices = 0;
-  for (size_t f = 0; f < result.shapes[0].mesh.num_face_vertices.size(); f++) {
-    int fv = result.shapes[0].mesh.num_face_vertices[f];
-    result.total_vertices += fv;
-  }
-
-  // Pack the data
-  result.packed.reserve(NUM_PACKED_ELEMENTS * result.total_vertices);
-  size_t index_offset = 0;
-  for (size_t f = 0; f < result.shapes[0].mesh.num_face_vertices.size(); f++) {
-    int fv = result.shapes[0].mesh.num_face_vertices[f];
-    for (size_t v = 0; v < fv; v++) {
-      tinyobj::index_t idx = result.shapes[0].mesh.indices[index_offset + v];
-      result.packed.push_back(result.attrib.vertices[3*idx.vertex_index+0]);
-      result.packed.push_back(result.attrib.vertices[3*idx.vertex_index+1]);
-      result.packed.push_back(result.attrib.vertices[3*idx.vertex_index+2]);
-      result.packed.push_back(result.attrib.texcoords[2*idx.texcoord_index+0]);
-      result.packed.push_back(result.attrib.texcoords[2*idx.texcoord_index+1]);
-      result.packed.push_back(result.attrib.normals[3*idx.normal_index+0]);
-      result.packed.push_back(result.attrib.normals[3*idx.normal_index+1]);
-      result.packed.push_back(result.attrib.normals[3*idx.normal_index+2]);
-    }
-    index_offset += fv;
-  }
-
-  return result;
-}
-
-uint32_t load_texture(const char *path) {
-  stbi_set_flip_vertically_on_load(true);
-  uint32_t tid = 0;
-  int w, h, num_components;
-  unsigned char *data = stbi_load(path, &w, &h, &num_components, 0);
-  if (data) {
-    glGenTextures(1, &tid);
-    GLenum format = GL_RED;
-    if (num_components == 1) {
-      format = GL_RED;
-    } else if (num_components == 3) {
-      format = GL_RGB;
-    } else if (num_components == 4) {
-      format = GL_RGBA;
-    }
-    glBindTexture(GL_TEXTURE_2D, tid);
-    glTexImage2D(GL_TEXTURE_2D, 0, format, w, h, 0, format, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
+void render_instances(MaterialTable &mt, GpuScene &gs, OcclusionCuller *oc);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    printf("Loaded texture: %s as tid %d\n", path, tid);
-  } else {
-    printf("ERROR: Texture could not be not loaded %s\n", path);
-  }
-  stbi_image_free(data);
-  return tid;
-}
 
 void bind_pbr_textures(PBRTextures &t) {
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, t.albedo_tid);
-  glActiveTexture(GL_TEXTURE1);
-  glBindTexture(GL_TEXTURE_2D, t.normal_tid);
-  glActiveTexture(GL_TEXTURE2);
-  glBindTexture(GL_TEXTURE_2D, t.metallic_tid);
-  glActiveTexture(GL_TEXTURE3);
-  glBindTexture(GL_TEXTURE_2D, t.roughness_tid);
-  glActiveTexture(GL_TEXTURE4);
-  glBindTexture(GL_TEXTURE_2D, t.ao_tid);
+  gl_active_texture(GL_TEXTURE0);
+  gl_bind_texture(GL_TEXTURE_2D, t.albedo_tid);
+  gl_active_texture(GL_TEXTURE1);
+  gl_bind_texture(GL_TEXTURE_2D, t.normal_tid);
+  gl_active_texture(GL_TEXTURE2);
+  gl_bind_texture(GL_TEXTURE_2D, t.metallic_tid);
+  gl_active_texture(GL_TEXTURE3);
+  gl_bind_texture(GL_TEXTURE_2D, t.roughness_tid);
+  gl_active_texture(GL_TEXTURE4);
+  gl_bind_texture(GL_TEXTURE_2D, t.ao_tid);
 }
 
 void deferred_bind_pbr_textures(PBRTextures &t) {
-  glActiveTexture(GL_TEXTURE3);
-  glBindTexture(GL_TEXTURE_2D, t.metallic_tid);
-  glActiveTexture(GL_TEXTURE4);
-  glBindTexture(GL_TEXTURE_2D, t.roughness_tid);
-  glActiveTexture(GL_TEXTURE5);
-  glBindTexture(GL_TEXTURE_2D, t.ao_tid);
+  gl_active_texture(GL_TEXTURE3);
+  gl_bind_texture(GL_TEXTURE_2D, t.metallic_tid);
+  gl_active_texture(GL_TEXTURE4);
+  gl_bind_texture(GL_TEXTURE_2D, t.roughness_tid);
+  gl_active_texture(GL_TEXTURE5);
+  gl_bind_texture(GL_TEXTURE_2D, t.ao_tid);
 }
 
 uint32_t load_cubemap(const std::string &dir) {
   uint32_t tid;
   glGenTextures(1, &tid);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, tid);
+  gl_bind_texture(GL_TEXTURE_CUBE_MAP, tid);
   std::string names[6] = {
     "right.jpg",
     "left.jpg",
@@ -267,23 +219,24 @@ uint32_t load_cubemap(const std::string &dir) {
 }
 
 uint32_t load_hdr_texture(const std::string &path) {
-  stbi_set_flip_vertically_on_load(true);
+  uint64_t start = rwtm_now();
   uint32_t tid = 0;
-  int w, h, num_components;
-  float *data = stbi_loadf(path.c_str(), &w, &h, &num_components, 0);
-  if (data) {
+  HdrImage img;
+  if (hdr_load(&img, path.c_str(), g_pTS)) {
     glGenTextures(1, &tid);
-    glBindTexture(GL_TEXTURE_2D, tid);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, w, h, 0, GL_RGB, GL_FLOAT, data);
+    gl_bind_texture(GL_TEXTURE_2D, tid);
+    // Rows of RGB halves are only 2 byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, img.w, img.h, 0, GL_RGB, GL_HALF_FLOAT, img.pixels.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    printf("Loaded HDR texture: %s as tid %d\n", path.c_str(), tid);
+    printf("Loaded HDR texture: %s (%ux%u) as tid %d in %.2f ms\n", path.c_str(), img.w, img.h, tid, rwtm_to_ms(rwtm_now() - start));
   } else {
     printf("ERROR: HDR texture could not be not loaded %s\n", path.c_str());
   }
-  stbi_image_free(data);
   return tid;
 }
 
@@ -292,7 +245,7 @@ uint32_t create_env_map(Shader &env_shader, const std::string &hdr_path) {
   uint32_t capture_rb;
   glGenFramebuffers(1, &capture_fb);
   glGenRenderbuffers(1, &capture_rb);
-  glBindFramebuffer(GL_FRAMEBUFFER, capture_fb);
+  gl_bind_framebuffer(GL_FRAMEBUFFER, capture_fb);
   glBindRenderbuffer(GL_RENDERBUFFER, capture_rb);
   glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, 512, 512);
   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, capture_rb);
@@ -300,7 +253,7 @@ uint32_t create_env_map(Shader &env_shader, const std::string &hdr_path) {
   uint32_t hdr_tid = load_hdr_texture(hdr_path);
   uint32_t cube_map_tid;
   glGenTextures(1, &cube_map_tid);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, cube_map_tid);
+  gl_bind_texture(GL_TEXTURE_CUBE_MAP, cube_map_tid);
   for (int i = 0; i < 6; i++) {
     glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 512, 512, 0, GL_RGB, GL_FLOAT, NULL);
   }
@@ -313,8 +266,8 @@ uint32_t create_env_map(Shader &env_shader, const std::string &hdr_path) {
   env_shader.use();
   env_shader.set_unif_1i("equirectangular_map", 0);
   env_shader.set_unif_mat4("u_projection", &capture_persp_mat);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, hdr_tid);
+  gl_active_texture(GL_TEXTURE0);
+  gl_bind_texture(GL_TEXTURE_2D, hdr_tid);
   glViewport(0, 0, 512, 512);
   for (int i = 0; i < 6; i++) {
     Mat4 view = get_view_mat(&capture_pos, &capture_targets[i], &capture_ups[i]);
@@ -324,9 +277,9 @@ uint32_t create_env_map(Shader &env_shader, const std::string &hdr_path) {
     render_cube();
   }
 
-  glDeleteFramebuffers(1, &capture_fb);
+  gl_delete_framebuffers(1, &capture_fb);
   glDeleteRenderbuffers(1, &capture_rb);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
 
   printf("Created environment map texture with tid %d\n", cube_map_tid);
   return cube_map_tid;
@@ -335,7 +288,7 @@ uint32_t create_env_map(Shader &env_shader, const std::string &hdr_path) {
 uint32_t create_irradiance_map(Shader &irr_shader, uint32 env_map_tid) {
   uint32_t irr_map_tid;
   glGenTextures(1, &irr_map_tid);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, irr_map_tid);
+  gl_bind_texture(GL_TEXTURE_CUBE_MAP, irr_map_tid);
   for (int i = 0; i < 6; i++) {
     glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 32, 32, 0, GL_RGB, GL_FLOAT, NULL);
   }
@@ -349,7 +302,7 @@ uint32_t create_irradiance_map(Shader &irr_shader, uint32 env_map_tid) {
   uint32_t capture_rb;
   glGenFramebuffers(1, &capture_fb);
   glGenRenderbuffers(1, &capture_rb);
-  glBindFramebuffer(GL_FRAMEBUFFER, capture_fb);
+  gl_bind_framebuffer(GL_FRAMEBUFFER, capture_fb);
   glBindRenderbuffer(GL_RENDERBUFFER, capture_rb);
   glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 32, 32);
   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, capture_rb);
@@ -357,8 +310,8 @@ uint32_t create_irradiance_map(Shader &irr_shader, uint32 env_map_tid) {
   irr_shader.use();
   irr_shader.set_unif_1i("environment_map", 0);
   irr_shader.set_unif_mat4("u_projection", &capture_persp_mat);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, env_map_tid);
+  gl_active_texture(GL_TEXTURE0);
+  gl_bind_texture(GL_TEXTURE_CUBE_MAP, env_map_tid);
   glViewport(0, 0, 32, 32);
   for (int i = 0; i < 6; i++) {
     Mat4 view = get_view_mat(&capture_pos, &capture_targets[i], &capture_ups[i]);
@@ -368,9 +321,9 @@ uint32_t create_irradiance_map(Shader &irr_shader, uint32 env_map_tid) {
     render_cube();
   }
 
-  glDeleteFramebuffers(1, &capture_fb);
+  gl_delete_framebuffers(1, &capture_fb);
   glDeleteRenderbuffers(1, &capture_rb);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
 
   printf("Created irradiance map texture with tid %d\n", irr_map_tid);
 
@@ -382,12 +335,12 @@ uint32_t create_prefilter_map(Shader &prefilter_shader, uint32_t env_map_tid) {
   uint32_t capture_rb;
   glGenFramebuffers(1, &capture_fb);
   glGenRenderbuffers(1, &capture_rb);
-  glBindFramebuffer(GL_FRAMEBUFFER, capture_fb);
+  gl_bind_framebuffer(GL_FRAMEBUFFER, capture_fb);
   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, capture_rb);
 
   uint32_t prefilter_map_tid;
   glGenTextures(1, &prefilter_map_tid);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, prefilter_map_tid);
+  gl_bind_texture(GL_TEXTURE_CUBE_MAP, prefilter_map_tid);
   for (int i = 0; i < 6; i++) {
     glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 128, 128, 0, GL_RGB, GL_FLOAT, NULL);
   }
@@ -401,9 +354,9 @@ uint32_t create_prefilter_map(Shader &prefilter_shader, uint32_t env_map_tid) {
   prefilter_shader.use();
   prefilter_shader.set_unif_1i("environment_map", 0);
   prefilter_shader.set_unif_mat4("u_projection", &capture_persp_mat);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, env_map_tid);
-  glBindFramebuffer(GL_FRAMEBUFFER, capture_fb);
+  gl_active_texture(GL_TEXTURE0);
+  gl_bind_texture(GL_TEXTURE_CUBE_MAP, env_map_tid);
+  gl_bind_framebuffer(GL_FRAMEBUFFER, capture_fb);
   constexpr uint32_t max_mip_level = 5;
   for (int mip = 0; mip < max_mip_level; mip++) {
     uint32_t mip_width = 128 * std::pow(0.5, mip);
@@ -423,9 +376,9 @@ uint32_t create_prefilter_map(Shader &prefilter_shader, uint32_t env_map_tid) {
     }
   }
 
-  glDeleteFramebuffers(1, &capture_fb);
+  gl_delete_framebuffers(1, &capture_fb);
   glDeleteRenderbuffers(1, &capture_rb);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
 
   printf("Created prefilter map texture with tid %d\n", prefilter_map_tid);
 
@@ -435,7 +388,7 @@ uint32_t create_prefilter_map(Shader &prefilter_shader, uint32_t env_map_tid) {
 uint32_t create_brdf_lut(Shader &brdf_shader) {
   uint32_t brdf_tid;
   glGenTextures(1, &brdf_tid);
-  glBindTexture(GL_TEXTURE_2D, brdf_tid);
+  gl_bind_texture(GL_TEXTURE_2D, brdf_tid);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, 512, 512, 0, GL_RG, GL_FLOAT, 0);
 
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -447,7 +400,7 @@ uint32_t create_brdf_lut(Shader &brdf_shader) {
   uint32_t capture_rb;
   glGenFramebuffers(1, &capture_fb);
   glGenRenderbuffers(1, &capture_rb);
-  glBindFramebuffer(GL_FRAMEBUFFER, capture_fb);
+  gl_bind_framebuffer(GL_FRAMEBUFFER, capture_fb);
   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, capture_rb);
   glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, brdf_tid, 0);
@@ -457,69 +410,15 @@ uint32_t create_brdf_lut(Shader &brdf_shader) {
   brdf_shader.use();
   render_quad();
 
-  glDeleteFramebuffers(1, &capture_fb);
+  gl_delete_framebuffers(1, &capture_fb);
   glDeleteRenderbuffers(1, &capture_rb);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
 
   printf("Created BRDF LUT texture with tid %d\n", brdf_tid);
 
   return brdf_tid;
 }
 
-GBuffer create_g_buffer() {
-  GBuffer result;
-  glGenFramebuffers(1, &result.fbo);
-  glBindFramebuffer(GL_FRAMEBUFFER, result.fbo);
-  glGenTextures(1, &result.g_pos);
-  glBindTexture(GL_TEXTURE_2D, result.g_pos);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGB, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, result.g_pos, 0);
-  glGenTextures(1, &result.g_normal);
-  glBindTexture(GL_TEXTURE_2D, result.g_normal);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGB, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, result.g_normal, 0);
-  glGenTextures(1, &result.g_albedo);
-  glBindTexture(GL_TEXTURE_2D, result.g_albedo);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGB, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, result.g_albedo, 0);
-  glGenTextures(1, &result.g_metallic);
-  glBindTexture(GL_TEXTURE_2D, result.g_metallic);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGB, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, result.g_metallic, 0);
-  glGenTextures(1, &result.g_roughness);
-  glBindTexture(GL_TEXTURE_2D, result.g_roughness);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGB, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT4, GL_TEXTURE_2D, result.g_roughness, 0);
-  glGenTextures(1, &result.g_ao);
-  glBindTexture(GL_TEXTURE_2D, result.g_ao);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGB, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT5, GL_TEXTURE_2D, result.g_ao, 0);
-  uint32_t attachments[6] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3, GL_COLOR_ATTACHMENT4, GL_COLOR_ATTACHMENT5 };
-  glDrawBuffers(6, attachments);
-  glGenRenderbuffers(1, &result.rbo);
-  glBindRenderbuffer(GL_RENDERBUFFER, result.rbo);
-  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, SCREEN_WIDTH, SCREEN_HEIGHT);
-  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, result.rbo);
-  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-    printf("g-buffer not created properly\n");
-  }
-
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-  return result;
-}
-
 void set_clear_color(int state) {
   switch (state) {
     case 0:
@@ -540,8 +439,186 @@ void set_clear_color(int state) {
   }
 }
 
+// Frame prep jobs, see the graph in main. Each one is a single task, the parallel
+// parts (scene update, soft occlusion, packet generation) fan out from inside.
+static void camera_job(uint32_t start, uint32_t end, uint32_t threadnum, void *args) {
+  FramePrep *fp = (FramePrep *) args;
+  Camera &camera = *fp->camera;
+  if (fp->is_bench) {
+    // Fixed dt so every run sees exactly the same camera positions
+    Vec3 pos, target;
+    camera_path_sample(fp->camera_path, fp->path_time, &pos, &target);
+    camera.look_at(pos, target);
+    fp->path_time += fp->bench_dt_ms / 1000.0f;
+  } else {
+    fp->tick_accumulator += fp->dt_ms;
+    int num_ticks = 0;
+    while (fp->tick_accumulator >= SKIP_TICKS && num_ticks < MAX_FRAMESKIP) {
+      camera.begin_tick();
+      camera.update(SKIP_TICKS);
+      if (fp->is_recording_path) {
+        fp->camera_path->keys.push_back({ fp->path_time, camera.pos, camera.target });
+        fp->path_time += SKIP_TICKS / 1000.0f;
+      }
+      fp->tick_accumulator -= SKIP_TICKS;
+      num_ticks++;
+    }
+    if (num_ticks == MAX_FRAMESKIP) {
+      // We're too far behind (breakpoint, window drag, hitch). Drop the backlog
+      // instead of spending the next frames catching up.
+      fp->tick_accumulator = 0.0f;
+    }
+    camera.interpolate(fp->tick_accumulator / SKIP_TICKS);
+  }
+  fp->view_proj = mat4_mult(&camera.persp_mat, &camera.view_mat);
+
+  fp->frame_uniforms = ring_buffer_alloc(fp->frame_ring, sizeof(FrameUniforms));
+  if (fp->frame_uniforms.ptr) {
+    FrameUniforms u = {};
+    u.view = camera.view_mat;
+    u.projection = camera.persp_mat;
+    u.cam_pos[0] = camera.render_pos.x;
+    u.cam_pos[1] = camera.render_pos.y;
+    u.cam_pos[2] = camera.render_pos.z;
+    u.render_scale[0] = fp->render_scale[0];
+    u.render_scale[1] = fp->render_scale[1];
+    memcpy(fp->frame_uniforms.ptr, &u, sizeof(u));
+  }
+}
+
+static void transforms_job(uint32_t start, uint32_t end, uint32_t threadnum, void *args) {
+  FramePrep *fp = (FramePrep *) args;
+  Scene &scene = *fp->scene;
+  if (scene_update(&scene.graph) > 0) {
+    std::vector<Aabb> &instance_boxes = *fp->instance_boxes;
+    std::vector<uint32_t> &changed = *fp->changed_instances;
+    changed.clear();
+    for (uint32_t node : scene.graph.changed_nodes) {
+      if (scene.node_instance[node] >= 0) {
+        changed.push_back(scene.node_instance[node]);
+      }
+    }
+    aabb_transform_indexed(scene.instance_bounds.data(), scene.graph.world.data(), scene.instance_nodes.data(), instance_boxes.data(),
+                           changed.data(), (uint32_t) changed.size());
+    // NOTE(ray): Still a full rebuild, a refit would only have to walk the changed leaves up
+    bvh_build(fp->instance_bvh, instance_boxes.data(), instance_boxes.size());
+    gpu_scene_update(fp->gpu_scene, &scene, instance_boxes.data(), changed.data(), (uint32_t) changed.size());
+    shadows_check_static(fp->shadows, &scene);
+  }
+}
+
+// Culled instances never reach GL
+static void cull_job(uint32_t start, uint32_t end, uint32_t threadnum, void *args) {
+  FramePrep *fp = (FramePrep *) args;
+  Scene &scene = *fp->scene;
+  std::vector<uint32_t> &visible_instances = *fp->visible_instances;
+  Frustum frustum = frustum_from_matrix(&fp->view_proj);
+  visible_instances.clear();
+  bvh_cull(fp->instance_bvh, &frustum, visible_instances);
+
+  if (fp->occlusion_mode == OcclusionMode::CPU) {
+    // An occluder sits inside its own instance, so the instance never hides itself
+    SoftOcclusion *so = fp->soft_occlusion;
+    soft_occlusion_begin(so, &fp->view_proj);
+    for (uint32_t idx : visible_instances) {
+      SceneInstance &inst = scene.instances[idx];
+      if (inst.occluder >= 0) {
+        Mat4 mvp = mat4_mult(&fp->view_proj, &scene.graph.world[inst.node]);
+        soft_occlusion_add(so, &scene.occluders[inst.occluder], &mvp);
+      }
+    }
+    soft_occlusion_rasterize(so);
+    size_t num_visible = 0;
+    for (uint32_t idx : visible_instances) {
+      if (soft_occlusion_test(so, &(*fp->instance_boxes)[idx])) {
+        visible_instances[num_visible++] = idx;
+      }
+    }
+    visible_instances.resize(num_visible);
+  }
+}
+
+static void packets_job(uint32_t start, uint32_t end, uint32_t threadnum, void *args) {
+  FramePrep *fp = (FramePrep *) args;
+  render_queue_begin(fp->render_queue);
+  gpu_scene_queue(fp->gpu_scene, fp->render_queue, *fp->visible_instances, fp->geometry_program, fp->camera->render_pos, fp->camera->far_z);
+  render_queue_sort(fp->render_queue);
+  gpu_scene_write_draws(fp->gpu_scene, fp->frame_ring);
+}
+
 int main(int argc, char* argv[]) {
+  // Benchmark mode: --bench <camera path> <num frames> [report prefix]
+  // Regression check: --bench-compare <baseline.json> <current.json> [threshold %]
+  // Input capture: --record-input <file> or --replay-input <file>
+  // Frame pacing: --pacing <uncapped|limit|vsync|adaptive> [--fps <target>]
+  // Scenes: --scene <file.scene|file.sceneb>, --compile-scene <in.scene> <out.sceneb>
+  // Occlusion culling: --occlusion <gpu|cpu|off>
+  // Materials: --no-bindless uses the texture arrays even where ARB_bindless_texture is available
+  // Dynamic resolution: --dynres <GPU budget in ms>
+  const char *bench_path_file = NULL;
+  const char *scene_file = "assets/scenes/default.scene";
+  const char *record_input_file = NULL;
+  const char *replay_input_file = NULL;
+  const char *bench_report_prefix = "bench";
+  uint32_t bench_num_frames = 0;
+  PacingMode pacing_mode = PacingMode::UNCAPPED;
+  float target_fps = 60.0f;
+  OcclusionMode occlusion_mode = OcclusionMode::GPU;
+  float dynres_budget_ms = 0.0f;
+  bool allow_bindless = true;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--bench-compare") == 0 && i + 2 < argc) {
+      float threshold = i + 3 < argc ? (float) atof(argv[i+3]) : 5.0f;
+      return bench_compare(argv[i+1], argv[i+2], threshold) == 0 ? 0 : 1;
+    } else if (strcmp(argv[i], "--compile-scene") == 0 && i + 2 < argc) {
+      SceneDesc desc;
+      return scene_load_text(&desc, argv[i+1]) && scene_save_binary(&desc, argv[i+2]) ? 0 : 1;
+    } else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc) {
+      scene_file = argv[i+1];
+    } else if (strcmp(argv[i], "--bench") == 0 && i + 2 < argc) {
+      bench_path_file = argv[i+1];
+      bench_num_frames = atoi(argv[i+2]);
+      if (i + 3 < argc && argv[i+3][0] != '-') {
+        bench_report_prefix = argv[i+3];
+      }
+    } else if (strcmp(argv[i], "--record-input") == 0 && i + 1 < argc) {
+      record_input_file = argv[i+1];
+    } else if (strcmp(argv[i], "--replay-input") == 0 && i + 1 < argc) {
+      replay_input_file = argv[i+1];
+    } else if (strcmp(argv[i], "--pacing") == 0 && i + 1 < argc) {
+      const char *mode = argv[i+1];
+      if (strcmp(mode, "limit") == 0) {
+        pacing_mode = PacingMode::LIMIT;
+      } else if (strcmp(mode, "vsync") == 0) {
+        pacing_mode = PacingMode::VSYNC;
+      } else if (strcmp(mode, "adaptive") == 0) {
+        pacing_mode = PacingMode::ADAPTIVE_VSYNC;
+      }
+    } else if (strcmp(argv[i], "--occlusion") == 0 && i + 1 < argc) {
+      const char *mode = argv[i+1];
+      if (strcmp(mode, "cpu") == 0) {
+        occlusion_mode = OcclusionMode::CPU;
+      } else if (strcmp(mode, "off") == 0) {
+        occlusion_mode = OcclusionMode::OFF;
+      }
+    } else if (strcmp(argv[i], "--no-bindless") == 0) {
+      allow_bindless = false;
+    } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+      target_fps = (float) atof(argv[i+1]);
+    } else if (strcmp(argv[i], "--dynres") == 0 && i + 1 < argc) {
+      dynres_budget_ms = (float) atof(argv[i+1]);
+    }
+  }
+  bool is_bench = bench_path_file != NULL;
   rwtm_init();
+
+  // Parse before creating the window so a bad scene fails fast
+  SceneDesc scene_desc;
+  uint64_t scene_load_start = rwtm_now();
+  if (!scene_load(&scene_desc, scene_file)) {
+    return 1;
+  }
+
   puts("Hello");
   SDL_Init(SDL_INIT_EVERYTHING);
   SDL_GL_SetAttribute(SDL_GL_ACCELERATED_VISUAL, 1);
@@ -556,14 +633,29 @@ int main(int argc, char* argv[]) {
   win = SDL_CreateWindow("render3d_01", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
   gl_context = SDL_GL_CreateContext(win);
   gladLoadGLLoader(SDL_GL_GetProcAddress);
+  gl_state_invalidate();
   printf("Vendor:   %s\n", glGetString(GL_VENDOR));
   printf("Renderer: %s\n", glGetString(GL_RENDERER));
   printf("Version:  %s\n", glGetString(GL_VERSION));
 
-  glEnable(GL_DEPTH_TEST);
-  glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+  gl_enable(GL_DEPTH_TEST);
+  gl_enable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+  g_pTS = enkiNewTaskScheduler();
+  enkiInitTaskScheduler(g_pTS);
+
+  // Drawable size, which is bigger than the window size on high DPI displays
+  int screen_w, screen_h;
+  SDL_GL_GetDrawableSize(win, &screen_w, &screen_h);
+
+  FrameCapture frame_capture;
+  capture_init(&frame_capture, g_pTS, screen_w, screen_h, "capture");
 
-  GBuffer g_buffer = create_g_buffer();
+  // Every frame is declared as a render graph, its targets come out of the pool
+  RenderTargetPool render_targets;
+  render_target_pool_init(&render_targets);
+  RenderGraph render_graph;
+  render_graph_init(&render_graph, &render_targets);
   // Load textures
   // TODO(ray): Load these on another thread
 #if 0
@@ -582,27 +674,14 @@ int main(int argc, char* argv[]) {
   concrete.ao_tid = load_texture("assets/concrete/concrete_floor_02_AO_1k.jpg");
 #endif
 
-  PBRTextures aluminium;
-  aluminium.albedo_tid = load_texture("assets/scuffed_aluminum/Aluminum-Scuffed_basecolor.png");
-  aluminium.normal_tid = load_texture("assets/scuffed_aluminum/Aluminum-Scuffed_normal.png");
-  aluminium.metallic_tid = load_texture("assets/scuffed_aluminum/Aluminum-Scuffed_metallic.png");
-  aluminium.roughness_tid = load_texture("assets/scuffed_aluminum/Aluminum-Scuffed_roughness.png");
-  aluminium.ao_tid = load_texture("assets/scuffed_aluminum/Aluminum-Scuffed_metallic.png");
-
   uint32_t cube_map_tid = load_cubemap("assets/skybox");
 
-  // Load obj
-  MeshFull cerberus;
-  cerberus.to_mesh = tinyobj_load("assets/cerberus/cerberus.obj");
-  cerberus.textures.albedo_tid = load_texture("assets/cerberus/Cerberus_A.tga");
-  cerberus.textures.normal_tid = load_texture("assets/cerberus/Cerberus_N.tga");
-  cerberus.textures.metallic_tid = load_texture("assets/cerberus/Cerberus_M.tga");
-  cerberus.textures.roughness_tid = load_texture("assets/cerberus/Cerberus_R.tga");
-  cerberus.textures.ao_tid = load_texture("assets/cerberus/Cerberus_AO.tga");
-
-  MeshFull bunny;
-  bunny.to_mesh = tinyobj_load("assets/bunny.obj");
-  bunny.textures = aluminium;
+  AssetCache asset_cache;
+  Scene scene;
+  scene_instantiate(&scene_desc, &asset_cache, g_pTS, &scene);
+  printf("Scene %s ready in %.2f ms\n", scene_file, rwtm_to_ms(rwtm_now() - scene_load_start));
+  // Only the forward path has a limit, the deferred one draws a volume per light
+  int num_lights = scene.lights.size() < MAX_SCENE_LIGHTS ? (int) scene.lights.size() : MAX_SCENE_LIGHTS;
 
   // Load shader
   Shader basic_s = Shader("shaders/basic.vert", "shaders/basic_pbr.frag");
@@ -617,10 +696,49 @@ int main(int argc, char* argv[]) {
   Shader prefilter_s = Shader("shaders/cubemap.vert", "shaders/prefilter_convolution.frag");
   Shader brdf_s = Shader("shaders/quad.vert", "shaders/brdf.frag");
   Shader solid_s = Shader("shaders/logl_pbr.vert", "shaders/solid.frag");
-  Shader deferred_geometry_s = Shader("shaders/logl_pbr.vert", "shaders/deferred_geometry.frag");
+  // Materials are looked up by id in the geometry pass, through bindless handles if the driver has them
+  bool use_bindless = allow_bindless && GLAD_GL_ARB_bindless_texture;
+  MaterialTable material_table;
+  material_table_build(&material_table, scene.materials, use_bindless);
+  Shader deferred_geometry_s = Shader("shaders/gpu_driven.vert", use_bindless ? "shaders/deferred_geometry_bindless.frag" : "shaders/deferred_geometry.frag");
+  if (!use_bindless) {
+    deferred_geometry_s.use();
+    for (int i = 0; i < MATERIAL_MAX_ARRAYS; i++) {
+      std::string name = "u_material_arrays[" + std::to_string(i) + "]";
+      deferred_geometry_s.set_unif_1i(name.c_str(), i);
+    }
+  }
   Shader deferred_pbr_s = Shader("shaders/deferred_pbr.vert", "shaders/deferred_pbr.frag");
-
-  uint32_t env_map_tid = create_env_map(env_s, "assets/Tokyo_BigSight_3k.hdr");
+  Shader light_stencil_s = Shader("shaders/light_volume.vert", "shaders/light_stencil.frag");
+  Shader light_volume_s = Shader("shaders/light_volume.vert", "shaders/light_volume.frag");
+  Shader shadow_depth_s = Shader("shaders/shadow_depth.vert", "shaders/shadow_depth.frag");
+  Shader hiz_reduce_s = Shader("shaders/hiz_reduce.comp");
+  Shader occlusion_cull_s = Shader("shaders/occlusion_cull.comp");
+
+  // Samplers never change units and the lights don't move, so none of it is set per frame
+  quad_s.use();
+  quad_s.set_unif_1i("screen_tex", 0);
+  deferred_pbr_s.use();
+  deferred_pbr_s.set_unif_1i("g_position", 0);
+  deferred_pbr_s.set_unif_1i("g_normal", 1);
+  deferred_pbr_s.set_unif_1i("g_albedo", 2);
+  deferred_pbr_s.set_unif_1i("g_metallic", 3);
+  deferred_pbr_s.set_unif_1i("g_roughness", 4);
+  deferred_pbr_s.set_unif_1i("g_ao", 5);
+  deferred_pbr_s.set_unif_1i("u_irradiance_map", 6);
+  deferred_pbr_s.set_unif_1i("u_prefilter_map", 7);
+  deferred_pbr_s.set_unif_1i("u_brdf_lut", 8);
+  deferred_pbr_s.set_unif_1i("u_light_accum", 9);
+  deferred_pbr_s.set_unif_1i("u_sun_shadow", 10);
+  light_volume_s.use();
+  light_volume_s.set_unif_1i("g_pos", 0);
+  light_volume_s.set_unif_1i("g_normal", 1);
+  light_volume_s.set_unif_1i("g_albedo", 2);
+  light_volume_s.set_unif_1i("g_metallic", 3);
+  light_volume_s.set_unif_1i("g_roughness", 4);
+  light_volume_s.set_unif_1i("u_point_shadows", 5);
+
+  uint32_t env_map_tid = create_env_map(env_s, scene.env_hdr);
   //uint32_t env_map_tid = create_env_map(env_s, "assets/20_Subway_Lights_3k.hdr");
   uint32_t irradiance_map_tid = create_irradiance_map(irradiance_map_s, env_map_tid);
   uint32_t prefilter_map_tid = create_prefilter_map(prefilter_s, env_map_tid);
@@ -639,52 +757,55 @@ int main(int argc, char* argv[]) {
   cur_shader->set_unif_1i("u_prefilter_map", 6);
   cur_shader->set_unif_1i("u_brdf_lut", 7);
 
-  glActiveTexture(GL_TEXTURE5);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, irradiance_map_tid);
-  glActiveTexture(GL_TEXTURE6);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, prefilter_map_tid);
-  glActiveTexture(GL_TEXTURE7);
-  glBindTexture(GL_TEXTURE_2D, brdf_lut_tid);
-
-  // Create another framebuffer to render to
-  uint32_t fb;
-  glGenFramebuffers(1, &fb);
-  glBindFramebuffer(GL_FRAMEBUFFER, fb);
-  // Create texture
-  uint32_t tex_color_buf, tex_depth_buf;
-  glGenTextures(1, &tex_color_buf);
-  printf("tex_color_buf tid: %d\n", tex_color_buf);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, tex_color_buf);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, SCREEN_WIDTH, SCREEN_HEIGHT, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex_color_buf, 0);
-
-  // Using a renderbuffer instead
-  uint32_t rbo;
-  glGenRenderbuffers(1, &rbo);
-  glBindRenderbuffer(GL_RENDERBUFFER, rbo);
-  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, SCREEN_WIDTH, SCREEN_HEIGHT);
-  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rbo);
-
-  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-    printf("Error: Framebuffer %d is not complete\n", fb);
-    return 1;
-  }
+  gl_active_texture(GL_TEXTURE5);
+  gl_bind_texture(GL_TEXTURE_CUBE_MAP, irradiance_map_tid);
+  gl_active_texture(GL_TEXTURE6);
+  gl_bind_texture(GL_TEXTURE_CUBE_MAP, prefilter_map_tid);
+  gl_active_texture(GL_TEXTURE7);
+  gl_bind_texture(GL_TEXTURE_2D, brdf_lut_tid);
 
   // Create the camera
-  Camera camera = Camera(rwm_v3_init(0,2,15), rwm_v3_init(0,0,-1), rwm_v3_init(0,1.0,0), 45.0, 0.1, 100.0, ASPECT_RATIO);
+  Camera camera = Camera(rwm_v3_init(0,2,15), rwm_v3_init(0,0,-1), rwm_v3_init(0,1.0,0), 45.0, 0.1, 100.0, (float) screen_w / screen_h);
   puts("main view_mat");
   rwm_m4_puts(&(camera.persp_mat));
   cur_shader->set_unif_mat4("u_view", &camera.view_mat);
   cur_shader->set_unif_mat4("u_projection", &camera.persp_mat);
 
-  int w, h;
-  SDL_GetWindowSize(win, &w, &h);
-  glViewport(0, 0, w, h);
-
-  SDL_GL_SetSwapInterval(0);
+  glViewport(0, 0, screen_w, screen_h);
+
+  // Benchmarks always run uncapped
+  FramePacer pacer;
+  pacer_init(&pacer, is_bench ? PacingMode::UNCAPPED : pacing_mode, target_fps);
+
+  GpuTimers gpu_timers;
+  gpu_timers_init(&gpu_timers);
+  DynamicResolution dynres;
+  dynres_init(&dynres, dynres_budget_ms);
+  // Below full scale the present pass stretches the rendered part over the window
+  GLuint upscale_sampler;
+  glGenSamplers(1, &upscale_sampler);
+  glSamplerParameteri(upscale_sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glSamplerParameteri(upscale_sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glSamplerParameteri(upscale_sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glSamplerParameteri(upscale_sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  CameraPath camera_path;
+  BenchRun bench_run;
+  bool is_recording_path = false;
+  if (is_bench) {
+    if (!camera_path_load(&camera_path, bench_path_file)) {
+      return 1;
+    }
+    bench_run.path_name = bench_path_file;
+    bench_run.num_frames = bench_num_frames;
+    bench_run.dt_ms = 1000.0f / TICKS_PER_SECOND;
+  }
+  if (replay_input_file && !input_replay_begin(replay_input_file)) {
+    return 1;
+  }
+  if (record_input_file && !input_record_begin(record_input_file)) {
+    return 1;
+  }
 
   uint64_t cur_time = rwtm_now();
   uint64_t frame_time = 0;
@@ -693,29 +814,94 @@ int main(int argc, char* argv[]) {
   bool is_next_shader_logl = true;
   bool holding_2 = false;
 
-  Vec3 light_positions[] = {
-    rwm_v3_init(-9.0f,  9.0f, 9.0f),
-    rwm_v3_init( 9.0f,  9.0f, 9.0f),
-    rwm_v3_init(-9.0f, -9.0f, 9.0f),
-    rwm_v3_init( 9.0f, -9.0f, 9.0f),
-  };
-  Vec3 light_colors[] = {
-    rwm_v3_init(100.0f, 300.0f, 300.0f),
-    rwm_v3_init(300.0f, 147.0f, 0.0f),
-    rwm_v3_init(300.0f, 300.0f, 300.0f),
-    rwm_v3_init(300.0f, 300.0f, 300.0f)
-  };
-
-  constexpr int num_rows = 7;
-  constexpr int num_cols = 7;
-  constexpr float spacing = 2.5;
   bool use_texture_pbr = true;
+
+  // World space boxes of every instance, rebuilt into the BVH whenever a transform changes
+  std::vector<Aabb> instance_boxes(scene.instances.size());
+  std::vector<uint32_t> changed_instances;
+  changed_instances.reserve(scene.instances.size());
+  InstanceBvh instance_bvh;
+  std::vector<uint32_t> visible_instances;
+  visible_instances.reserve(scene.instances.size());
+
+  // Instances that survive the frustum are drawn indirectly, the Hi-Z pass decides
+  // on the GPU whether each draw has any instances. F7 cycles GPU, CPU and no occlusion culling.
+  OcclusionCuller occlusion;
+  occlusion_init(&occlusion, &hiz_reduce_s, &occlusion_cull_s, screen_w, screen_h);
+  occlusion.enabled = occlusion_mode == OcclusionMode::GPU;
+  SoftOcclusion soft_occlusion;
+  soft_occlusion_init(&soft_occlusion, g_pTS);
+  LightVolumes light_volumes;
+  light_volumes_init(&light_volumes);
+  // The G-buffer pass is a single multi-draw out of the mesh arena
+  GpuScene gpu_scene;
+  gpu_scene_build(&gpu_scene, &scene, &asset_cache, &occlusion);
+  // Cube faces are laid out like the environment captures
+  Shadows shadows;
+  shadows_init(&shadows, &shadow_depth_s, &scene, &gpu_scene, capture_targets, capture_ups);
+  // Draw packets of every pass, generated across the workers and sorted by state then depth
+  RenderQueue render_queue;
+  render_queue_init(&render_queue, g_pTS);
+
+  // Per-frame uniforms and draw data, memcpy'd in by the frame prep jobs
+  RingBuffer frame_ring;
+  if (!ring_buffer_init(&frame_ring, sizeof(FrameUniforms) + sizeof(DrawData) * (uint32_t) scene.instances.size() + 4096)) {
+    return 1;
+  }
+
+  // Frame prep as a job graph: camera and transforms in parallel, then culling,
+  // then the geometry packets. The GL thread only consumes the sorted queue.
+  FramePrep frame_prep = {};
+  frame_prep.camera = &camera;
+  frame_prep.frame_ring = &frame_ring;
+  frame_prep.camera_path = &camera_path;
+  frame_prep.bench_dt_ms = bench_run.dt_ms;
+  frame_prep.is_bench = is_bench;
+  frame_prep.scene = &scene;
+  frame_prep.asset_cache = &asset_cache;
+  frame_prep.instance_boxes = &instance_boxes;
+  frame_prep.changed_instances = &changed_instances;
+  frame_prep.instance_bvh = &instance_bvh;
+  frame_prep.gpu_scene = &gpu_scene;
+  frame_prep.shadows = &shadows;
+  frame_prep.soft_occlusion = &soft_occlusion;
+  frame_prep.visible_instances = &visible_instances;
+  frame_prep.render_queue = &render_queue;
+  frame_prep.geometry_program = deferred_geometry_s.id;
+  JobGraph frame_graph;
+  job_graph_init(&frame_graph, g_pTS);
+  uint32_t camera_job_id = job_graph_add(&frame_graph, "camera", camera_job, &frame_prep, {});
+  uint32_t transforms_job_id = job_graph_add(&frame_graph, "transforms", transforms_job, &frame_prep, {});
+  uint32_t cull_job_id = job_graph_add(&frame_graph, "cull", cull_job, &frame_prep, { camera_job_id, transforms_job_id });
+  job_graph_add(&frame_graph, "packets", packets_job, &frame_prep, { cull_job_id });
+
   while (!quit) {
     int64_t new_time = rwtm_now();
     frame_time = new_time - cur_time;
     cur_time = new_time;
+    g_render_stats = {};
+
+    float dt_ms = rwtm_to_ms(frame_time);
+    process_raw_input(&quit, &dt_ms);
+    if (replay_input_file && !is_input_replaying()) {
+      quit = true;
+    }
 
-    process_raw_input(&quit);
+    // Minimized windows report 0x0, keep the old size until it comes back. The
+    // render graph picks up the new size, the old targets age out of the pool.
+    if (is_window_resized()) {
+      int w, h;
+      SDL_GL_GetDrawableSize(win, &w, &h);
+      if (w > 0 && h > 0 && (w != screen_w || h != screen_h)) {
+        screen_w = w;
+        screen_h = h;
+        occlusion_resize(&occlusion, screen_w, screen_h);
+        capture_resize(&frame_capture, screen_w, screen_h);
+        camera.set_aspect((float) screen_w / screen_h);
+        glViewport(0, 0, screen_w, screen_h);
+        printf("Resized to %dx%d\n", screen_w, screen_h);
+      }
+    }
 
     if (is_down(SDL_SCANCODE_ESCAPE)) {
       quit = true;
@@ -733,9 +919,9 @@ int main(int argc, char* argv[]) {
     }
     if (is_pressed(SDL_SCANCODE_3)) {
       if (is_next_state_wire) {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+        gl_polygon_mode(GL_LINE);
       } else {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        gl_polygon_mode(GL_FILL);
       }
       is_next_state_wire = !is_next_state_wire;
     }
@@ -765,245 +951,366 @@ int main(int argc, char* argv[]) {
       use_texture_pbr = true;
     }
 
+    // F9 records whatever the current debug view shows, F10 records raw video frames
+    if (is_pressed(SDL_SCANCODE_F9) || is_pressed(SDL_SCANCODE_F10)) {
+      if (frame_capture.is_recording) {
+        capture_end(&frame_capture);
+      } else if (is_pressed(SDL_SCANCODE_F10)) {
+        capture_begin(&frame_capture, CaptureFormat::RAW);
+      } else {
+        capture_begin(&frame_capture, state == 0 ? CaptureFormat::PNG : CaptureFormat::HDR);
+      }
+    }
+
+    if (is_pressed(SDL_SCANCODE_F7)) {
+      const char *names[] = { "gpu", "cpu", "off" };
+      occlusion_mode = (OcclusionMode) (((int) occlusion_mode + 1) % 3);
+      occlusion.enabled = occlusion_mode == OcclusionMode::GPU;
+      printf("Occlusion culling: %s\n", names[(int) occlusion_mode]);
+    }
+
     if (is_mouse_scrolling() != 0) {
       printf("SCROLLING %d\n", is_mouse_scrolling());
     }
 
-    camera.update(rwtm_to_ms(frame_time));
+    // F6 records the camera into a path file that --bench can replay
+    if (!is_bench && is_pressed(SDL_SCANCODE_F6)) {
+      if (is_recording_path) {
+        camera_path_save(&camera_path, "camera.path");
+      } else {
+        camera_path.keys.clear();
+        frame_prep.path_time = 0.0f;
+      }
+      is_recording_path = !is_recording_path;
+    }
 
+    // Targets stay at the window size, the scene passes only render the bottom-left
+    // render_w x render_h of them. Captures are always full size.
+    int render_w = screen_w;
+    int render_h = screen_h;
+    if (!frame_capture.is_recording) {
+      dynres_size(&dynres, screen_w, screen_h, &render_w, &render_h);
+    }
+    float render_scale_x = (float) render_w / screen_w;
+    float render_scale_y = (float) render_h / screen_h;
+
+    // Everything up to the final command list runs on the workers
+    ring_buffer_begin_frame(&frame_ring);
+    frame_prep.render_scale[0] = render_scale_x;
+    frame_prep.render_scale[1] = render_scale_y;
+    frame_prep.dt_ms = dt_ms;
+    frame_prep.is_recording_path = is_recording_path;
+    frame_prep.occlusion_mode = occlusion_mode;
+    job_graph_run(&frame_graph);
+    gpu_scene_upload(&gpu_scene, &occlusion);
+    Mat4 view_proj = frame_prep.view_proj;
+    if (frame_prep.frame_uniforms.ptr) {
+      RingAlloc &fu = frame_prep.frame_uniforms;
+      glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, fu.buffer, fu.offset, fu.size);
+    }
+    g_render_stats.instances_visible = visible_instances.size();
+    g_render_stats.instances_total = scene.instances.size();
+
+    // Outside the graph, the shadow maps persist across frames and are mostly cached
+    gpu_timers_begin(&gpu_timers, BENCH_PASS_SHADOWS);
+    shadows_render(&shadows, &scene, &gpu_scene, &camera);
+    gpu_timers_end(&gpu_timers);
+
+    // The frame as a render graph. Passes nothing reads from are culled, so the
+    // debug views only draw the G-buffer and the capture pass only runs when recording.
+    render_graph_begin(&render_graph, screen_w, screen_h);
+    uint32_t lit_color = render_graph_texture(&render_graph, "lit_color", screen_w, screen_h, GL_RGB8);
+    // What the present pass shows and F9/F10 capture
+    uint32_t shown = lit_color;
 #if 0
     // Forward rendering
-    glBindFramebuffer(GL_FRAMEBUFFER, fb);
-    glEnable(GL_DEPTH_TEST);
-    glClearColor(0.1, 0.1, 0.1, 1.0);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    cur_shader->use();
-
-    // Need to load the albedo map back in because we've replaced it when rendering the quad
-    if (!use_texture_pbr) {
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_CUBE_MAP, irradiance_map_tid);
-      glActiveTexture(GL_TEXTURE1);
-      glBindTexture(GL_TEXTURE_CUBE_MAP, prefilter_map_tid);
-      glActiveTexture(GL_TEXTURE2);
-      glBindTexture(GL_TEXTURE_2D, brdf_lut_tid);
+    uint32_t lit_depth = render_graph_texture(&render_graph, "lit_depth", screen_w, screen_h, GL_DEPTH24_STENCIL8);
+    uint32_t forward_pass = render_graph_add_pass(&render_graph, "forward");
+    render_graph_color(&render_graph, forward_pass, lit_color, RG_CLEAR);
+    render_graph_depth(&render_graph, forward_pass, lit_depth, RG_CLEAR, true);
+    render_graph_viewport(&render_graph, forward_pass, render_w, render_h);
+#else
+    // Deferred rendering
+    const char *g_names[6] = { "g_pos", "g_normal", "g_albedo", "g_metallic", "g_roughness", "g_ao" };
+    uint32_t g_colors[6];
+    for (int i = 0; i < 6; i++) {
+      g_colors[i] = render_graph_texture(&render_graph, g_names[i], screen_w, screen_h, GL_RGB16F);
     }
+    uint32_t g_depth = render_graph_texture(&render_graph, "g_depth", screen_w, screen_h, GL_DEPTH24_STENCIL8);
 
-    cur_shader->set_unif_3fv("u_cam_pos", &camera.pos);
-    cur_shader->set_unif_mat4("u_view", &camera.view_mat);
-    cur_shader->set_unif_mat4("u_projection", &camera.persp_mat);
-
-    Vec3 alb = rwm_v3_init(0.5f, 0, 0);
-    cur_shader->set_unif_3fv("u_albedo", &alb);
-    cur_shader->set_unif_1f("u_ao", 1.0f);
-    cur_shader->set_unif_1f("u_metallic", 0.8f);
-    cur_shader->set_unif_1f("u_roughness", 0.1f);
-
-    for (int i = 0; i < sizeof(light_positions) / sizeof(light_positions[0]); i++) {
-      std::string pos_name = "u_light_pos[" + std::to_string(i) + "]";
-      std::string col_name = "u_light_color[" + std::to_string(i) + "]";
-      cur_shader->set_unif_3fv(pos_name.c_str(), &light_positions[i]);
-      cur_shader->set_unif_3fv(col_name.c_str(), &light_colors[i]);
+    uint32_t geometry_pass = render_graph_add_pass(&render_graph, "geometry");
+    for (int i = 0; i < 6; i++) {
+      render_graph_color(&render_graph, geometry_pass, g_colors[i], RG_CLEAR);
+    }
+    render_graph_depth(&render_graph, geometry_pass, g_depth, RG_CLEAR, true);
+    render_graph_viewport(&render_graph, geometry_pass, render_w, render_h);
+
+    // Point and spot lights add up in HDR, each only over the pixels inside its volume.
+    // The stencil of the G-buffer depth does the rejection, the depth itself is read only.
+    uint32_t light_accum = render_graph_texture(&render_graph, "light_accum", screen_w, screen_h, GL_RGB16F);
+    uint32_t local_lights_pass = render_graph_add_pass(&render_graph, "local_lights");
+    for (int i = 0; i < 5; i++) {
+      render_graph_read(&render_graph, local_lights_pass, g_colors[i]);
+    }
+    render_graph_color(&render_graph, local_lights_pass, light_accum, RG_CLEAR);
+    render_graph_depth(&render_graph, local_lights_pass, g_depth, RG_LOAD, false);
+    render_graph_viewport(&render_graph, local_lights_pass, render_w, render_h);
+
+    // Lighting and sky share the G-buffer depth, read only. The depth test splits the
+    // screen between them, so together they cover every pixel and nothing is cleared.
+    uint32_t lighting_pass = render_graph_add_pass(&render_graph, "lighting");
+    for (int i = 0; i < 6; i++) {
+      render_graph_read(&render_graph, lighting_pass, g_colors[i]);
     }
+    render_graph_read(&render_graph, lighting_pass, light_accum);
+    render_graph_color(&render_graph, lighting_pass, lit_color, RG_DONT_CARE);
+    render_graph_depth(&render_graph, lighting_pass, g_depth, RG_LOAD, false);
+    render_graph_viewport(&render_graph, lighting_pass, render_w, render_h);
 
-    Transform ts = rwtr_trs(
-      rwm_v3_init(0.0, 0.0, 10.0),
-      rwm_v3_init(2.0, 2.0, 2.0),
-      RWTR_NO_AXIS, 0.0f
-    );
-    Quaternion q1 = rwm_q_init_rotation(rwm_v3_init(0.0, 1.0, 0.0), rwm_to_radians(-90.0f));
-    Quaternion q2 = rwm_q_init_rotation(rwm_v3_init(1.0, 0.0, 0.0), rwm_to_radians(45.0f));
-    Transform r = rwtr_init_rotate_q(rwm_q_mult(q1, q2));
-    Transform model_tr = rwtr_compose(&ts, &r);
-    cur_shader->set_unif_mat4("u_model", &model_tr.t);
-    render_mesh_full(cerberus);
-
-    model_tr = rwtr_trs(
-      rwm_v3_init(1.0, 0.0, 8.6),
-      rwm_v3_init(1.0, 1.0, 1.0),
-      RWTR_NO_AXIS, 0.0f
-    );
-    cur_shader->set_unif_mat4("u_model", &model_tr.t);
-    render_mesh_full(bunny);
-
-    //bind_pbr_textures(aluminium);
-    //render_plane();
-
-#if 1
-    bind_pbr_textures(aluminium);
-
-    for (int i = 0; i < num_rows; i++) {
-      float metallic = (float)i/(float)num_rows;
-      cur_shader->set_unif_1f("u_metallic", metallic);
-      for (int j = 0; j < num_cols; j++) {
-        float roughness = rwm_clamp((float)j/(float)num_cols, 0.05f, 1.0f);
-        cur_shader->set_unif_1f("u_roughness", roughness);
-        Mat4 model = rwm_m4_identity();
-        model.e[0][3] = (j - (num_cols/2)) * spacing;
-        model.e[1][3] = (i - (num_rows/2)) * spacing;
-        cur_shader->set_unif_mat4("u_model", &model);
-        render_sphere();
-      }
+    if (state > 0) {
+      shown = g_colors[state - 1];
     }
 #endif
+    uint32_t present_pass = render_graph_add_pass(&render_graph, "present");
+    render_graph_read(&render_graph, present_pass, shown);
+    render_graph_backbuffer(&render_graph, present_pass);
+    uint32_t capture_pass = render_graph_add_pass(&render_graph, "capture");
+    render_graph_read(&render_graph, capture_pass, shown);
+    if (frame_capture.is_recording) {
+      render_graph_side_effect(&render_graph, capture_pass);
+    }
+    render_graph_compile(&render_graph);
+
+#if 0
+    if (render_graph_begin_pass(&render_graph, forward_pass)) {
+      gl_enable(GL_DEPTH_TEST);
+      cur_shader->use();
+
+      // Need to load the albedo map back in because we've replaced it when rendering the quad
+      if (!use_texture_pbr) {
+        gl_active_texture(GL_TEXTURE0);
+        gl_bind_texture(GL_TEXTURE_CUBE_MAP, irradiance_map_tid);
+        gl_active_texture(GL_TEXTURE1);
+        gl_bind_texture(GL_TEXTURE_CUBE_MAP, prefilter_map_tid);
+        gl_active_texture(GL_TEXTURE2);
+        gl_bind_texture(GL_TEXTURE_2D, brdf_lut_tid);
+      }
+
+      cur_shader->set_unif_3fv("u_cam_pos", &camera.render_pos);
+      cur_shader->set_unif_mat4("u_view", &camera.view_mat);
+      cur_shader->set_unif_mat4("u_projection", &camera.persp_mat);
+
+      Vec3 alb = rwm_v3_init(0.5f, 0, 0);
+      cur_shader->set_unif_3fv("u_albedo", &alb);
+      cur_shader->set_unif_1f("u_ao", 1.0f);
+      cur_shader->set_unif_1f("u_metallic", 0.8f);
+      cur_shader->set_unif_1f("u_roughness", 0.1f);
+
+      for (int i = 0; i < num_lights; i++) {
+        std::string pos_name = "u_light_pos[" + std::to_string(i) + "]";
+        std::string col_name = "u_light_color[" + std::to_string(i) + "]";
+        cur_shader->set_unif_3fv(pos_name.c_str(), &scene.lights[i].pos);
+        cur_shader->set_unif_3fv(col_name.c_str(), &scene.lights[i].color);
+      }
 
-    // Render the light spheres
-    for (int i = 0; i < sizeof(light_positions) / sizeof(light_positions[0]); i++) {
+      // Sorted by material then depth, textures only change between materials
+      render_queue_begin(&render_queue);
+      for (uint32_t idx : visible_instances) {
+        SceneInstance &inst = scene.instances[idx];
+        Vec3 d = 0.5f * (instance_boxes[idx].min + instance_boxes[idx].max) - camera.render_pos;
+        float depth = sqrtf(rwm_v3_dot(d, d)) / camera.far_z;
+        render_queue.worker_packets[0].push_back({ render_key(RENDER_PASS_FORWARD, cur_shader->id, inst.material, asset_cache.meshes[inst.mesh].vao, depth), idx, 0 });
+      }
+      render_queue_sort(&render_queue);
+      uint32_t bound_material = UINT32_MAX;
+      for (DrawPacket &p : render_queue.packets) {
+        SceneInstance &inst = scene.instances[p.index];
+        if (inst.material != bound_material) {
+          bind_pbr_textures(scene.materials[inst.material]);
+          bound_material = inst.material;
+        }
+        cur_shader->set_unif_mat4("u_model", &scene.graph.world[inst.node]);
+        draw_gpu_mesh(asset_cache.meshes[inst.mesh]);
+      }
+
+      // Render the light spheres
       solid_s.use();
-      solid_s.set_unif_3fv("u_light_color", &light_colors[i]);
-      Mat4 model = rwm_m4_identity();
-      model.e[0][3] = light_positions[i].x;
-      model.e[1][3] = light_positions[i].y;
-      model.e[2][3] = light_positions[i].z;
-      model.e[0][0] = 0.5;
-      model.e[1][1] = 0.5;
-      model.e[2][2] = 0.5;
-      solid_s.set_unif_mat4("u_model", &model);
       solid_s.set_unif_mat4("u_view", &camera.view_mat);
       solid_s.set_unif_mat4("u_projection", &camera.persp_mat);
-      render_sphere();
-    }
+      for (int i = 0; i < num_lights; i++) {
+        solid_s.set_unif_3fv("u_light_color", &scene.lights[i].color);
+        Mat4 model = rwm_m4_identity();
+        model.e[0][3] = scene.lights[i].pos.x;
+        model.e[1][3] = scene.lights[i].pos.y;
+        model.e[2][3] = scene.lights[i].pos.z;
+        model.e[0][0] = 0.5;
+        model.e[1][1] = 0.5;
+        model.e[2][2] = 0.5;
+        solid_s.set_unif_mat4("u_model", &model);
+        render_sphere();
+      }
 
-    render_skybox(skybox_s, camera, env_map_tid);
-    render_to_quad(quad_s, tex_color_buf);
+      render_skybox(skybox_s, camera, env_map_tid);
+      render_graph_end_pass(&render_graph, forward_pass);
+    }
 #else
-    // Deferred rendering
     // phase 1 - deferred geometry
-    glBindFramebuffer(GL_FRAMEBUFFER, g_buffer.fbo);
-    glEnable(GL_DEPTH_TEST);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    cur_shader = &deferred_geometry_s;
-    cur_shader->use();
-    cur_shader->set_unif_1i("u_albedo_map", 0);
-    cur_shader->set_unif_1i("u_normal_map", 1);
-    cur_shader->set_unif_1i("u_metallic_map", 2);
-    cur_shader->set_unif_1i("u_roughness_map", 3);
-    cur_shader->set_unif_1i("u_ao_map", 4);
-    cur_shader->set_unif_1i("u_irradiance_map", 5);
-    cur_shader->set_unif_mat4("u_projection", &camera.persp_mat);
-    cur_shader->set_unif_mat4("u_view", &camera.view_mat);
-
-    Transform ts = rwtr_trs(
-      rwm_v3_init(0.0, 0.0, 10.0),
-      rwm_v3_init(2.0, 2.0, 2.0),
-      RWTR_NO_AXIS, 0.0f
-    );
-    Quaternion q1 = rwm_q_init_rotation(rwm_v3_init(0.0, 1.0, 0.0), rwm_to_radians(-90.0f));
-    Quaternion q2 = rwm_q_init_rotation(rwm_v3_init(1.0, 0.0, 0.0), rwm_to_radians(45.0f));
-    Transform r = rwtr_init_rotate_q(rwm_q_mult(q1, q2));
-    Transform model_tr = rwtr_compose(&ts, &r);
-    cur_shader->set_unif_mat4("u_model", &model_tr.t);
-    render_mesh_full(cerberus);
-
-    model_tr = rwtr_trs(
-      rwm_v3_init(1.0, 0.0, 8.6),
-      rwm_v3_init(1.0, 1.0, 1.0),
-      RWTR_NO_AXIS, 0.0f
-    );
-    cur_shader->set_unif_mat4("u_model", &model_tr.t);
-    render_mesh_full(bunny);
-
-#if 1
-    bind_pbr_textures(aluminium);
-
-    for (int i = 0; i < num_rows; i++) {
-      float metallic = (float)i/(float)num_rows;
-      cur_shader->set_unif_1f("u_metallic", metallic);
-      for (int j = 0; j < num_cols; j++) {
-        float roughness = rwm_clamp((float)j/(float)num_cols, 0.05f, 1.0f);
-        cur_shader->set_unif_1f("u_roughness", roughness);
-        Mat4 model = rwm_m4_identity();
-        model.e[0][3] = (j - (num_cols/2)) * spacing;
-        model.e[1][3] = (i - (num_rows/2)) * spacing;
-        cur_shader->set_unif_mat4("u_model", &model);
-        render_sphere();
+    if (render_graph_begin_pass(&render_graph, geometry_pass)) {
+      gpu_timers_begin(&gpu_timers, BENCH_PASS_GEOMETRY);
+      gpu_scene_submit(&gpu_scene, &render_queue, &occlusion);
+      occlusion_cull(&occlusion, OCCLUSION_PHASE_FIRST, &view_proj);
+      gl_enable(GL_DEPTH_TEST);
+      cur_shader = &deferred_geometry_s;
+      cur_shader->use();
+      render_instances(material_table, gpu_scene, &occlusion);
+
+      // Anything last frame's pyramid hid that is visible against what was just drawn
+      uint32_t depth_tid = render_graph_tid(&render_graph, g_depth);
+      occlusion_build_hiz(&occlusion, depth_tid, render_scale_x, render_scale_y);
+      if (occlusion.enabled) {
+        occlusion_cull(&occlusion, OCCLUSION_PHASE_SECOND, &view_proj);
+        cur_shader->use();
+        render_instances(material_table, gpu_scene, &occlusion);
+        // Next frame's first phase tests against the complete depth
+        occlusion_build_hiz(&occlusion, depth_tid, render_scale_x, render_scale_y);
       }
+      occlusion_end_frame(&occlusion, &view_proj);
+      gpu_timers_end(&gpu_timers);
+      render_graph_end_pass(&render_graph, geometry_pass);
     }
-#endif
 
-    // Phase 2 - Lighting pass
-#if 1
-    glBindFramebuffer(GL_FRAMEBUFFER, fb);
-    glEnable(GL_DEPTH_TEST);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    cur_shader = &deferred_pbr_s;
-    cur_shader->use();
-    cur_shader->set_unif_1i("g_position", 0);
-    cur_shader->set_unif_1i("g_normal", 1);
-    cur_shader->set_unif_1i("g_albedo", 2);
-    cur_shader->set_unif_1i("g_metallic", 3);
-    cur_shader->set_unif_1i("g_roughness", 4);
-    cur_shader->set_unif_1i("g_ao", 5);
-    cur_shader->set_unif_1i("u_irradiance_map", 6);
-    cur_shader->set_unif_1i("u_prefilter_map", 7);
-    cur_shader->set_unif_1i("u_brdf_lut", 8);
-    cur_shader->set_unif_3fv("u_cam_pos", &camera.pos);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, g_buffer.g_pos);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, g_buffer.g_normal);
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, g_buffer.g_albedo);
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, g_buffer.g_metallic);
-    glActiveTexture(GL_TEXTURE4);
-    glBindTexture(GL_TEXTURE_2D, g_buffer.g_roughness);
-    glActiveTexture(GL_TEXTURE5);
-    glBindTexture(GL_TEXTURE_2D, g_buffer.g_ao);
-    glActiveTexture(GL_TEXTURE6);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, irradiance_map_tid);
-    glActiveTexture(GL_TEXTURE7);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, prefilter_map_tid);
-    glActiveTexture(GL_TEXTURE8);
-    glBindTexture(GL_TEXTURE_2D, brdf_lut_tid);
-    for (int i = 0; i < sizeof(light_positions) / sizeof(light_positions[0]); i++) {
-      std::string pos_name = "u_light_pos[" + std::to_string(i) + "]";
-      std::string col_name = "u_light_color[" + std::to_string(i) + "]";
-      cur_shader->set_unif_3fv(pos_name.c_str(), &light_positions[i]);
-      cur_shader->set_unif_3fv(col_name.c_str(), &light_colors[i]);
+    // Phase 2 - Local lights, then the ambient/IBL pass that adds them up
+    if (render_graph_begin_pass(&render_graph, local_lights_pass)) {
+      gpu_timers_begin(&gpu_timers, BENCH_PASS_LOCAL_LIGHTS);
+      for (int i = 0; i < 5; i++) {
+        gl_active_texture(GL_TEXTURE0 + i);
+        gl_bind_texture(GL_TEXTURE_2D, render_graph_tid(&render_graph, g_colors[i]));
+      }
+      gl_active_texture(GL_TEXTURE5);
+      gl_bind_texture(GL_TEXTURE_CUBE_MAP_ARRAY, shadows.cube_sample_tid);
+      Frustum light_frustum = frustum_from_matrix(&view_proj);
+      light_volumes_render(&light_volumes, &light_stencil_s, &light_volume_s, scene.lights,
+                           shadows.light_cube.data(), &light_frustum);
+      gpu_timers_end(&gpu_timers);
+      render_graph_end_pass(&render_graph, local_lights_pass);
     }
-    render_quad();
-#endif
 
-    // Copy depth buffer to the draw framebuffer
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, g_buffer.fbo);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fb);
-    glBlitFramebuffer(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-
-    render_skybox(skybox_s, camera, env_map_tid);
-
-    // phase 3 - finally render to default framebuffer quad
-    switch (state) {
-      case 0:
-        render_to_quad(quad_s, tex_color_buf);
-        break;
-      case 1:
-        render_to_quad(quad_s, g_buffer.g_pos);
-        break;
-      case 2:
-        render_to_quad(quad_s, g_buffer.g_normal);
-        break;
-      case 3:
-        render_to_quad(quad_s, g_buffer.g_albedo);
-        break;
-      case 4:
-        render_to_quad(quad_s, g_buffer.g_metallic);
-        break;
-      case 5:
-        render_to_quad(quad_s, g_buffer.g_roughness);
-        break;
-      case 6:
-        render_to_quad(quad_s, g_buffer.g_ao);
-        break;
-      default:
-        break;
+    if (render_graph_begin_pass(&render_graph, lighting_pass)) {
+      gpu_timers_begin(&gpu_timers, BENCH_PASS_LIGHTING);
+      // The quad is pushed to the far plane and only passes in front of geometry,
+      // background pixels are rejected before shading
+      gl_enable(GL_DEPTH_TEST);
+      gl_depth_mask(false);
+      glDepthRange(1.0, 1.0);
+      gl_depth_func(GL_GREATER);
+      cur_shader = &deferred_pbr_s;
+      cur_shader->use();
+      for (int i = 0; i < 6; i++) {
+        gl_active_texture(GL_TEXTURE0 + i);
+        gl_bind_texture(GL_TEXTURE_2D, render_graph_tid(&render_graph, g_colors[i]));
+      }
+      gl_active_texture(GL_TEXTURE6);
+      gl_bind_texture(GL_TEXTURE_CUBE_MAP, irradiance_map_tid);
+      gl_active_texture(GL_TEXTURE7);
+      gl_bind_texture(GL_TEXTURE_CUBE_MAP, prefilter_map_tid);
+      gl_active_texture(GL_TEXTURE8);
+      gl_bind_texture(GL_TEXTURE_2D, brdf_lut_tid);
+      gl_active_texture(GL_TEXTURE9);
+      gl_bind_texture(GL_TEXTURE_2D, render_graph_tid(&render_graph, light_accum));
+      gl_active_texture(GL_TEXTURE10);
+      gl_bind_texture(GL_TEXTURE_2D_ARRAY, shadows.cascade_sample_tid);
+      // The sun's direction and cascades, black when the scene has no sun
+      Vec3 sun_color = shadows.sun.enabled ? shadows.sun.color : rwm_v3_zero();
+      Vec3 cam_forward = rwm_v3_init(-camera.view_mat.e[2][0], -camera.view_mat.e[2][1], -camera.view_mat.e[2][2]);
+      cur_shader->set_unif_3fv("u_sun_dir", &shadows.sun.dir);
+      cur_shader->set_unif_3fv("u_sun_color", &sun_color);
+      cur_shader->set_unif_3fv("u_cam_forward", &cam_forward);
+      Vec4 cascade_far;
+      for (int i = 0; i < SHADOW_NUM_CASCADES; i++) {
+        std::string name = "u_cascade_view_proj[" + std::to_string(i) + "]";
+        cur_shader->set_unif_mat4(name.c_str(), &shadows.cascade_view_proj[i]);
+        cascade_far.e[i] = shadows.cascade_far[i];
+      }
+      cur_shader->set_unif_4fv("u_cascade_far", &cascade_far);
+      render_quad();
+      glDepthRange(0.0, 1.0);
+      gpu_timers_end(&gpu_timers);
+
+      // The sky lands on the far plane, where the depth is still cleared
+      gpu_timers_begin(&gpu_timers, BENCH_PASS_SKYBOX);
+      render_skybox(skybox_s, camera, env_map_tid);
+      gl_depth_mask(true);
+      gpu_timers_end(&gpu_timers);
+      render_graph_end_pass(&render_graph, lighting_pass);
     }
 #endif
 
+    // phase 3 - finally put it on the default framebuffer
+    if (render_graph_begin_pass(&render_graph, present_pass)) {
+      gpu_timers_begin(&gpu_timers, BENCH_PASS_PRESENT);
+      if (render_w == screen_w && render_h == screen_h) {
+        // Nothing to filter, a blit is cheaper than a full screen draw
+        glBlitNamedFramebuffer(render_graph_read_fbo(&render_graph, shown), 0,
+                               0, 0, screen_w, screen_h, 0, 0, screen_w, screen_h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+      } else {
+        quad_s.use();
+        quad_s.set_unif_2f("u_uv_scale", render_scale_x, render_scale_y);
+        // Sharpen back some of the detail the bilinear upscale blurs
+        quad_s.set_unif_1f("u_sharpness", (1.0f - render_scale_x) / (1.0f - DYNRES_MIN_SCALE));
+        glBindSampler(0, upscale_sampler);
+        render_to_quad(quad_s, render_graph_tid(&render_graph, shown));
+        glBindSampler(0, 0);
+      }
+      gpu_timers_end(&gpu_timers);
+      render_graph_end_pass(&render_graph, present_pass);
+    }
+    // Nothing after this reads the frame's ring section
+    ring_buffer_end_frame(&frame_ring);
+
+    if (render_graph_begin_pass(&render_graph, capture_pass)) {
+      capture_frame(&frame_capture, render_graph_read_fbo(&render_graph, shown), GL_COLOR_ATTACHMENT0);
+      render_graph_end_pass(&render_graph, capture_pass);
+    }
+    capture_poll(&frame_capture);
+
+    render_target_pool_end_frame(&render_targets);
+
+    pacer_wait(&pacer);
     SDL_GL_SwapWindow(win);
+    gpu_timers_next_frame(&gpu_timers);
+    float gpu_frame_ms = 0.0f;
+    for (int i = 0; i < BENCH_PASS_COUNT; i++) {
+      gpu_frame_ms += gpu_timers.pass_ms[i];
+    }
+    dynres_update(&dynres, gpu_frame_ms);
+
+    if (is_bench) {
+      bench_record_frame(&bench_run, rwtm_to_ms(rwtm_now() - new_time), &gpu_timers);
+      if (bench_run.frames.size() >= bench_run.num_frames) {
+        bench_write_report(&bench_run, bench_report_prefix);
+        quit = true;
+      }
+    }
   }
 
+  glDeleteSamplers(1, &upscale_sampler);
+  job_graph_destroy(&frame_graph);
+  ring_buffer_destroy(&frame_ring);
+  render_queue_destroy(&render_queue);
+  gpu_scene_destroy(&gpu_scene);
+  material_table_destroy(&material_table);
+  arena_destroy(&asset_cache.arena);
+  soft_occlusion_destroy(&soft_occlusion);
+  light_volumes_destroy(&light_volumes);
+  shadows_destroy(&shadows);
+  occlusion_shutdown(&occlusion);
+  scene_destroy(&scene);
+  input_record_end();
+  capture_shutdown(&frame_capture);
+  render_graph_destroy(&render_graph);
+  render_target_pool_destroy(&render_targets);
+  enkiDeleteTaskScheduler(g_pTS);
+
   SDL_GL_DeleteContext(gl_context);
   SDL_DestroyWindow(win);
   SDL_Quit();
@@ -1012,113 +1319,46 @@ int main(int argc, char* argv[]) {
 
 void render_plane() {
   if (plane_vao == 0) {
-    constexpr float plane_vertices[] = {
-      // positions            // texcoords   // normals
-       10.0f, -0.5f,  10.0f,  10.0f,  0.0f,   0.0f, 1.0f, 0.0f,
-      -10.0f, -0.5f,  10.0f,   0.0f,  0.0f,   0.0f, 1.0f, 0.0f,
-      -10.0f, -0.5f, -10.0f,   0.0f, 10.0f,   0.0f, 1.0f, 0.0f,
-       10.0f, -0.5f,  10.0f,  10.0f,  0.0f,   0.0f, 1.0f, 0.0f,
-      -10.0f, -0.5f, -10.0f,   0.0f, 10.0f,   0.0f, 1.0f, 0.0f,
-       10.0f, -0.5f, -10.0f,  10.0f, 10.0f,   0.0f, 1.0f, 0.0f
+    float plane_vertices[] = {
+      // positions            // texcoords   // normals         // tangent
+       10.0f, -0.5f,  10.0f,  10.0f,  0.0f,   0.0f, 1.0f, 0.0f,  0.0f,
+      -10.0f, -0.5f,  10.0f,   0.0f,  0.0f,   0.0f, 1.0f, 0.0f,  0.0f,
+      -10.0f, -0.5f, -10.0f,   0.0f, 10.0f,   0.0f, 1.0f, 0.0f,  0.0f,
+       10.0f, -0.5f,  10.0f,  10.0f,  0.0f,   0.0f, 1.0f, 0.0f,  0.0f,
+      -10.0f, -0.5f, -10.0f,   0.0f, 10.0f,   0.0f, 1.0f, 0.0f,  0.0f,
+       10.0f, -0.5f, -10.0f,  10.0f, 10.0f,   0.0f, 1.0f, 0.0f,  0.0f
     };
+    compute_tangents(plane_vertices, 6, NULL, 0);
     glGenVertexArrays(1, &plane_vao);
     uint32_t vbo;
     glGenBuffers(1, &vbo);
-    glBindVertexArray(plane_vao);
+    gl_bind_vertex_array(plane_vao);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(plane_vertices), &plane_vertices, GL_STATIC_DRAW);
-    constexpr size_t stride =  8 * sizeof(float);
+    constexpr size_t stride = NUM_PACKED_ELEMENTS * sizeof(float);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void *)0);
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void *)(3 * sizeof(float)));
     glEnableVertexAttribArray(2);
     glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void *)(5 * sizeof(float)));
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(4, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void *)(PACKED_TANGENT_OFFSET * sizeof(float)));
   }
-  glBindVertexArray(plane_vao);
+  gl_bind_vertex_array(plane_vao);
   //glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
   glDrawArrays(GL_TRIANGLES, 0, 6);
-  glBindVertexArray(0);
+  stats_count_draw(GL_TRIANGLES, 6);
 }
 
 void render_sphere() {
-  if (sphere_vao == 0) {
-    glGenVertexArrays(1, &sphere_vao);
-    //uint32_t vbo, ebo;
-    glGenBuffers(1, &sphere_vbo);
-    glGenBuffers(1, &sphere_ebo);
-    std::vector<Vec3> positions;
-    std::vector<Vec2> uv;
-    std::vector<Vec3> normals;
-    std::vector<unsigned int> indices;
-
-    const uint32_t x_segments = 64;
-    const uint32_t y_segments = 64;
-    const float pi = 3.14159265359;
-    for (int y = 0; y <= y_segments; y++) {
-      for (int x = 0; x <= x_segments; x++) {
-        float x_seg = (float)x/(float)x_segments;
-        float y_seg = (float)y/(float)y_segments;
-        float x_pos = std::cos(x_seg * 2.0f * pi) * std::sin(y_seg * pi);
-        float y_pos = std::cos(y_seg * pi);
-        float z_pos = std::sin(x_seg * 2.0f * pi) * std::sin(y_seg * pi);
-        positions.push_back(rwm_v3_init(x_pos, y_pos, z_pos));
-        normals.push_back(rwm_v3_init(x_pos, y_pos, z_pos));
-        uv.push_back(rwm_v2_init(x_seg, y_seg));
-      }
-    }
-
-    bool is_odd_row = false;
-    for (int y = 0; y < y_segments; y++) {
-      if (!is_odd_row) {
-        for (int x = 0; x <= x_segments; x++) {
-          indices.push_back(y * (x_segments+1) + x);
-          indices.push_back((y+1) * (x_segments+1) + x);
-        }
-      } else {
-        for (int x = x_segments; x >= 0; x--) {
-          indices.push_back((y+1) * (x_segments+1) + x);
-          indices.push_back(y * (x_segments+1) + x);
-        }
-
-      }
-      is_odd_row = !is_odd_row;
-    }
-    idx_count = indices.size();
-    std::vector<float> data;
-    for (int i = 0; i < positions.size(); i++) {
-      data.push_back(positions[i].x);
-      data.push_back(positions[i].y);
-      data.push_back(positions[i].z);
-      if (uv.size() > 0) {
-        data.push_back(uv[i].x);
-        data.push_back(uv[i].y);
-      }
-      if (normals.size() > 0) {
-        data.push_back(normals[i].x);
-        data.push_back(normals[i].y);
-        data.push_back(normals[i].z);
-      }
-    }
-    glBindVertexArray(sphere_vao);
-    glBindBuffer(GL_ARRAY_BUFFER, sphere_vbo);
-    glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(float), &data[0], GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphere_ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-    constexpr size_t stride = (3 + 2 + 3) * sizeof(float);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)(5 * sizeof(float)));
+  if (sphere_mesh.vao == 0) {
+    std::vector<float> packed;
+    std::vector<uint32_t> indices;
+    sphere_geometry(64, packed, indices);
+    sphere_mesh = upload_mesh(packed.data(), packed.size() / NUM_PACKED_ELEMENTS, indices.data(), indices.size(), GL_TRIANGLE_STRIP);
   }
-
-  glBindVertexArray(sphere_vao);
-  //glBindBuffer(GL_ARRAY_BUFFER, sphere_vbo);
-  //glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphere_ebo);
-  glDrawElements(GL_TRIANGLE_STRIP, idx_count, GL_UNSIGNED_INT, 0);
-  glBindVertexArray(0);
+  draw_gpu_mesh(sphere_mesh);
 }
 
 void render_quad() {
@@ -1133,7 +1373,7 @@ void render_quad() {
     glGenVertexArrays(1, &quad_vao);
     uint32_t vbo;
     glGenBuffers(1, &vbo);
-    glBindVertexArray(quad_vao);
+    gl_bind_vertex_array(quad_vao);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices), &quad_vertices, GL_STATIC_DRAW);
     constexpr size_t stride = 5 * sizeof(float);
@@ -1142,29 +1382,27 @@ void render_quad() {
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void *)(3 * sizeof(float)));
   }
-  glBindVertexArray(quad_vao);
+  gl_bind_vertex_array(quad_vao);
   glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-  glBindVertexArray(0);
+  stats_count_draw(GL_TRIANGLE_STRIP, 4);
 
 }
 
 void render_to_quad(Shader &quad_shader, uint32_t tex_color_buffer) {
-  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-  glDisable(GL_DEPTH_TEST);
+  gl_polygon_mode(GL_FILL);
+  gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
+  gl_disable(GL_DEPTH_TEST);
   quad_shader.use();
-  quad_shader.set_unif_1i("screen_tex", 0);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, tex_color_buffer);
-  glDrawArrays(GL_TRIANGLES, 0, 6);
+  gl_active_texture(GL_TEXTURE0);
+  gl_bind_texture(GL_TEXTURE_2D, tex_color_buffer);
   render_quad();
   if (!is_next_state_wire) {
-    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+    gl_polygon_mode(GL_LINE);
   }
 }
 
 void render_skybox(Shader &skybox_shader, Camera &camera, uint32_t skybox_tid) {
-  glDepthFunc(GL_LEQUAL);
+  gl_depth_func(GL_LEQUAL);
   skybox_shader.use();
   // Remove the translation part of the view matrix
   // We don't want the box to move along with the camera
@@ -1174,10 +1412,10 @@ void render_skybox(Shader &skybox_shader, Camera &camera, uint32_t skybox_tid) {
   view.e[2][3] = 0;
   skybox_shader.set_unif_mat4("u_view", &view);
   skybox_shader.set_unif_mat4("u_projection", &camera.persp_mat);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, skybox_tid);
+  gl_active_texture(GL_TEXTURE0);
+  gl_bind_texture(GL_TEXTURE_CUBE_MAP, skybox_tid);
   render_cube();
-  glDepthFunc(GL_LESS);
+  gl_depth_func(GL_LESS);
 }
 
 void render_cube() {
@@ -1229,7 +1467,7 @@ void render_cube() {
       -1.0f,  1.0f,  1.0f,  0.0f,  1.0f,  0.0f, 0.0f, 0.0f  // bottom-left
     };
     glGenBuffers(1, &vbo);
-    glBindVertexArray(cube_vao);
+    gl_bind_vertex_array(cube_vao);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
     constexpr size_t stride = (3 + 3 + 2) * sizeof(float);
@@ -1241,56 +1479,41 @@ void render_cube() {
     glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(6 * sizeof(float)));
   }
 
-  glBindVertexArray(cube_vao);
+  gl_bind_vertex_array(cube_vao);
   glDrawArrays(GL_TRIANGLES, 0, 36);
-  glBindVertexArray(0);
+  stats_count_draw(GL_TRIANGLES, 36);
 }
 
 void render_rw_mesh(Mesh &m) {
   if (mesh_vao == 0) {
     glGenVertexArrays(1, &mesh_vao);
-    glBindVertexArray(mesh_vao);
+    gl_bind_vertex_array(mesh_vao);
     glGenBuffers(1, &mesh_vbo);
     glGenBuffers(1, &mesh_ebo);
     glBindBuffer(GL_ARRAY_BUFFER, mesh_vbo);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh_ebo);
+    constexpr size_t stride = NUM_PACKED_ELEMENTS * sizeof(float);
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
     glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
     glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(5 * sizeof(float)));
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)(5 * sizeof(float)));
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(4, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)(PACKED_TANGENT_OFFSET * sizeof(float)));
   }
-  glBindVertexArray(mesh_vao);
+  gl_bind_vertex_array(mesh_vao);
   glBindBuffer(GL_ARRAY_BUFFER, mesh_vbo);
   glBufferData(GL_ARRAY_BUFFER, sizeof(float) * NUM_PACKED_ELEMENTS * m.v.size(), &(m.packed[0]), GL_STATIC_DRAW);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh_ebo);
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(float) * m.v_idx.size(), &(m.v_idx[0]), GL_STATIC_DRAW);
   glDrawElements(GL_TRIANGLES, m.v_idx.size(), GL_UNSIGNED_INT, 0);
-  glBindVertexArray(0);
-}
-
-void render_tinyobj_mesh(TinyObjMesh &m) {
-  if (mesh_vao == 0) {
-    glGenVertexArrays(1, &mesh_vao);
-    glBindVertexArray(mesh_vao);
-    glGenBuffers(1, &mesh_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh_vbo);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(5 * sizeof(float)));
-  }
-  glBindVertexArray(mesh_vao);
-  glBindBuffer(GL_ARRAY_BUFFER, mesh_vbo);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(float) * NUM_PACKED_ELEMENTS * m.total_vertices, m.packed.data(), GL_STATIC_DRAW);
-  glDrawArrays(GL_TRIANGLES, 0, m.total_vertices);
-  glBindVertexArray(0);
+  stats_count_draw(GL_TRIANGLES, m.v_idx.size());
 }
 
-void render_mesh_full(MeshFull &m) {
-  bind_pbr_textures(m.textures);
-  render_tinyobj_mesh(m.to_mesh);
+void render_instances(MaterialTable &mt, GpuScene &gs, OcclusionCuller *oc) {
+  // Which draws actually go out is up to the culling compute shader, and the
+  // materials are picked in the shader, so this is the same few calls for any scene
+  material_table_bind(&mt);
+  gpu_scene_draw(&gs, oc);
 }
@@ -0,0 +1,171 @@
+#include "material_table.h"
+#include <stdio.h>
+#include <algorithm>
+#include <glad/glad.h>
+#include "gl_state.h"
+
+struct ArrayBucket {
+  int w;
+  int h;
+  uint32_t format;
+  std::vector<uint32_t> layers;
+};
+
+static uint32_t sized_format(int internal_format) {
+  switch (internal_format) {
+    case GL_RED:
+    case GL_R8:
+      return GL_R8;
+    case GL_RGB:
+    case GL_RGB8:
+      return GL_RGB8;
+    case GL_RGBA:
+    case GL_RGBA8:
+      return GL_RGBA8;
+    default:
+      return internal_format;
+  }
+}
+
+static void get_maps(PBRTextures &t, uint32_t maps[MATERIAL_MAP_COUNT]) {
+  maps[MATERIAL_MAP_ALBEDO] = t.albedo_tid;
+  maps[MATERIAL_MAP_NORMAL] = t.normal_tid;
+  maps[MATERIAL_MAP_METALLIC] = t.metallic_tid;
+  maps[MATERIAL_MAP_ROUGHNESS] = t.roughness_tid;
+  maps[MATERIAL_MAP_AO] = t.ao_tid;
+}
+
+static void build_bindless(MaterialTable *mt, std::vector<PBRTextures> &materials) {
+  std::vector<uint64_t> table;
+  for (PBRTextures &t : materials) {
+    uint32_t maps[MATERIAL_MAP_COUNT];
+    get_maps(t, maps);
+    for (uint32_t tid : maps) {
+      uint64_t handle = tid ? glGetTextureHandleARB(tid) : 0;
+      if (handle && std::find(mt->handles.begin(), mt->handles.end(), handle) == mt->handles.end()) {
+        glMakeTextureHandleResidentARB(handle);
+        mt->handles.push_back(handle);
+      }
+      table.push_back(handle);
+    }
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, mt->ssbo);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint64_t) * table.size(), table.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+static void build_arrays(MaterialTable *mt, std::vector<PBRTextures> &materials) {
+  std::vector<ArrayBucket> buckets;
+  // Texture id to its slot, the same texture is often shared between materials
+  std::vector<std::pair<uint32_t, uint32_t>> slots;
+  std::vector<uint32_t> table;
+  for (PBRTextures &t : materials) {
+    uint32_t maps[MATERIAL_MAP_COUNT];
+    get_maps(t, maps);
+    for (uint32_t tid : maps) {
+      auto it = std::find_if(slots.begin(), slots.end(), [&](std::pair<uint32_t, uint32_t> &s) { return s.first == tid; });
+      if (it != slots.end()) {
+        table.push_back(it->second);
+        continue;
+      }
+      int w = 0, h = 0, internal_format = 0;
+      if (tid) {
+        gl_bind_texture(GL_TEXTURE_2D, tid);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internal_format);
+      }
+      uint32_t format = sized_format(internal_format);
+      size_t b = 0;
+      while (b < buckets.size() && !(buckets[b].w == w && buckets[b].h == h && buckets[b].format == format)) {
+        b++;
+      }
+      if (b == buckets.size()) {
+        if (b == MATERIAL_MAX_ARRAYS) {
+          printf("ERROR: More than %d texture sizes/formats in the materials, tid %d falls back to the first\n", MATERIAL_MAX_ARRAYS, tid);
+          slots.push_back({ tid, 0 });
+          table.push_back(0);
+          continue;
+        }
+        buckets.push_back({ w, h, format, {} });
+      }
+      uint32_t slot = ((uint32_t) b << 16) | (uint32_t) buckets[b].layers.size();
+      buckets[b].layers.push_back(tid);
+      slots.push_back({ tid, slot });
+      table.push_back(slot);
+    }
+  }
+  gl_bind_texture(GL_TEXTURE_2D, 0);
+
+  for (ArrayBucket &b : buckets) {
+    uint32_t array_tid;
+    glGenTextures(1, &array_tid);
+    mt->array_tids.push_back(array_tid);
+    // A missing texture gets a 1x1 black layer rather than a hole in the table
+    int w = b.w > 0 ? b.w : 1;
+    int h = b.h > 0 ? b.h : 1;
+    int num_levels = 1;
+    while ((w >> num_levels) > 0 || (h >> num_levels) > 0) {
+      num_levels++;
+    }
+    gl_bind_texture(GL_TEXTURE_2D_ARRAY, array_tid);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, num_levels, b.format ? b.format : GL_R8, w, h, b.layers.size());
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    if (b.w == 0) {
+      glClearTexImage(array_tid, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+    }
+    for (size_t layer = 0; layer < b.layers.size(); layer++) {
+      if (b.layers[layer] == 0) {
+        continue;
+      }
+      // Straight GPU to GPU copy of every mip level load_texture generated
+      for (int level = 0; level < num_levels; level++) {
+        int lw = std::max(w >> level, 1);
+        int lh = std::max(h >> level, 1);
+        glCopyImageSubData(b.layers[layer], GL_TEXTURE_2D, level, 0, 0, 0,
+                           array_tid, GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, lw, lh, 1);
+      }
+    }
+    printf("Material texture array %d: %dx%d, %zu layers\n", array_tid, w, h, b.layers.size());
+  }
+  gl_bind_texture(GL_TEXTURE_2D_ARRAY, 0);
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, mt->ssbo);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * table.size(), table.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void material_table_build(MaterialTable *mt, std::vector<PBRTextures> &materials, bool bindless) {
+  mt->bindless = bindless;
+  mt->array_tids.clear();
+  mt->handles.clear();
+  glGenBuffers(1, &mt->ssbo);
+  if (bindless) {
+    build_bindless(mt, materials);
+  } else {
+    build_arrays(mt, materials);
+  }
+}
+
+void material_table_bind(MaterialTable *mt) {
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_TABLE_BINDING, mt->ssbo);
+  for (size_t i = 0; i < mt->array_tids.size(); i++) {
+    gl_active_texture(GL_TEXTURE0 + i);
+    gl_bind_texture(GL_TEXTURE_2D_ARRAY, mt->array_tids[i]);
+  }
+}
+
+void material_table_destroy(MaterialTable *mt) {
+  for (uint64_t handle : mt->handles) {
+    glMakeTextureHandleNonResidentARB(handle);
+  }
+  if (!mt->array_tids.empty()) {
+    gl_delete_textures(mt->array_tids.size(), mt->array_tids.data());
+  }
+  glDeleteBuffers(1, &mt->ssbo);
+  mt->array_tids.clear();
+  mt->handles.clear();
+}
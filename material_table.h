@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "assets.h"
+
+// Texture units 0..MATERIAL_MAX_ARRAYS-1 hold the arrays, matches shaders/deferred_geometry.frag
+#define MATERIAL_MAX_ARRAYS 8
+// SSBO binding of the per-material layers or handles
+#define MATERIAL_TABLE_BINDING 5
+
+// Order of the maps of a material in the table, shared with the shaders
+enum MaterialMap {
+  MATERIAL_MAP_ALBEDO,
+  MATERIAL_MAP_NORMAL,
+  MATERIAL_MAP_METALLIC,
+  MATERIAL_MAP_ROUGHNESS,
+  MATERIAL_MAP_AO,
+  MATERIAL_MAP_COUNT
+};
+
+// Every material's textures behind one binding, so the shader picks them by
+// material id and a pass doesn't rebind anything between materials.
+// Without bindless, textures are copied into GL_TEXTURE_2D_ARRAYs bucketed by
+// size and format, and each map is stored as (array << 16) | layer.
+// With ARB_bindless_texture each map is the texture's resident handle.
+struct MaterialTable {
+  bool bindless;
+  std::vector<uint32_t> array_tids;
+  std::vector<uint64_t> handles;
+  uint32_t ssbo;
+};
+
+// The source textures stay as they are, the forward path still binds them directly
+void material_table_build(MaterialTable *mt, std::vector<PBRTextures> &materials, bool bindless);
+void material_table_bind(MaterialTable *mt);
+void material_table_destroy(MaterialTable *mt);
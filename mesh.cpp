@@ -7,6 +7,9 @@
 #include <rw_math.h>
 #include <assert.h>
 #include <set>
+#include <algorithm>
+#include <string.h>
+#include <math.h>
 
 using namespace std;
 
@@ -53,6 +56,7 @@ static void pack_and_order_data(Mesh *out_mesh) {
       memcpy(out_mesh->packed + (NUM_PACKED_ELEMENTS * out_mesh->v_idx[i]) + 5,
           out_mesh->n.data() + out_mesh->n_idx[i], sizeof(Vec3));
     }
+    compute_tangents(out_mesh->packed, out_mesh->v.size(), (const uint32_t *) out_mesh->v_idx.data(), out_mesh->v_idx.size());
 
     // Loop through the temporary buffers
     for (int i = 0; i < out_mesh->v_idx.size(); ++i) {
@@ -74,6 +78,165 @@ static void pack_and_order_data(Mesh *out_mesh) {
   }
 }
 
+Bounds compute_bounds(const float *positions, uint32_t num_vertices, uint32_t stride) {
+  Bounds result = {};
+  if (num_vertices == 0) {
+    return result;
+  }
+  result.min = rwm_v3_init(positions[0], positions[1], positions[2]);
+  result.max = result.min;
+  for (uint32_t i = 1; i < num_vertices; i++) {
+    const float *p = positions + i * stride;
+    for (int k = 0; k < 3; k++) {
+      result.min.e[k] = p[k] < result.min.e[k] ? p[k] : result.min.e[k];
+      result.max.e[k] = p[k] > result.max.e[k] ? p[k] : result.max.e[k];
+    }
+  }
+  result.center = 0.5f * (result.min + result.max);
+  float max_dist_sq = 0.0f;
+  for (uint32_t i = 0; i < num_vertices; i++) {
+    const float *p = positions + i * stride;
+    Vec3 d = rwm_v3_init(p[0], p[1], p[2]) - result.center;
+    float dist_sq = rwm_v3_dot(d, d);
+    max_dist_sq = dist_sq > max_dist_sq ? dist_sq : max_dist_sq;
+  }
+  result.radius = sqrtf(max_dist_sq);
+  return result;
+}
+
+uint32_t pack_tangent(Vec3 tangent, float sign) {
+  // Onto the octahedron, then the lower half folded out over the corners
+  float l1 = fabsf(tangent.x) + fabsf(tangent.y) + fabsf(tangent.z);
+  float x = tangent.x / l1;
+  float y = tangent.y / l1;
+  if (tangent.z < 0.0f) {
+    float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+    float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    x = fx;
+    y = fy;
+  }
+  // 10 bit snorm x/y, z unused, 2 bit snorm w
+  int32_t ix = (int32_t) roundf(x * 511.0f);
+  int32_t iy = (int32_t) roundf(y * 511.0f);
+  uint32_t iw = sign < 0.0f ? 3 : 1;
+  return ((uint32_t) ix & 0x3ff) | (((uint32_t) iy & 0x3ff) << 10) | (iw << 30);
+}
+
+static Vec3 packed_vec3(const float *packed, uint32_t v, uint32_t offset) {
+  const float *p = packed + v * NUM_PACKED_ELEMENTS + offset;
+  return rwm_v3_init(p[0], p[1], p[2]);
+}
+
+static Vec3 project_normalize(Vec3 v, Vec3 n) {
+  Vec3 p = v - rwm_v3_dot(n, v) * n;
+  float len = sqrtf(rwm_v3_dot(p, p));
+  return len > 1e-12f ? (1.0f / len) * p : rwm_v3_zero();
+}
+
+void compute_tangents(float *packed, uint32_t num_vertices, const uint32_t *indices, uint32_t num_indices) {
+  if (!indices) {
+    num_indices = num_vertices;
+  }
+  // Which way round each vertex's uvs go, by the sign of its triangles' uv area. On a
+  // mirrored uv seam both sides share position, uv and normal but not this.
+  vector<int32_t> uv_winding(num_vertices, 0);
+  for (uint32_t i = 0; i + 2 < num_indices; i += 3) {
+    uint32_t tri[3];
+    for (int k = 0; k < 3; k++) {
+      tri[k] = indices ? indices[i+k] : i+k;
+    }
+    const float *uv[3];
+    for (int k = 0; k < 3; k++) {
+      uv[k] = packed + tri[k] * NUM_PACKED_ELEMENTS + 3;
+    }
+    float det = (uv[1][0] - uv[0][0]) * (uv[2][1] - uv[0][1]) - (uv[2][0] - uv[0][0]) * (uv[1][1] - uv[0][1]);
+    for (int k = 0; k < 3; k++) {
+      uv_winding[tri[k]] += det < 0.0f ? -1 : (det > 0.0f ? 1 : 0);
+    }
+  }
+  for (int32_t &w : uv_winding) {
+    w = w < 0 ? 1 : 0;
+  }
+
+  // Group identical vertices, sorting them by everything but the tangent, then by
+  // uv winding so mirrored sides are never averaged into one tangent
+  const size_t key_size = PACKED_TANGENT_OFFSET * sizeof(float);
+  auto compare = [&](uint32_t a, uint32_t b) {
+    int c = memcmp(packed + a * NUM_PACKED_ELEMENTS, packed + b * NUM_PACKED_ELEMENTS, key_size);
+    return c != 0 ? c : uv_winding[a] - uv_winding[b];
+  };
+  vector<uint32_t> order(num_vertices);
+  for (uint32_t i = 0; i < num_vertices; i++) {
+    order[i] = i;
+  }
+  sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return compare(a, b) < 0;
+  });
+  vector<uint32_t> group(num_vertices);
+  uint32_t num_groups = 0;
+  for (uint32_t i = 0; i < num_vertices; i++) {
+    if (i > 0 && compare(order[i], order[i-1]) != 0) {
+      num_groups++;
+    }
+    group[order[i]] = num_groups;
+  }
+  num_groups++;
+
+  vector<Vec3> tangents(num_groups, rwm_v3_zero());
+  vector<Vec3> bitangents(num_groups, rwm_v3_zero());
+  for (uint32_t i = 0; i + 2 < num_indices; i += 3) {
+    uint32_t tri[3];
+    for (int k = 0; k < 3; k++) {
+      tri[k] = indices ? indices[i+k] : i+k;
+    }
+    Vec3 p[3];
+    float u[3], v[3];
+    for (int k = 0; k < 3; k++) {
+      p[k] = packed_vec3(packed, tri[k], 0);
+      u[k] = packed[tri[k] * NUM_PACKED_ELEMENTS + 3];
+      v[k] = packed[tri[k] * NUM_PACKED_ELEMENTS + 4];
+    }
+    Vec3 e1 = p[1] - p[0];
+    Vec3 e2 = p[2] - p[0];
+    float s1 = u[1] - u[0], t1 = v[1] - v[0];
+    float s2 = u[2] - u[0], t2 = v[2] - v[0];
+    float det = s1 * t2 - s2 * t1;
+    // No uv area, no direction to take from it
+    if (fabsf(det) < 1e-20f) {
+      continue;
+    }
+    Vec3 sdir = (1.0f / det) * (t2 * e1 - t1 * e2);
+    Vec3 tdir = (1.0f / det) * (s1 * e2 - s2 * e1);
+    for (int k = 0; k < 3; k++) {
+      Vec3 a = p[(k+1) % 3] - p[k];
+      Vec3 b = p[(k+2) % 3] - p[k];
+      float len = sqrtf(rwm_v3_dot(a, a) * rwm_v3_dot(b, b));
+      if (len <= 0.0f) {
+        continue;
+      }
+      float angle = acosf(fmaxf(-1.0f, fminf(1.0f, rwm_v3_dot(a, b) / len)));
+      Vec3 n = packed_vec3(packed, tri[k], 5);
+      uint32_t g = group[tri[k]];
+      tangents[g] = tangents[g] + angle * project_normalize(sdir, n);
+      bitangents[g] = bitangents[g] + angle * project_normalize(tdir, n);
+    }
+  }
+
+  for (uint32_t i = 0; i < num_vertices; i++) {
+    Vec3 n = rwm_v3_normalize(packed_vec3(packed, i, 5));
+    uint32_t g = group[i];
+    Vec3 t = project_normalize(tangents[g], n);
+    if (rwm_v3_dot(t, t) == 0.0f) {
+      // Nothing to go on, any direction in the surface will do
+      Vec3 axis = fabsf(n.x) < 0.9f ? rwm_v3_init(1.0f, 0.0f, 0.0f) : rwm_v3_init(0.0f, 1.0f, 0.0f);
+      t = project_normalize(axis, n);
+    }
+    float sign = rwm_v3_dot(rwm_v3_cross(n, t), bitangents[g]) < 0.0f ? -1.0f : 1.0f;
+    uint32_t bits = pack_tangent(t, sign);
+    memcpy(packed + i * NUM_PACKED_ELEMENTS + PACKED_TANGENT_OFFSET, &bits, sizeof(bits));
+  }
+}
+
 // NOTE(ray): We're storing a lot more data than necessary for debug reasons
 uint8_t load_obj(Mesh *out_mesh, const char *obj_path) {
   cout << "Loading obj: " << obj_path << endl;
@@ -176,6 +339,7 @@ uint8_t load_obj(Mesh *out_mesh, const char *obj_path) {
   }
 
   pack_and_order_data(out_mesh);
+  out_mesh->bounds = compute_bounds((float *) out_mesh->v.data(), out_mesh->v.size(), 3);
 
   out_mesh->format = cur_ff;
 
@@ -3,7 +3,11 @@
 #include <vector>
 #include <rw_math.h>
 
-#define NUM_PACKED_ELEMENTS 8
+// Packed vertex: position xyz, uv, normal xyz, tangent. The tangent is a single
+// GL_INT_2_10_10_10_REV word stored in the float slot: the octahedral encoded
+// direction in x/y and the bitangent sign in w, see pack_tangent.
+#define NUM_PACKED_ELEMENTS 9
+#define PACKED_TANGENT_OFFSET 8
 
 enum class FaceFormat {
   UNDEFINED,
@@ -13,6 +17,27 @@ enum class FaceFormat {
   VVTVN
 };
 
+// Object space bounds, computed once at load. The sphere is centred on the box
+// but sized to the furthest vertex, so it's usually tighter than the box corners.
+struct Bounds {
+  Vec3 min;
+  Vec3 max;
+  Vec3 center;
+  float radius;
+};
+
+// stride is in floats, 3 for a Vec3 array or NUM_PACKED_ELEMENTS for packed vertices
+Bounds compute_bounds(const float *positions, uint32_t num_vertices, uint32_t stride);
+
+// sign is +1 when the bitangent (the v direction) is cross(normal, tangent), -1 when mirrored
+uint32_t pack_tangent(Vec3 tangent, float sign);
+// Fills in the tangent of packed vertices from their positions, uvs and normals.
+// Vertices with the same position, uv and normal share a tangent, so meshes that
+// were unwelded for the GPU still get smooth tangents, and uv seams (where the uvs
+// differ) get a tangent on each side. Triangles are weighted by the angle at each
+// corner, like MikkTSpace. indices can be NULL for a plain triangle list.
+void compute_tangents(float *packed, uint32_t num_vertices, const uint32_t *indices, uint32_t num_indices);
+
 typedef struct Mesh {
   std::vector<int> f;
   std::vector<int> v_idx;
@@ -33,6 +58,7 @@ typedef struct Mesh {
   float *packed;
 
   FaceFormat format;
+  Bounds bounds;
 } Mesh;
 
 uint8_t load_obj(Mesh *out_obj, const char *obj_path);
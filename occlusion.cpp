@@ -0,0 +1,153 @@
+#include "occlusion.h"
+#include <stdio.h>
+#include <vector>
+#include <glad/glad.h>
+#include "gl_state.h"
+
+static void create_pyramid(OcclusionCuller *oc) {
+  oc->num_levels = 1;
+  while ((oc->w >> oc->num_levels) > 0 || (oc->h >> oc->num_levels) > 0) {
+    oc->num_levels++;
+  }
+  glGenTextures(1, &oc->hiz_tid);
+  gl_bind_texture(GL_TEXTURE_2D, oc->hiz_tid);
+  glTexStorage2D(GL_TEXTURE_2D, oc->num_levels, GL_R32F, oc->w, oc->h);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+void occlusion_init(OcclusionCuller *oc, Shader *reduce_s, Shader *cull_s, int w, int h) {
+  oc->enabled = true;
+  oc->has_history = false;
+  oc->w = w;
+  oc->h = h;
+  oc->reduce_s = reduce_s;
+  oc->cull_s = cull_s;
+  oc->num_draws = 0;
+  oc->num_commands = 0;
+  oc->prev_view_proj = rwm_m4_identity();
+
+  create_pyramid(oc);
+
+  glGenBuffers(1, &oc->bounds_ssbo);
+  glGenBuffers(1, &oc->command_buffer);
+  glGenBuffers(1, &oc->drawn_ssbo);
+}
+
+void occlusion_resize(OcclusionCuller *oc, int w, int h) {
+  if (w == oc->w && h == oc->h) {
+    return;
+  }
+  gl_delete_textures(1, &oc->hiz_tid);
+  oc->w = w;
+  oc->h = h;
+  oc->has_history = false;
+  create_pyramid(oc);
+}
+
+void occlusion_set_num_draws(OcclusionCuller *oc, uint32_t num_draws) {
+  oc->num_draws = num_draws;
+  oc->num_commands = 0;
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, oc->command_buffer);
+  glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawCommand) * num_draws, NULL, GL_STREAM_DRAW);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+  std::vector<uint32_t> zeros(num_draws, 0);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, oc->drawn_ssbo);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * num_draws, zeros.data(), GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void occlusion_set_commands(OcclusionCuller *oc, const DrawCommand *commands, uint32_t count) {
+  oc->num_commands = count;
+  if (count == 0) {
+    return;
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, oc->command_buffer);
+  glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(DrawCommand) * count, commands);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void occlusion_set_bounds(OcclusionCuller *oc, const Aabb *boxes, uint32_t count) {
+  // std430 vec4 pairs
+  std::vector<float> packed(8 * count);
+  for (uint32_t i = 0; i < count; i++) {
+    float *p = &packed[8 * i];
+    p[0] = boxes[i].min.x;
+    p[1] = boxes[i].min.y;
+    p[2] = boxes[i].min.z;
+    p[3] = 1.0f;
+    p[4] = boxes[i].max.x;
+    p[5] = boxes[i].max.y;
+    p[6] = boxes[i].max.z;
+    p[7] = 1.0f;
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, oc->bounds_ssbo);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(float) * packed.size(), packed.data(), GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void occlusion_cull(OcclusionCuller *oc, OcclusionPhase phase, Mat4 *view_proj) {
+  if (oc->num_commands == 0) {
+    return;
+  }
+
+  Shader *s = oc->cull_s;
+  s->use();
+  s->set_unif_mat4("u_view_proj", phase == OCCLUSION_PHASE_FIRST ? &oc->prev_view_proj : view_proj);
+  s->set_unif_1u("u_num_commands", oc->num_commands);
+  s->set_unif_1i("u_hiz_levels", oc->num_levels);
+  s->set_unif_1u("u_phase", phase == OCCLUSION_PHASE_FIRST ? 0 : 1);
+  s->set_unif_1i("u_test", oc->enabled && oc->has_history);
+  s->set_unif_1i("u_hiz", 0);
+  gl_active_texture(GL_TEXTURE0);
+  gl_bind_texture(GL_TEXTURE_2D, oc->hiz_tid);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, oc->bounds_ssbo);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, oc->command_buffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, oc->drawn_ssbo);
+  glDispatchCompute((oc->num_commands + OCCLUSION_CULL_GROUP_SIZE - 1) / OCCLUSION_CULL_GROUP_SIZE, 1, 1);
+  // The commands are read by the indirect draws, drawn by the second phase
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void occlusion_build_hiz(OcclusionCuller *oc, uint32_t depth_tid, float scale_x, float scale_y) {
+  if (!oc->enabled) {
+    oc->has_history = false;
+    return;
+  }
+  Shader *s = oc->reduce_s;
+  s->use();
+  s->set_unif_1i("u_depth", 0);
+  s->set_unif_2f("u_depth_scale", scale_x, scale_y);
+  gl_active_texture(GL_TEXTURE0);
+  gl_bind_texture(GL_TEXTURE_2D, depth_tid);
+  for (int level = 0; level < oc->num_levels; level++) {
+    int w = oc->w >> level;
+    int h = oc->h >> level;
+    w = w > 0 ? w : 1;
+    h = h > 0 ? h : 1;
+    s->set_unif_1i("u_first", level == 0);
+    if (level > 0) {
+      glBindImageTexture(0, oc->hiz_tid, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+    }
+    glBindImageTexture(1, oc->hiz_tid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute((w + OCCLUSION_REDUCE_GROUP_SIZE - 1) / OCCLUSION_REDUCE_GROUP_SIZE,
+                      (h + OCCLUSION_REDUCE_GROUP_SIZE - 1) / OCCLUSION_REDUCE_GROUP_SIZE, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+  }
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+  oc->has_history = true;
+}
+
+void occlusion_end_frame(OcclusionCuller *oc, Mat4 *view_proj) {
+  oc->prev_view_proj = *view_proj;
+}
+
+void occlusion_shutdown(OcclusionCuller *oc) {
+  gl_delete_textures(1, &oc->hiz_tid);
+  glDeleteBuffers(1, &oc->bounds_ssbo);
+  glDeleteBuffers(1, &oc->command_buffer);
+  glDeleteBuffers(1, &oc->drawn_ssbo);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <rw_math.h>
+#include "shader.h"
+#include "assets.h"
+#include "cull.h"
+
+#define OCCLUSION_CULL_GROUP_SIZE 64
+#define OCCLUSION_REDUCE_GROUP_SIZE 8
+
+// Matches DrawElementsIndirectCommand
+struct DrawCommand {
+  uint32_t count;
+  uint32_t instance_count;
+  uint32_t first;
+  uint32_t base_vertex;
+  uint32_t base_instance;
+};
+
+enum OcclusionPhase {
+  // Test against last frame's pyramid with last frame's view_proj
+  OCCLUSION_PHASE_FIRST,
+  // Retest what the first phase rejected against the pyramid of what it drew
+  OCCLUSION_PHASE_SECOND
+};
+
+// Two phase Hi-Z occlusion culling. Culling results never come back to the CPU,
+// the compute shader writes instance_count straight into the indirect draw buffer.
+// The buffer only holds this frame's frustum survivors, in submission order, and
+// each command's base_instance is its draw id.
+struct OcclusionCuller {
+  bool enabled;
+  bool has_history;
+  int w;
+  int h;
+  int num_levels;
+  uint32_t hiz_tid;
+  uint32_t bounds_ssbo;
+  uint32_t command_buffer;
+  uint32_t drawn_ssbo;
+  uint32_t num_draws;
+  uint32_t num_commands;
+  Mat4 prev_view_proj;
+  Shader *reduce_s;
+  Shader *cull_s;
+};
+
+void occlusion_init(OcclusionCuller *oc, Shader *reduce_s, Shader *cull_s, int w, int h);
+// Reallocates the pyramid for a new depth size, the next first phase draws everything
+void occlusion_resize(OcclusionCuller *oc, int w, int h);
+// Sizes the buffers for draw ids [0, num_draws)
+void occlusion_set_num_draws(OcclusionCuller *oc, uint32_t num_draws);
+// This frame's commands, at most num_draws. Both phases cull the same commands.
+void occlusion_set_commands(OcclusionCuller *oc, const DrawCommand *commands, uint32_t count);
+// Indexed by draw id
+void occlusion_set_bounds(OcclusionCuller *oc, const Aabb *boxes, uint32_t count);
+void occlusion_cull(OcclusionCuller *oc, OcclusionPhase phase, Mat4 *view_proj);
+// Rebuilds the pyramid from a depth texture the same size as the culler, of which
+// only the bottom-left scale_x by scale_y was rendered to
+void occlusion_build_hiz(OcclusionCuller *oc, uint32_t depth_tid, float scale_x, float scale_y);
+// Keeps view_proj for next frame's first phase
+void occlusion_end_frame(OcclusionCuller *oc, Mat4 *view_proj);
+void occlusion_shutdown(OcclusionCuller *oc);
@@ -0,0 +1,301 @@
+#include "render_graph.h"
+#include <stdio.h>
+#include <string.h>
+#include <glad/glad.h>
+#include "gl_state.h"
+
+static bool is_depth_format(uint32_t format) {
+  return format == GL_DEPTH_COMPONENT16 || format == GL_DEPTH_COMPONENT24 || format == GL_DEPTH_COMPONENT32F ||
+         format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+}
+
+static bool has_stencil(uint32_t format) {
+  return format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+}
+
+static void delete_framebuffers(RenderGraph *g) {
+  for (RgFramebuffer &fb : g->framebuffers) {
+    gl_delete_framebuffers(1, &fb.fbo);
+  }
+  g->framebuffers.clear();
+}
+
+void render_graph_init(RenderGraph *g, RenderTargetPool *pool) {
+  g->pool = pool;
+  g->backbuffer_w = 0;
+  g->backbuffer_h = 0;
+  g->pool_generation = pool->generation;
+}
+
+void render_graph_destroy(RenderGraph *g) {
+  delete_framebuffers(g);
+  g->resources.clear();
+  g->passes.clear();
+}
+
+void render_graph_begin(RenderGraph *g, int backbuffer_w, int backbuffer_h) {
+  for (RgResource &r : g->resources) {
+    if (r.tid) {
+      printf("ERROR: Render graph texture %s was never released\n", r.name);
+      render_target_release(g->pool, r.tid);
+    }
+  }
+  g->resources.clear();
+  g->passes.clear();
+  g->backbuffer_w = backbuffer_w;
+  g->backbuffer_h = backbuffer_h;
+  if (g->pool_generation != g->pool->generation) {
+    delete_framebuffers(g);
+    g->pool_generation = g->pool->generation;
+  }
+}
+
+uint32_t render_graph_texture(RenderGraph *g, const char *name, int w, int h, uint32_t format) {
+  RgResource r = {};
+  r.name = name;
+  r.w = w;
+  r.h = h;
+  r.format = format;
+  r.first_pass = RENDER_GRAPH_NONE;
+  r.last_pass = RENDER_GRAPH_NONE;
+  g->resources.push_back(r);
+  return (uint32_t) g->resources.size() - 1;
+}
+
+uint32_t render_graph_add_pass(RenderGraph *g, const char *name) {
+  RgPass p;
+  p.name = name;
+  p.num_colors = 0;
+  p.depth = { RENDER_GRAPH_NONE, RG_LOAD, false };
+  p.backbuffer = false;
+  p.viewport_w = 0;
+  p.viewport_h = 0;
+  p.side_effect = false;
+  p.culled = false;
+  g->passes.push_back(p);
+  return (uint32_t) g->passes.size() - 1;
+}
+
+void render_graph_read(RenderGraph *g, uint32_t pass, uint32_t res) {
+  g->passes[pass].reads.push_back(res);
+}
+
+void render_graph_write_image(RenderGraph *g, uint32_t pass, uint32_t res) {
+  g->passes[pass].image_writes.push_back(res);
+}
+
+void render_graph_color(RenderGraph *g, uint32_t pass, uint32_t res, RgLoad load) {
+  RgPass &p = g->passes[pass];
+  if (p.num_colors == RENDER_GRAPH_MAX_COLOR) {
+    printf("ERROR: Pass %s has more than %d color attachments\n", p.name, RENDER_GRAPH_MAX_COLOR);
+    return;
+  }
+  p.colors[p.num_colors++] = { res, load, true };
+}
+
+void render_graph_depth(RenderGraph *g, uint32_t pass, uint32_t res, RgLoad load, bool write) {
+  g->passes[pass].depth = { res, write ? load : RG_LOAD, write };
+}
+
+void render_graph_viewport(RenderGraph *g, uint32_t pass, int w, int h) {
+  g->passes[pass].viewport_w = w;
+  g->passes[pass].viewport_h = h;
+}
+
+void render_graph_backbuffer(RenderGraph *g, uint32_t pass) {
+  g->passes[pass].backbuffer = true;
+  g->passes[pass].side_effect = true;
+}
+
+void render_graph_side_effect(RenderGraph *g, uint32_t pass) {
+  g->passes[pass].side_effect = true;
+}
+
+static void touch(RgResource &r, uint32_t pass) {
+  if (r.first_pass == RENDER_GRAPH_NONE) {
+    r.first_pass = pass;
+  }
+  r.last_pass = pass;
+}
+
+void render_graph_compile(RenderGraph *g) {
+  // Walk back from the side effects. A pass is needed if something after it reads
+  // what it writes. Attachments it overwrites are dead before it, what it reads
+  // (including loaded attachments) is live.
+  std::vector<bool> live(g->resources.size(), false);
+  for (size_t i = g->passes.size(); i-- > 0;) {
+    RgPass &p = g->passes[i];
+    bool needed = p.side_effect;
+    for (uint32_t c = 0; c < p.num_colors; c++) {
+      needed = needed || live[p.colors[c].res];
+    }
+    if (p.depth.res != RENDER_GRAPH_NONE && p.depth.write) {
+      needed = needed || live[p.depth.res];
+    }
+    for (uint32_t res : p.image_writes) {
+      needed = needed || live[res];
+    }
+    p.culled = !needed;
+    if (p.culled) {
+      continue;
+    }
+    for (uint32_t c = 0; c < p.num_colors; c++) {
+      live[p.colors[c].res] = p.colors[c].load == RG_LOAD;
+    }
+    if (p.depth.res != RENDER_GRAPH_NONE) {
+      live[p.depth.res] = !p.depth.write || p.depth.load == RG_LOAD;
+    }
+    for (uint32_t res : p.reads) {
+      live[res] = true;
+    }
+  }
+
+  for (uint32_t i = 0; i < g->passes.size(); i++) {
+    RgPass &p = g->passes[i];
+    if (p.culled) {
+      continue;
+    }
+    for (uint32_t res : p.reads) {
+      touch(g->resources[res], i);
+    }
+    for (uint32_t res : p.image_writes) {
+      touch(g->resources[res], i);
+    }
+    for (uint32_t c = 0; c < p.num_colors; c++) {
+      touch(g->resources[p.colors[c].res], i);
+    }
+    if (p.depth.res != RENDER_GRAPH_NONE) {
+      touch(g->resources[p.depth.res], i);
+    }
+  }
+}
+
+static uint32_t get_framebuffer(RenderGraph *g, const uint32_t *colors, uint32_t num_colors, uint32_t depth) {
+  uint32_t tids[RENDER_GRAPH_MAX_COLOR + 1] = {};
+  for (uint32_t c = 0; c < num_colors; c++) {
+    tids[c] = colors[c];
+  }
+  tids[RENDER_GRAPH_MAX_COLOR] = depth;
+  for (RgFramebuffer &fb : g->framebuffers) {
+    if (memcmp(fb.tids, tids, sizeof(tids)) == 0) {
+      return fb.fbo;
+    }
+  }
+
+  // DSA, so making one never disturbs the bound framebuffer
+  RgFramebuffer fb;
+  memcpy(fb.tids, tids, sizeof(tids));
+  glCreateFramebuffers(1, &fb.fbo);
+  GLenum draw_buffers[RENDER_GRAPH_MAX_COLOR];
+  for (uint32_t c = 0; c < num_colors; c++) {
+    glNamedFramebufferTexture(fb.fbo, GL_COLOR_ATTACHMENT0 + c, colors[c], 0);
+    draw_buffers[c] = GL_COLOR_ATTACHMENT0 + c;
+  }
+  if (num_colors > 0) {
+    glNamedFramebufferDrawBuffers(fb.fbo, num_colors, draw_buffers);
+  } else {
+    glNamedFramebufferDrawBuffer(fb.fbo, GL_NONE);
+    glNamedFramebufferReadBuffer(fb.fbo, GL_NONE);
+  }
+  if (depth) {
+    GLint format = 0;
+    glGetTextureLevelParameteriv(depth, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+    glNamedFramebufferTexture(fb.fbo, has_stencil(format) ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT, depth, 0);
+  }
+  if (glCheckNamedFramebufferStatus(fb.fbo, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    printf("ERROR: Render graph framebuffer %u is not complete\n", fb.fbo);
+  }
+  g->framebuffers.push_back(fb);
+  return fb.fbo;
+}
+
+bool render_graph_begin_pass(RenderGraph *g, uint32_t pass) {
+  RgPass &p = g->passes[pass];
+  if (p.culled) {
+    return false;
+  }
+  for (RgResource &r : g->resources) {
+    if (r.first_pass == pass) {
+      r.tid = render_target_acquire(g->pool, r.w, r.h, r.format);
+    }
+  }
+
+  GLbitfield barriers = 0;
+  for (uint32_t res : p.reads) {
+    if (g->resources[res].image_written) {
+      barriers |= GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+      g->resources[res].image_written = false;
+    }
+  }
+  for (uint32_t c = 0; c < p.num_colors; c++) {
+    if (g->resources[p.colors[c].res].image_written) {
+      barriers |= GL_FRAMEBUFFER_BARRIER_BIT;
+      g->resources[p.colors[c].res].image_written = false;
+    }
+  }
+  for (uint32_t res : p.image_writes) {
+    if (g->resources[res].image_written) {
+      barriers |= GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+    }
+    g->resources[res].image_written = true;
+  }
+  if (barriers) {
+    glMemoryBarrier(barriers);
+  }
+
+  if (p.backbuffer) {
+    gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, g->backbuffer_w, g->backbuffer_h);
+  } else if (p.num_colors > 0 || p.depth.res != RENDER_GRAPH_NONE) {
+    uint32_t colors[RENDER_GRAPH_MAX_COLOR];
+    for (uint32_t c = 0; c < p.num_colors; c++) {
+      colors[c] = g->resources[p.colors[c].res].tid;
+    }
+    uint32_t depth = p.depth.res != RENDER_GRAPH_NONE ? g->resources[p.depth.res].tid : 0;
+    gl_bind_framebuffer(GL_FRAMEBUFFER, get_framebuffer(g, colors, p.num_colors, depth));
+    RgResource &first = g->resources[p.num_colors > 0 ? p.colors[0].res : p.depth.res];
+    if (p.viewport_w > 0) {
+      glViewport(0, 0, p.viewport_w, p.viewport_h);
+    } else {
+      glViewport(0, 0, first.w, first.h);
+    }
+
+    const float black[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (uint32_t c = 0; c < p.num_colors; c++) {
+      if (p.colors[c].load == RG_CLEAR) {
+        glClearBufferfv(GL_COLOR, c, black);
+      }
+    }
+    if (p.depth.res != RENDER_GRAPH_NONE && p.depth.load == RG_CLEAR) {
+      RgResource &d = g->resources[p.depth.res];
+      if (has_stencil(d.format)) {
+        glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+      } else if (is_depth_format(d.format)) {
+        const float one = 1.0f;
+        glClearBufferfv(GL_DEPTH, 0, &one);
+      }
+    }
+  }
+  return true;
+}
+
+void render_graph_end_pass(RenderGraph *g, uint32_t pass) {
+  for (RgResource &r : g->resources) {
+    if (r.last_pass == pass && r.tid) {
+      render_target_release(g->pool, r.tid);
+      r.tid = 0;
+    }
+  }
+}
+
+uint32_t render_graph_tid(RenderGraph *g, uint32_t res) {
+  return g->resources[res].tid;
+}
+
+uint32_t render_graph_read_fbo(RenderGraph *g, uint32_t res) {
+  RgResource &r = g->resources[res];
+  if (is_depth_format(r.format)) {
+    return get_framebuffer(g, NULL, 0, r.tid);
+  }
+  return get_framebuffer(g, &r.tid, 1, 0);
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "render_target_pool.h"
+
+#define RENDER_GRAPH_MAX_COLOR 8
+#define RENDER_GRAPH_NONE UINT32_MAX
+
+// What happens to an attachment's previous contents when the pass starts
+enum RgLoad {
+  // Kept, the pass draws on top of what an earlier pass left. Counts as a read.
+  RG_LOAD,
+  RG_CLEAR,
+  // The pass overwrites every pixel, e.g. a blit
+  RG_DONT_CARE
+};
+
+struct RgResource {
+  const char *name;
+  int w;
+  int h;
+  uint32_t format;
+  // Only valid between the first and last pass that use it
+  uint32_t tid;
+  uint32_t first_pass;
+  uint32_t last_pass;
+  // Last write was an image store, the next access needs a barrier
+  bool image_written;
+};
+
+struct RgAttachment {
+  uint32_t res;
+  RgLoad load;
+  bool write;
+};
+
+struct RgPass {
+  const char *name;
+  // Sampled in shaders or read by blits
+  std::vector<uint32_t> reads;
+  // Written with image stores
+  std::vector<uint32_t> image_writes;
+  RgAttachment colors[RENDER_GRAPH_MAX_COLOR];
+  uint32_t num_colors;
+  RgAttachment depth;
+  bool backbuffer;
+  // 0 covers the whole attachment
+  int viewport_w;
+  int viewport_h;
+  // Runs even if nothing reads what it writes (presenting, readbacks)
+  bool side_effect;
+  bool culled;
+};
+
+// Cached by attachments, rebuilt whenever the pool deletes textures since GL
+// may hand a deleted texture's name to a new one
+struct RgFramebuffer {
+  uint32_t tids[RENDER_GRAPH_MAX_COLOR + 1];
+  uint32_t fbo;
+};
+
+// The frame declared as passes and the textures they read and write, rebuilt
+// every frame. Compiling culls passes nothing reads from, in reverse from the
+// side effects, and works out each transient texture's lifetime over the passes
+// left. Executing runs the passes in declaration order: begin_pass acquires the
+// textures first used there, issues barriers, binds the framebuffer, sets the
+// viewport and clears; end_pass gives back the textures last used there, so later
+// passes can get the same memory from the pool.
+struct RenderGraph {
+  RenderTargetPool *pool;
+  int backbuffer_w;
+  int backbuffer_h;
+  std::vector<RgResource> resources;
+  std::vector<RgPass> passes;
+  std::vector<RgFramebuffer> framebuffers;
+  uint32_t pool_generation;
+};
+
+void render_graph_init(RenderGraph *g, RenderTargetPool *pool);
+void render_graph_destroy(RenderGraph *g);
+void render_graph_begin(RenderGraph *g, int backbuffer_w, int backbuffer_h);
+// A texture that lives within the frame
+uint32_t render_graph_texture(RenderGraph *g, const char *name, int w, int h, uint32_t format);
+uint32_t render_graph_add_pass(RenderGraph *g, const char *name);
+void render_graph_read(RenderGraph *g, uint32_t pass, uint32_t res);
+void render_graph_write_image(RenderGraph *g, uint32_t pass, uint32_t res);
+void render_graph_color(RenderGraph *g, uint32_t pass, uint32_t res, RgLoad load);
+// Read only depth is attached for testing but never written
+void render_graph_depth(RenderGraph *g, uint32_t pass, uint32_t res, RgLoad load, bool write);
+// Renders into the bottom-left w x h of the attachments
+void render_graph_viewport(RenderGraph *g, uint32_t pass, int w, int h);
+// Draws to the default framebuffer, which makes it a side effect
+void render_graph_backbuffer(RenderGraph *g, uint32_t pass);
+void render_graph_side_effect(RenderGraph *g, uint32_t pass);
+void render_graph_compile(RenderGraph *g);
+// False if the pass was culled, otherwise end_pass has to follow
+bool render_graph_begin_pass(RenderGraph *g, uint32_t pass);
+void render_graph_end_pass(RenderGraph *g, uint32_t pass);
+// Only valid inside passes that use the resource
+uint32_t render_graph_tid(RenderGraph *g, uint32_t res);
+// Framebuffer with just this texture attached, for blits and readbacks
+uint32_t render_graph_read_fbo(RenderGraph *g, uint32_t res);
@@ -0,0 +1,98 @@
+#include "render_queue.h"
+#include <string.h>
+
+uint64_t render_key(RenderPass pass, uint32_t program, uint32_t material, uint32_t vao, float depth) {
+  const uint32_t max_depth = (1u << RENDER_KEY_DEPTH_BITS) - 1;
+  depth = depth < 0.0f ? 0.0f : (depth > 1.0f ? 1.0f : depth);
+  return ((uint64_t) (pass & 0xf) << RENDER_KEY_PASS_SHIFT) |
+         ((uint64_t) (program & 0xff) << RENDER_KEY_PROGRAM_SHIFT) |
+         ((uint64_t) (material & 0xffff) << RENDER_KEY_MATERIAL_SHIFT) |
+         ((uint64_t) (vao & 0xfff) << RENDER_KEY_VAO_SHIFT) |
+         (uint64_t) (depth * max_depth);
+}
+
+static void generate_task(uint32_t start, uint32_t end, uint32_t threadnum, void *args) {
+  RenderQueue *q = (RenderQueue *) args;
+  q->generate(start, end, q->generate_args, q->worker_packets[threadnum]);
+}
+
+void render_queue_init(RenderQueue *q, enkiTaskScheduler *ts) {
+  q->ts = ts;
+  q->task = enkiCreateTaskSet(ts, generate_task);
+  q->worker_packets.resize(enkiGetNumTaskThreads(ts));
+}
+
+void render_queue_destroy(RenderQueue *q) {
+  enkiDeleteTaskSet(q->task);
+}
+
+void render_queue_begin(RenderQueue *q) {
+  for (std::vector<DrawPacket> &wp : q->worker_packets) {
+    wp.clear();
+  }
+  q->packets.clear();
+}
+
+void render_queue_generate(RenderQueue *q, uint32_t count, PacketGenerator generate, void *args) {
+  if (count < RENDER_QUEUE_PARALLEL_THRESHOLD) {
+    generate(0, count, args, q->worker_packets[0]);
+    return;
+  }
+  q->generate = generate;
+  q->generate_args = args;
+  enkiAddTaskSetToPipe(q->ts, q->task, q, count);
+  enkiWaitForTaskSet(q->ts, q->task);
+}
+
+// LSD radix sort, 8 bits per pass. All eight histograms are built in one read,
+// and a digit every key shares (most of the pass/program bits in practice) is skipped.
+static void radix_sort(std::vector<DrawPacket> &packets, std::vector<DrawPacket> &scratch) {
+  size_t n = packets.size();
+  if (n < 2) {
+    return;
+  }
+  uint32_t counts[8][256];
+  memset(counts, 0, sizeof(counts));
+  for (size_t i = 0; i < n; i++) {
+    uint64_t key = packets[i].key;
+    for (int d = 0; d < 8; d++) {
+      counts[d][(key >> (8 * d)) & 0xff]++;
+    }
+  }
+  scratch.resize(n);
+  DrawPacket *src = packets.data();
+  DrawPacket *dst = scratch.data();
+  for (int d = 0; d < 8; d++) {
+    uint32_t *c = counts[d];
+    if (c[(src[0].key >> (8 * d)) & 0xff] == n) {
+      continue;
+    }
+    uint32_t offsets[256];
+    uint32_t sum = 0;
+    for (int b = 0; b < 256; b++) {
+      offsets[b] = sum;
+      sum += c[b];
+    }
+    for (size_t i = 0; i < n; i++) {
+      dst[offsets[(src[i].key >> (8 * d)) & 0xff]++] = src[i];
+    }
+    DrawPacket *tmp = src;
+    src = dst;
+    dst = tmp;
+  }
+  if (src != packets.data()) {
+    packets.swap(scratch);
+  }
+}
+
+void render_queue_sort(RenderQueue *q) {
+  size_t total = 0;
+  for (std::vector<DrawPacket> &wp : q->worker_packets) {
+    total += wp.size();
+  }
+  q->packets.reserve(total);
+  for (std::vector<DrawPacket> &wp : q->worker_packets) {
+    q->packets.insert(q->packets.end(), wp.begin(), wp.end());
+  }
+  radix_sort(q->packets, q->scratch);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <TaskScheduler_c.h>
+
+// Below this many items packets are generated on the calling thread
+#define RENDER_QUEUE_PARALLEL_THRESHOLD 1024
+
+// 64-bit sort key, most significant first:
+//   pass     4 bits  passes run in order
+//   program  8 bits
+//   material 16 bits
+//   vao      12 bits
+//   depth    24 bits  view distance, front to back within the same state
+// Sorting by the key groups draws by the state that is most expensive to change.
+#define RENDER_KEY_PASS_SHIFT 60
+#define RENDER_KEY_PROGRAM_SHIFT 52
+#define RENDER_KEY_MATERIAL_SHIFT 36
+#define RENDER_KEY_VAO_SHIFT 24
+#define RENDER_KEY_DEPTH_BITS 24
+
+enum RenderPass {
+  RENDER_PASS_GEOMETRY,
+  RENDER_PASS_FORWARD,
+  RENDER_PASS_COUNT
+};
+
+struct DrawPacket {
+  uint64_t key;
+  // What to draw, up to the pass (instance, draw index, ...)
+  uint32_t index;
+  uint32_t pad;
+};
+
+// depth is the view distance divided by the far plane, clamped to [0, 1]
+uint64_t render_key(RenderPass pass, uint32_t program, uint32_t material, uint32_t vao, float depth);
+inline uint32_t render_key_material(uint64_t key) {
+  return (uint32_t) (key >> RENDER_KEY_MATERIAL_SHIFT) & 0xffff;
+}
+
+// Fills out with the packets of items [start, end). Runs on any worker, so it may only read shared state.
+typedef void (*PacketGenerator)(uint32_t start, uint32_t end, void *args, std::vector<DrawPacket> &out);
+
+// Packets for one frame. Every worker appends to its own vector, they're merged
+// and radix sorted once everything is generated. The vectors keep their capacity
+// between frames, so after the first frames nothing is allocated.
+struct RenderQueue {
+  std::vector<std::vector<DrawPacket>> worker_packets;
+  std::vector<DrawPacket> packets;
+  std::vector<DrawPacket> scratch;
+  enkiTaskScheduler *ts;
+  enkiTaskSet *task;
+  PacketGenerator generate;
+  void *generate_args;
+};
+
+void render_queue_init(RenderQueue *q, enkiTaskScheduler *ts);
+void render_queue_destroy(RenderQueue *q);
+// Drops last frame's packets
+void render_queue_begin(RenderQueue *q);
+// Runs generate over count items, split across the workers
+void render_queue_generate(RenderQueue *q, uint32_t count, PacketGenerator generate, void *args);
+// Merges the worker packets into packets, sorted by key
+void render_queue_sort(RenderQueue *q);
@@ -0,0 +1,90 @@
+#include "render_target_pool.h"
+#include <stdio.h>
+#include <glad/glad.h>
+#include "gl_state.h"
+
+static uint32_t bytes_per_pixel(uint32_t format) {
+  switch (format) {
+    case GL_R8: return 1;
+    case GL_RG16F: return 4;
+    case GL_RGB16F: return 6;
+    case GL_RGBA16F: return 8;
+    case GL_RGBA32F: return 16;
+    case GL_DEPTH_COMPONENT32F: return 4;
+    // Padded to 4 bytes by every driver we've seen
+    default: return 4;
+  }
+}
+
+void render_target_pool_init(RenderTargetPool *pool) {
+  pool->targets.clear();
+  pool->frame = 0;
+  pool->bytes = 0;
+  pool->generation = 0;
+}
+
+void render_target_pool_destroy(RenderTargetPool *pool) {
+  for (PooledTarget &t : pool->targets) {
+    if (t.in_use) {
+      printf("ERROR: Render target %u (%dx%d) is still in use\n", t.tid, t.w, t.h);
+    }
+    gl_delete_textures(1, &t.tid);
+  }
+  pool->targets.clear();
+  pool->bytes = 0;
+  pool->generation++;
+}
+
+uint32_t render_target_acquire(RenderTargetPool *pool, int w, int h, uint32_t format) {
+  for (PooledTarget &t : pool->targets) {
+    if (!t.in_use && t.w == w && t.h == h && t.format == format) {
+      t.in_use = true;
+      t.last_used_frame = pool->frame;
+      return t.tid;
+    }
+  }
+
+  PooledTarget t;
+  t.w = w;
+  t.h = h;
+  t.format = format;
+  t.in_use = true;
+  t.last_used_frame = pool->frame;
+  glGenTextures(1, &t.tid);
+  gl_bind_texture(GL_TEXTURE_2D, t.tid);
+  glTexStorage2D(GL_TEXTURE_2D, 1, format, w, h);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  pool->targets.push_back(t);
+  pool->bytes += (uint64_t) w * h * bytes_per_pixel(format);
+  return t.tid;
+}
+
+void render_target_release(RenderTargetPool *pool, uint32_t tid) {
+  for (PooledTarget &t : pool->targets) {
+    if (t.tid == tid) {
+      t.in_use = false;
+      t.last_used_frame = pool->frame;
+      return;
+    }
+  }
+  printf("ERROR: Texture %u doesn't belong to the render target pool\n", tid);
+}
+
+void render_target_pool_end_frame(RenderTargetPool *pool) {
+  size_t num_kept = 0;
+  for (size_t i = 0; i < pool->targets.size(); i++) {
+    PooledTarget &t = pool->targets[i];
+    if (!t.in_use && pool->frame - t.last_used_frame >= RENDER_TARGET_MAX_IDLE_FRAMES) {
+      gl_delete_textures(1, &t.tid);
+      pool->bytes -= (uint64_t) t.w * t.h * bytes_per_pixel(t.format);
+      pool->generation++;
+      continue;
+    }
+    pool->targets[num_kept++] = t;
+  }
+  pool->targets.resize(num_kept);
+  pool->frame++;
+}
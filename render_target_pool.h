@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// Frames a released target stays around unused before it's deleted. Long enough
+// that flipping between two sizes (fullscreen toggles) doesn't reallocate.
+#define RENDER_TARGET_MAX_IDLE_FRAMES 4
+
+// Single level 2D texture with immutable storage, keyed by size and internal format
+struct PooledTarget {
+  uint32_t tid;
+  int w;
+  int h;
+  uint32_t format;
+  bool in_use;
+  uint32_t last_used_frame;
+};
+
+// Render targets handed out by size and format. A released target goes straight
+// back into the pool, so a later acquire in the same frame gets the same memory:
+// targets whose lifetimes don't overlap share it. After a resize the old size is
+// never asked for again and its targets are deleted once they've been idle for
+// RENDER_TARGET_MAX_IDLE_FRAMES.
+struct RenderTargetPool {
+  std::vector<PooledTarget> targets;
+  uint32_t frame;
+  uint64_t bytes;
+  // Bumped whenever a texture is deleted, anything caching texture names checks it
+  uint32_t generation;
+};
+
+void render_target_pool_init(RenderTargetPool *pool);
+void render_target_pool_destroy(RenderTargetPool *pool);
+// Sampler state is left to the caller, a reused target keeps what its last user set
+uint32_t render_target_acquire(RenderTargetPool *pool, int w, int h, uint32_t format);
+void render_target_release(RenderTargetPool *pool, uint32_t tid);
+// Deletes targets that have been idle too long
+void render_target_pool_end_frame(RenderTargetPool *pool);
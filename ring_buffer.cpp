@@ -0,0 +1,97 @@
+#include "ring_buffer.h"
+#include <stdio.h>
+
+static uint32_t align_up(uint32_t x, uint32_t alignment) {
+  return (x + alignment - 1) / alignment * alignment;
+}
+
+bool ring_buffer_init(RingBuffer *rb, uint32_t frame_size) {
+  GLint ubo_align = 0;
+  GLint ssbo_align = 0;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &ubo_align);
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &ssbo_align);
+  rb->alignment = ubo_align > ssbo_align ? ubo_align : ssbo_align;
+  if (rb->alignment < 16) {
+    rb->alignment = 16;
+  }
+  rb->frame_size = align_up(frame_size, rb->alignment);
+  rb->frame = 0;
+  rb->head = 0;
+  for (int i = 0; i < RING_BUFFER_FRAMES; i++) {
+    rb->fences[i] = 0;
+  }
+
+  GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  glGenBuffers(1, &rb->buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, rb->buffer);
+  glBufferStorage(GL_COPY_WRITE_BUFFER, (GLsizeiptr) rb->frame_size * RING_BUFFER_FRAMES, NULL, flags);
+  rb->mapped = (uint8_t *) glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, (GLsizeiptr) rb->frame_size * RING_BUFFER_FRAMES, flags);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  if (!rb->mapped) {
+    printf("ERROR: Could not map a %u byte ring buffer\n", rb->frame_size * RING_BUFFER_FRAMES);
+    glDeleteBuffers(1, &rb->buffer);
+    rb->buffer = 0;
+    return false;
+  }
+  return true;
+}
+
+void ring_buffer_destroy(RingBuffer *rb) {
+  for (int i = 0; i < RING_BUFFER_FRAMES; i++) {
+    if (rb->fences[i]) {
+      glDeleteSync(rb->fences[i]);
+      rb->fences[i] = 0;
+    }
+  }
+  if (rb->buffer) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, rb->buffer);
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glDeleteBuffers(1, &rb->buffer);
+  }
+  rb->buffer = 0;
+  rb->mapped = NULL;
+}
+
+void ring_buffer_begin_frame(RingBuffer *rb) {
+  rb->frame = (rb->frame + 1) % RING_BUFFER_FRAMES;
+  rb->head = 0;
+  GLsync fence = rb->fences[rb->frame];
+  if (!fence) {
+    return;
+  }
+  // Normally already signalled, the section was last used RING_BUFFER_FRAMES - 1 frames ago
+  GLbitfield flags = 0;
+  for (;;) {
+    GLenum result = glClientWaitSync(fence, flags, 1000000);
+    if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED) {
+      break;
+    }
+    if (result == GL_WAIT_FAILED) {
+      printf("ERROR: Waiting on the ring buffer fence failed\n");
+      break;
+    }
+    flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+  }
+  glDeleteSync(fence);
+  rb->fences[rb->frame] = 0;
+}
+
+RingAlloc ring_buffer_alloc(RingBuffer *rb, uint32_t size) {
+  RingAlloc result = {};
+  uint32_t aligned = align_up(size, rb->alignment);
+  uint32_t start = rb->head.fetch_add(aligned);
+  if (start + size > rb->frame_size) {
+    printf("ERROR: Ring buffer section is full, %u bytes don't fit\n", size);
+    return result;
+  }
+  result.buffer = rb->buffer;
+  result.offset = rb->frame * rb->frame_size + start;
+  result.ptr = rb->mapped + result.offset;
+  result.size = size;
+  return result;
+}
+
+void ring_buffer_end_frame(RingBuffer *rb) {
+  rb->fences[rb->frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <glad/glad.h>
+
+// Frames the CPU may run ahead of the GPU, each one gets its own section
+#define RING_BUFFER_FRAMES 3
+
+struct RingAlloc {
+  void *ptr;
+  uint32_t buffer;
+  // From the start of the buffer, what glBindBufferRange takes
+  uint32_t offset;
+  uint32_t size;
+};
+
+// One persistently mapped, coherent buffer split into RING_BUFFER_FRAMES sections
+// for per-frame data. The GL thread opens a section with ring_buffer_begin_frame,
+// which waits on the fence of the frame that last used it, and fences it again in
+// ring_buffer_end_frame. In between any thread can allocate and memcpy straight
+// into the mapping, draws bind the ranges.
+struct RingBuffer {
+  uint32_t buffer;
+  uint8_t *mapped;
+  uint32_t frame_size;
+  // Allocations are aligned for both uniform and storage buffer ranges
+  uint32_t alignment;
+  uint32_t frame;
+  std::atomic<uint32_t> head;
+  GLsync fences[RING_BUFFER_FRAMES];
+};
+
+bool ring_buffer_init(RingBuffer *rb, uint32_t frame_size);
+void ring_buffer_destroy(RingBuffer *rb);
+// Waits until the GPU is done with the next section, GL thread only
+void ring_buffer_begin_frame(RingBuffer *rb);
+// Safe from any thread between begin and end. ptr is NULL if the section is full.
+RingAlloc ring_buffer_alloc(RingBuffer *rb, uint32_t size);
+// After the last draw reading this frame's section, GL thread only
+void ring_buffer_end_frame(RingBuffer *rb);
@@ -0,0 +1,406 @@
+#include "scene.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include "simd_math.h"
+
+// Compiled scene format, all little endian. Everything after the header is a flat
+// array so the whole file is read with one fread and copied straight out.
+//   SceneFileHeader
+//   char strings[string_bytes]       NUL terminated, referenced by byte offset
+//   uint32 meshes[num_meshes][2]     path and occluder path offsets
+//   uint32 materials[num_materials][5] albedo, normal, metallic, roughness, ao offsets
+//   SceneLightDesc lights[num_lights]
+//   SceneNodeDesc nodes[num_nodes]
+#define SCENE_FILE_MAGIC "R3DS"
+#define SCENE_FILE_VERSION 4
+
+struct SceneFileHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t env_hdr;
+  uint32_t string_bytes;
+  uint32_t num_meshes;
+  uint32_t num_materials;
+  uint32_t num_lights;
+  uint32_t num_nodes;
+  SceneSunDesc sun;
+};
+
+static Quaternion identity_rotation() {
+  return rwm_q_init_rotation(rwm_v3_init(0.0f, 1.0f, 0.0f), 0.0f);
+}
+
+// Reads the optional "parent p", "pos x y z", "scale x y z", "rotate ax ay az deg" and
+// "dynamic" that follow a group or instance. Rotations are applied in the order they're listed.
+// False if a key is unknown or missing any of its values.
+static bool parse_transform(std::istringstream &ss, std::unordered_map<std::string, int32_t> &node_names,
+                            int32_t *parent, Mat4 *local, uint32_t *flags) {
+  Vec3 pos = rwm_v3_zero();
+  Vec3 scale = rwm_v3_init(1.0f, 1.0f, 1.0f);
+  Quaternion rot = identity_rotation();
+  std::string key;
+  while (ss >> key) {
+    if (key == "parent") {
+      std::string name;
+      if (!(ss >> name)) {
+        return false;
+      }
+      auto it = node_names.find(name);
+      if (it == node_names.end()) {
+        printf("ERROR: Scene parent %s is not defined before its children\n", name.c_str());
+        return false;
+      }
+      *parent = it->second;
+    } else if (key == "pos") {
+      if (!(ss >> pos.x >> pos.y >> pos.z)) {
+        return false;
+      }
+    } else if (key == "scale") {
+      if (!(ss >> scale.x >> scale.y >> scale.z)) {
+        return false;
+      }
+    } else if (key == "rotate") {
+      Vec3 axis;
+      float deg;
+      if (!(ss >> axis.x >> axis.y >> axis.z >> deg)) {
+        return false;
+      }
+      rot = rwm_q_mult(rot, rwm_q_init_rotation(axis, rwm_to_radians(deg)));
+    } else if (key == "dynamic") {
+      *flags |= SCENE_NODE_DYNAMIC;
+    } else {
+      printf("ERROR: Unknown scene transform key %s\n", key.c_str());
+      return false;
+    }
+  }
+  *local = scene_trs(pos, scale, rot);
+  return true;
+}
+
+static int32_t lookup(std::unordered_map<std::string, int32_t> &names, const std::string &name, const char *what) {
+  auto it = names.find(name);
+  if (it == names.end()) {
+    printf("ERROR: Scene %s %s is not defined\n", what, name.c_str());
+    return -1;
+  }
+  return it->second;
+}
+
+bool scene_load_text(SceneDesc *desc, const char *path) {
+  std::ifstream f(path);
+  if (!f.is_open()) {
+    printf("ERROR: Scene could not be opened %s\n", path);
+    return false;
+  }
+  *desc = SceneDesc();
+  std::unordered_map<std::string, int32_t> mesh_names;
+  std::unordered_map<std::string, int32_t> material_names;
+  std::unordered_map<std::string, int32_t> node_names;
+
+  std::string line;
+  int line_num = 0;
+  while (std::getline(f, line)) {
+    line_num++;
+    std::istringstream ss(line);
+    std::string cmd;
+    if (!(ss >> cmd) || cmd[0] == '#') {
+      continue;
+    }
+
+    bool ok = true;
+    if (cmd == "env") {
+      ok = (bool) (ss >> desc->env_hdr);
+    } else if (cmd == "mesh") {
+      // mesh <name> <path> [occluder <path>]
+      std::string name, mesh_path, key, occluder_path;
+      ok = (bool) (ss >> name >> mesh_path);
+      if (ok && ss >> key) {
+        ok = key == "occluder" && (ss >> occluder_path);
+      }
+      mesh_names[name] = (int32_t) desc->meshes.size();
+      desc->meshes.push_back(mesh_path);
+      desc->occluders.push_back(occluder_path);
+    } else if (cmd == "material") {
+      std::string name;
+      SceneMaterialDesc m;
+      ok = (bool) (ss >> name >> m.albedo >> m.normal >> m.metallic >> m.roughness >> m.ao);
+      material_names[name] = (int32_t) desc->materials.size();
+      desc->materials.push_back(m);
+    } else if (cmd == "light") {
+      // light <pos> <color> [range r] [spot dx dy dz <inner deg> <outer deg>] [shadow]
+      SceneLightDesc l = {};
+      l.dir = rwm_v3_init(0.0f, -1.0f, 0.0f);
+      l.cos_inner = -1.0f;
+      l.cos_outer = -1.0f;
+      ok = (bool) (ss >> l.pos.x >> l.pos.y >> l.pos.z >> l.color.x >> l.color.y >> l.color.z);
+      std::string key;
+      while (ok && ss >> key) {
+        if (key == "range") {
+          ok = (bool) (ss >> l.range);
+        } else if (key == "spot") {
+          float inner = 0.0f, outer = 0.0f;
+          ok = (bool) (ss >> l.dir.x >> l.dir.y >> l.dir.z >> inner >> outer) && inner < outer && outer < 90.0f;
+          l.dir = rwm_v3_normalize(l.dir);
+          l.cos_inner = cosf(inner * 3.14159265359f / 180.0f);
+          l.cos_outer = cosf(outer * 3.14159265359f / 180.0f);
+        } else if (key == "shadow") {
+          l.casts_shadow = 1;
+        } else {
+          ok = false;
+        }
+      }
+      if (l.range <= 0.0f) {
+        float peak = fmaxf(l.color.x, fmaxf(l.color.y, l.color.z));
+        l.range = sqrtf(peak / SCENE_LIGHT_MIN_INTENSITY);
+      }
+      desc->lights.push_back(l);
+    } else if (cmd == "sun") {
+      // sun <dx dy dz> <r g b>
+      SceneSunDesc &sun = desc->sun;
+      ok = (bool) (ss >> sun.dir.x >> sun.dir.y >> sun.dir.z >> sun.color.x >> sun.color.y >> sun.color.z);
+      sun.dir = rwm_v3_normalize(sun.dir);
+      sun.enabled = 1;
+    } else if (cmd == "group" || cmd == "instance") {
+      SceneNodeDesc n = { SCENE_NO_PARENT, -1, -1, rwm_m4_identity() };
+      std::string name;
+      ok = (bool) (ss >> name);
+      if (ok && cmd == "instance") {
+        std::string mesh, material;
+        ok = (bool) (ss >> mesh >> material);
+        if (ok) {
+          n.mesh = lookup(mesh_names, mesh, "mesh");
+          n.material = lookup(material_names, material, "material");
+          ok = n.mesh >= 0 && n.material >= 0;
+        }
+      }
+      ok = ok && parse_transform(ss, node_names, &n.parent, &n.local, &n.flags);
+      node_names[name] = (int32_t) desc->nodes.size();
+      desc->nodes.push_back(n);
+    } else if (cmd == "grid") {
+      // grid <mesh> <material> <rows> <cols> <spacing> [transform], the transform places the
+      // whole grid and the cells are laid out on its xy plane around its origin
+      std::string mesh, material;
+      int rows = 0, cols = 0;
+      float spacing = 0.0f;
+      ok = (bool) (ss >> mesh >> material >> rows >> cols >> spacing);
+      SceneNodeDesc n = { SCENE_NO_PARENT, -1, -1, rwm_m4_identity() };
+      if (ok) {
+        n.mesh = lookup(mesh_names, mesh, "mesh");
+        n.material = lookup(material_names, material, "material");
+      }
+      ok = ok && n.mesh >= 0 && n.material >= 0 && parse_transform(ss, node_names, &n.parent, &n.local, &n.flags);
+      Mat4 grid_local = n.local;
+      for (int i = 0; ok && i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+          Mat4 cell = rwm_m4_identity();
+          cell.e[0][3] = (j - (cols/2)) * spacing;
+          cell.e[1][3] = (i - (rows/2)) * spacing;
+          n.local = mat4_mult(&grid_local, &cell);
+          desc->nodes.push_back(n);
+        }
+      }
+    } else {
+      printf("ERROR: Unknown scene command %s\n", cmd.c_str());
+      ok = false;
+    }
+
+    if (!ok || ss.bad()) {
+      printf("ERROR: %s:%d could not be parsed\n", path, line_num);
+      return false;
+    }
+  }
+  printf("Loaded scene %s: %zu meshes, %zu materials, %zu lights, %zu nodes\n", path,
+         desc->meshes.size(), desc->materials.size(), desc->lights.size(), desc->nodes.size());
+  return true;
+}
+
+static uint32_t add_string(std::vector<char> &strings, std::unordered_map<std::string, uint32_t> &offsets, const std::string &s) {
+  auto it = offsets.find(s);
+  if (it != offsets.end()) {
+    return it->second;
+  }
+  uint32_t offset = (uint32_t) strings.size();
+  strings.insert(strings.end(), s.begin(), s.end());
+  strings.push_back('\0');
+  offsets[s] = offset;
+  return offset;
+}
+
+bool scene_save_binary(SceneDesc *desc, const char *path) {
+  std::vector<char> strings;
+  std::unordered_map<std::string, uint32_t> offsets;
+  uint32_t env_hdr = add_string(strings, offsets, desc->env_hdr);
+  std::vector<uint32_t> meshes;
+  for (size_t i = 0; i < desc->meshes.size(); i++) {
+    meshes.push_back(add_string(strings, offsets, desc->meshes[i]));
+    meshes.push_back(add_string(strings, offsets, desc->occluders[i]));
+  }
+  std::vector<uint32_t> materials;
+  for (const SceneMaterialDesc &m : desc->materials) {
+    materials.push_back(add_string(strings, offsets, m.albedo));
+    materials.push_back(add_string(strings, offsets, m.normal));
+    materials.push_back(add_string(strings, offsets, m.metallic));
+    materials.push_back(add_string(strings, offsets, m.roughness));
+    materials.push_back(add_string(strings, offsets, m.ao));
+  }
+  // Keep the arrays after the strings 4 byte aligned
+  while (strings.size() % 4 != 0) {
+    strings.push_back('\0');
+  }
+
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    printf("ERROR: Scene could not be opened for writing %s\n", path);
+    return false;
+  }
+  SceneFileHeader header;
+  memcpy(header.magic, SCENE_FILE_MAGIC, 4);
+  header.version = SCENE_FILE_VERSION;
+  header.env_hdr = env_hdr;
+  header.string_bytes = (uint32_t) strings.size();
+  header.num_meshes = (uint32_t) desc->meshes.size();
+  header.num_materials = (uint32_t) desc->materials.size();
+  header.num_lights = (uint32_t) desc->lights.size();
+  header.num_nodes = (uint32_t) desc->nodes.size();
+  header.sun = desc->sun;
+  fwrite(&header, sizeof(header), 1, f);
+  fwrite(strings.data(), 1, strings.size(), f);
+  fwrite(meshes.data(), sizeof(uint32_t), meshes.size(), f);
+  fwrite(materials.data(), sizeof(uint32_t), materials.size(), f);
+  fwrite(desc->lights.data(), sizeof(SceneLightDesc), desc->lights.size(), f);
+  fwrite(desc->nodes.data(), sizeof(SceneNodeDesc), desc->nodes.size(), f);
+  fclose(f);
+  printf("Wrote compiled scene %s\n", path);
+  return true;
+}
+
+bool scene_load_binary(SceneDesc *desc, const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    printf("ERROR: Scene could not be opened %s\n", path);
+    return false;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  std::vector<uint8_t> data(size > 0 ? size : 0);
+  bool read_ok = size > 0 && fread(data.data(), 1, size, f) == (size_t) size;
+  fclose(f);
+
+  SceneFileHeader header;
+  if (!read_ok || data.size() < sizeof(header)) {
+    printf("ERROR: Scene could not be read %s\n", path);
+    return false;
+  }
+  memcpy(&header, data.data(), sizeof(header));
+  if (memcmp(header.magic, SCENE_FILE_MAGIC, 4) != 0 || header.version != SCENE_FILE_VERSION) {
+    printf("ERROR: %s is not a compiled scene or has the wrong version\n", path);
+    return false;
+  }
+  size_t expected = sizeof(header) + header.string_bytes +
+                    sizeof(uint32_t) * (2 * (size_t) header.num_meshes + 5 * (size_t) header.num_materials) +
+                    sizeof(SceneLightDesc) * header.num_lights + sizeof(SceneNodeDesc) * header.num_nodes;
+  if (data.size() != expected || header.string_bytes == 0 || data[sizeof(header) + header.string_bytes - 1] != '\0') {
+    printf("ERROR: Compiled scene %s is truncated or corrupt\n", path);
+    return false;
+  }
+
+  const uint8_t *p = data.data() + sizeof(header);
+  const char *strings = (const char *) p;
+  p += header.string_bytes;
+  auto str = [&](uint32_t offset) {
+    return offset < header.string_bytes ? std::string(strings + offset) : std::string();
+  };
+
+  *desc = SceneDesc();
+  desc->env_hdr = str(header.env_hdr);
+  desc->sun = header.sun;
+  const uint32_t *meshes = (const uint32_t *) p;
+  for (uint32_t i = 0; i < header.num_meshes; i++) {
+    desc->meshes.push_back(str(meshes[2 * i]));
+    desc->occluders.push_back(str(meshes[2 * i + 1]));
+  }
+  p += sizeof(uint32_t) * 2 * header.num_meshes;
+  const uint32_t *materials = (const uint32_t *) p;
+  for (uint32_t i = 0; i < header.num_materials; i++) {
+    const uint32_t *m = &materials[i * 5];
+    desc->materials.push_back({ str(m[0]), str(m[1]), str(m[2]), str(m[3]), str(m[4]) });
+  }
+  p += sizeof(uint32_t) * 5 * header.num_materials;
+  desc->lights.resize(header.num_lights);
+  memcpy(desc->lights.data(), p, sizeof(SceneLightDesc) * header.num_lights);
+  p += sizeof(SceneLightDesc) * header.num_lights;
+  desc->nodes.resize(header.num_nodes);
+  memcpy(desc->nodes.data(), p, sizeof(SceneNodeDesc) * header.num_nodes);
+
+  // The graph relies on parents coming first, don't trust the file on that
+  for (uint32_t i = 0; i < header.num_nodes; i++) {
+    SceneNodeDesc &n = desc->nodes[i];
+    if (n.parent < SCENE_NO_PARENT || n.parent >= (int32_t) i || n.mesh >= (int32_t) header.num_meshes || n.material >= (int32_t) header.num_materials ||
+        (n.mesh >= 0) != (n.material >= 0)) {
+      printf("ERROR: Compiled scene %s has a bad node %d\n", path, i);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool scene_load(SceneDesc *desc, const char *path) {
+  size_t len = strlen(path);
+  if (len > 7 && strcmp(path + len - 7, ".sceneb") == 0) {
+    return scene_load_binary(desc, path);
+  }
+  return scene_load_text(desc, path);
+}
+
+void scene_instantiate(SceneDesc *desc, AssetCache *cache, enkiTaskScheduler *ts, Scene *out) {
+  std::vector<uint32_t> mesh_ids;
+  std::vector<int32_t> occluder_ids;
+  out->occluders.clear();
+  for (size_t i = 0; i < desc->meshes.size(); i++) {
+    mesh_ids.push_back(cache_mesh(cache, desc->meshes[i]));
+    occluder_ids.push_back(-1);
+    if (!desc->occluders[i].empty()) {
+      occluder_ids[i] = (int32_t) out->occluders.size();
+      out->occluders.push_back(load_occluder(desc->occluders[i]));
+    }
+  }
+  out->materials.clear();
+  for (const SceneMaterialDesc &m : desc->materials) {
+    PBRTextures t;
+    t.albedo_tid = cache_texture(cache, m.albedo);
+    t.normal_tid = cache_texture(cache, m.normal);
+    t.metallic_tid = cache_texture(cache, m.metallic);
+    t.roughness_tid = cache_texture(cache, m.roughness);
+    t.ao_tid = cache_texture(cache, m.ao);
+    out->materials.push_back(t);
+  }
+
+  scene_graph_init(&out->graph, ts);
+  out->instances.clear();
+  out->instance_bounds.clear();
+  out->instance_nodes.clear();
+  out->node_instance.clear();
+  for (const SceneNodeDesc &n : desc->nodes) {
+    uint32_t node = scene_add_node(&out->graph, n.parent, n.local);
+    out->node_instance.push_back(n.mesh >= 0 ? (int32_t) out->instances.size() : -1);
+    if (n.mesh >= 0) {
+      out->instances.push_back({ node, mesh_ids[n.mesh], (uint32_t) n.material, occluder_ids[n.mesh], (n.flags & SCENE_NODE_DYNAMIC) != 0 });
+      out->instance_bounds.push_back(cache->meshes[mesh_ids[n.mesh]].bounds);
+      out->instance_nodes.push_back(node);
+    }
+  }
+
+  out->lights = desc->lights;
+  out->sun = desc->sun;
+  out->env_hdr = desc->env_hdr;
+}
+
+void scene_destroy(Scene *scene) {
+  scene_graph_destroy(&scene->graph);
+}
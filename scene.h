@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <rw_math.h>
+#include "assets.h"
+#include "scene_graph.h"
+
+// Matches the size of the u_light_pos/u_light_color arrays in the forward shaders,
+// the deferred path draws any number of lights
+#define MAX_SCENE_LIGHTS 4
+// Lights without a range reach out to where their falloff drops below this
+#define SCENE_LIGHT_MIN_INTENSITY 0.05f
+
+// What a scene file describes, before any asset is loaded. Paths are relative to the working directory.
+struct SceneMaterialDesc {
+  std::string albedo;
+  std::string normal;
+  std::string metallic;
+  std::string roughness;
+  std::string ao;
+};
+
+// Point light, or a spot light down dir if cos_outer > -1. Nothing is lit past range.
+struct SceneLightDesc {
+  Vec3 pos;
+  Vec3 color;
+  float range;
+  Vec3 dir;
+  // Cosines of the spot's half angles, full intensity inside inner, none outside outer
+  float cos_inner;
+  float cos_outer;
+  // Gets a cube shadow map, see Shadows
+  uint32_t casts_shadow;
+};
+
+// Directional light, dir is the way the light travels
+struct SceneSunDesc {
+  Vec3 dir;
+  Vec3 color;
+  uint32_t enabled;
+};
+
+// Moves every frame, drawn into the shadow maps each frame instead of the cached layer
+#define SCENE_NODE_DYNAMIC 1
+
+// Groups have no mesh or material (-1)
+struct SceneNodeDesc {
+  int32_t parent;
+  int32_t mesh;
+  int32_t material;
+  Mat4 local;
+  uint32_t flags;
+};
+
+struct SceneDesc {
+  std::string env_hdr;
+  std::vector<std::string> meshes;
+  // Low poly occluder per mesh for the software occlusion culling, empty for none
+  std::vector<std::string> occluders;
+  std::vector<SceneMaterialDesc> materials;
+  std::vector<SceneLightDesc> lights;
+  SceneSunDesc sun;
+  std::vector<SceneNodeDesc> nodes;
+};
+
+bool scene_load_text(SceneDesc *desc, const char *path);
+bool scene_load_binary(SceneDesc *desc, const char *path);
+bool scene_save_binary(SceneDesc *desc, const char *path);
+// Picks the loader from the extension, .sceneb is the compiled form
+bool scene_load(SceneDesc *desc, const char *path);
+
+struct SceneInstance {
+  uint32_t node;
+  uint32_t mesh;
+  uint32_t material;
+  // Index into Scene::occluders, -1 if the instance doesn't occlude anything
+  int32_t occluder;
+  bool is_dynamic;
+};
+
+// A loaded scene. Meshes are indices into the AssetCache, materials into materials.
+struct Scene {
+  SceneGraph graph;
+  std::vector<SceneInstance> instances;
+  // Object space bounds and node of every instance, split out of instances for aabb_transform_indexed
+  std::vector<Bounds> instance_bounds;
+  std::vector<uint32_t> instance_nodes;
+  // Instance of every graph node, -1 for groups
+  std::vector<int32_t> node_instance;
+  std::vector<PBRTextures> materials;
+  std::vector<OccluderMesh> occluders;
+  std::vector<SceneLightDesc> lights;
+  SceneSunDesc sun;
+  std::string env_hdr;
+};
+
+void scene_instantiate(SceneDesc *desc, AssetCache *cache, enkiTaskScheduler *ts, Scene *out);
+void scene_destroy(Scene *scene);
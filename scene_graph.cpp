@@ -0,0 +1,148 @@
+#include "scene_graph.h"
+#include <string.h>
+#include <rw_math.h>
+#include <rw_transform.h>
+#include <TaskScheduler_c.h>
+#include "simd_math.h"
+
+struct LevelArgs {
+  SceneGraph *sg;
+  uint32_t first;
+};
+
+// Every node in a level only reads its parent, which is in the previous level, so
+// the nodes of one level can be split across workers freely. Clean nodes are
+// skipped, the dirty ones go through in batches.
+static void update_level_task(uint32_t start, uint32_t end, uint32_t threadnum, void *args) {
+  LevelArgs *level = (LevelArgs *) args;
+  SceneGraph *sg = level->sg;
+  const uint32_t *nodes = sg->level_nodes.data() + level->first;
+  uint32_t batch[SCENE_UPDATE_BATCH];
+  uint32_t count = 0;
+  for (uint32_t i = start; i < end; i++) {
+    if (sg->dirty[nodes[i]]) {
+      batch[count++] = nodes[i];
+      if (count == SCENE_UPDATE_BATCH) {
+        mat4_mult_indexed(sg->world.data(), sg->parent.data(), sg->local.data(), sg->world.data(), batch, count);
+        count = 0;
+      }
+    }
+  }
+  mat4_mult_indexed(sg->world.data(), sg->parent.data(), sg->local.data(), sg->world.data(), batch, count);
+}
+
+static void rebuild_levels(SceneGraph *sg) {
+  uint32_t num_nodes = (uint32_t) sg->parent.size();
+  uint32_t num_levels = 0;
+  for (uint32_t i = 0; i < num_nodes; i++) {
+    if (sg->depth[i] + 1u > num_levels) {
+      num_levels = sg->depth[i] + 1;
+    }
+  }
+  // Counting sort by depth
+  sg->level_start.assign(num_levels + 1, 0);
+  for (uint32_t i = 0; i < num_nodes; i++) {
+    sg->level_start[sg->depth[i] + 1]++;
+  }
+  for (uint32_t l = 0; l < num_levels; l++) {
+    sg->level_start[l+1] += sg->level_start[l];
+  }
+  std::vector<uint32_t> cursor(sg->level_start.begin(), sg->level_start.end() - 1);
+  sg->level_nodes.resize(num_nodes);
+  for (uint32_t i = 0; i < num_nodes; i++) {
+    sg->level_nodes[cursor[sg->depth[i]]++] = i;
+  }
+  sg->levels_dirty = false;
+}
+
+void scene_graph_init(SceneGraph *sg, enkiTaskScheduler *ts) {
+  sg->first_dirty = UINT32_MAX;
+  sg->levels_dirty = true;
+  sg->ts = ts;
+  sg->task = enkiCreateTaskSet(ts, update_level_task);
+}
+
+void scene_graph_destroy(SceneGraph *sg) {
+  enkiDeleteTaskSet(sg->task);
+}
+
+uint32_t scene_add_node(SceneGraph *sg, int32_t parent, Mat4 local) {
+  uint32_t node = (uint32_t) sg->parent.size();
+  sg->parent.push_back(parent);
+  sg->depth.push_back(parent == SCENE_NO_PARENT ? 0 : sg->depth[parent] + 1);
+  sg->local.push_back(local);
+  sg->world.push_back(local);
+  sg->dirty.push_back(1);
+  if (node < sg->first_dirty) {
+    sg->first_dirty = node;
+  }
+  sg->levels_dirty = true;
+  return node;
+}
+
+void scene_set_local(SceneGraph *sg, uint32_t node, Mat4 local) {
+  sg->local[node] = local;
+  sg->dirty[node] = 1;
+  if (node < sg->first_dirty) {
+    sg->first_dirty = node;
+  }
+}
+
+uint32_t scene_update(SceneGraph *sg) {
+  sg->changed_nodes.clear();
+  if (sg->first_dirty == UINT32_MAX) {
+    return 0;
+  }
+  uint32_t num_nodes = (uint32_t) sg->parent.size();
+
+  // Pushes dirty flags down to the children, which only needs the bytes. Roots
+  // are copied here, the rest are multiplied below.
+  sg->update_nodes.clear();
+  for (uint32_t i = sg->first_dirty; i < num_nodes; i++) {
+    int32_t p = sg->parent[i];
+    if (p == SCENE_NO_PARENT) {
+      if (sg->dirty[i]) {
+        sg->world[i] = sg->local[i];
+        sg->changed_nodes.push_back(i);
+      }
+    } else if (sg->dirty[i] || sg->dirty[p]) {
+      sg->dirty[i] = 1;
+      sg->update_nodes.push_back(i);
+      sg->changed_nodes.push_back(i);
+    }
+  }
+  uint32_t count = (uint32_t) sg->update_nodes.size();
+
+  if (count < SCENE_PARALLEL_THRESHOLD) {
+    // Node order has every parent done before its children
+    mat4_mult_indexed(sg->world.data(), sg->parent.data(), sg->local.data(), sg->world.data(), sg->update_nodes.data(), count);
+  } else {
+    if (sg->levels_dirty) {
+      rebuild_levels(sg);
+    }
+    LevelArgs args;
+    args.sg = sg;
+    // Level 0 is only roots
+    uint32_t num_levels = (uint32_t) sg->level_start.size() - 1;
+    for (uint32_t l = 1; l < num_levels; l++) {
+      args.first = sg->level_start[l];
+      uint32_t level_count = sg->level_start[l+1] - args.first;
+      if (level_count < SCENE_PARALLEL_THRESHOLD) {
+        update_level_task(0, level_count, 0, &args);
+      } else {
+        enkiAddTaskSetToPipe(sg->ts, sg->task, &args, level_count);
+        enkiWaitForTaskSet(sg->ts, sg->task);
+      }
+    }
+  }
+
+  memset(sg->dirty.data() + sg->first_dirty, 0, num_nodes - sg->first_dirty);
+  sg->first_dirty = UINT32_MAX;
+  return (uint32_t) sg->changed_nodes.size();
+}
+
+Mat4 scene_trs(Vec3 pos, Vec3 scale, Quaternion rot) {
+  Transform ts = rwtr_trs(pos, scale, RWTR_NO_AXIS, 0.0f);
+  Transform r = rwtr_init_rotate_q(rot);
+  return rwtr_compose(&ts, &r).t;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <rw_math.h>
+#include <TaskScheduler_c.h>
+
+#define SCENE_NO_PARENT -1
+// Below this many nodes the update isn't worth spreading over the workers
+#define SCENE_PARALLEL_THRESHOLD 4096
+// Dirty nodes a worker gathers before multiplying them
+#define SCENE_UPDATE_BATCH 64
+
+// Transform hierarchy stored as parallel arrays indexed by node. Parents are always
+// added before their children, so a single forward pass sees every parent's world
+// matrix before its children need it.
+struct SceneGraph {
+  std::vector<int32_t> parent;
+  std::vector<uint16_t> depth;
+  std::vector<Mat4> local;
+  std::vector<Mat4> world;
+  std::vector<uint8_t> dirty;
+  // Lowest dirty node, nothing before it needs to be looked at. UINT32_MAX when clean.
+  uint32_t first_dirty;
+  // Nodes bucketed by depth for the parallel update, rebuilt when nodes are added
+  std::vector<uint32_t> level_nodes;
+  std::vector<uint32_t> level_start;
+  bool levels_dirty;
+  // Dirty nodes that have a parent, in node order, gathered before the matrices are multiplied
+  std::vector<uint32_t> update_nodes;
+  // Every node the last scene_update recomputed, roots included, in node order
+  std::vector<uint32_t> changed_nodes;
+  enkiTaskScheduler *ts;
+  enkiTaskSet *task;
+};
+
+void scene_graph_init(SceneGraph *sg, enkiTaskScheduler *ts);
+void scene_graph_destroy(SceneGraph *sg);
+uint32_t scene_add_node(SceneGraph *sg, int32_t parent, Mat4 local);
+void scene_set_local(SceneGraph *sg, uint32_t node, Mat4 local);
+// Recomputes world matrices of dirty subtrees. Returns the number of matrices recomputed,
+// which is zero for a static scene, and lists them in changed_nodes.
+uint32_t scene_update(SceneGraph *sg);
+
+Mat4 scene_trs(Vec3 pos, Vec3 scale, Quaternion rot);
@@ -5,6 +5,7 @@
 #include <sstream>
 #include <string>
 #include <glad/glad.h>
+#include "gl_state.h"
 
 // NOTE(ray): Don't worry about error handling right now
 Shader::Shader(const char *vs_path, const char *fs_path) {
@@ -61,14 +62,49 @@ Shader::Shader(const char *vs_path, const char *fs_path) {
   fs_file.close();
 }
 
+Shader::Shader(const char *cs_path) {
+  std::ifstream cs_file(cs_path);
+  std::stringstream buf;
+  buf << cs_file.rdbuf();
+  std::string cs_src_tmp = buf.str();
+  const char *c_src = cs_src_tmp.c_str();
+
+  int success;
+  char info_log[1024];
+
+  uint32_t cs = glCreateShader(GL_COMPUTE_SHADER);
+  glShaderSource(cs, 1, &c_src, NULL);
+  glCompileShader(cs);
+  glGetShaderiv(cs, GL_COMPILE_STATUS, &success);
+  if (!success) {
+    glGetShaderInfoLog(cs, 1024, NULL, info_log);
+    printf("Error: Compute shader compilation failed (%s)\n%s\n", cs_path, info_log);
+  }
+
+  id = glCreateProgram();
+  glAttachShader(id, cs);
+  glLinkProgram(id);
+  glGetProgramiv(id, GL_LINK_STATUS, &success);
+  if (!success) {
+    glGetProgramInfoLog(id, 1024, NULL, info_log);
+    printf("Error: Shader failed linking\n%s\n", info_log);
+  }
+
+  glDeleteShader(cs);
+  cs_file.close();
+}
+
 void Shader::use() {
-  glUseProgram(id);
+  gl_use_program(id);
 }
 
 int Shader::get_unif_loc(const char *unif_name) {
-  int location;
-  // TODO(ray): Cache
-  location = glGetUniformLocation(id, unif_name);
+  auto it = unif_locs.find(unif_name);
+  if (it != unif_locs.end()) {
+    return it->second;
+  }
+  int location = glGetUniformLocation(id, unif_name);
+  unif_locs[unif_name] = location;
   return location;
 }
 
@@ -87,6 +123,11 @@ void Shader::set_unif_1u(const char *unif_name, unsigned int u) {
   glUniform1ui(location, u);
 }
 
+void Shader::set_unif_2f(const char *unif_name, float x, float y) {
+  int location = this->get_unif_loc(unif_name);
+  glUniform2f(location, x, y);
+}
+
 void Shader::set_unif_3fv(const char *unif_name, Vec3 *v) {
   int location = this->get_unif_loc(unif_name);
   glUniform3fv(location, 1, (float *) v);
@@ -1,14 +1,21 @@
 #pragma once
+#include <string>
+#include <unordered_map>
 #include <rw_math.h>
 
 struct Shader {
   int id;
+  // glGetUniformLocation is a string lookup in the driver, only ask once per name
+  std::unordered_map<std::string, int> unif_locs;
   Shader(const char *vs_path, const char *fs_path);
+  // Compute only program
+  Shader(const char *cs_path);
   void use();
   int get_unif_loc(const char *unif_name);
   void set_unif_1f(const char *unif_name, float f);
   void set_unif_1i(const char *unif_name, int f);
   void set_unif_1u(const char *unif_name, unsigned int f);
+  void set_unif_2f(const char *unif_name, float x, float y);
   void set_unif_3fv(const char *unif_name, Vec3 *v);
   void set_unif_4fv(const char *unif_name, Vec4 *v);
   void set_unif_mat4(const char *unif_name, Mat4 *m);
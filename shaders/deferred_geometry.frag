@@ -1,8 +1,11 @@
-#version 410
+#version 430
 
 in vec3 WorldPos;
 in vec2 TexCoords;
 in vec3 Normal;
+// xyz world space tangent, w the bitangent sign
+in vec4 Tangent;
+flat in uint Material;
 
 layout (location = 0) out vec3 g_position;
 layout (location = 1) out vec3 g_normal;
@@ -11,33 +14,52 @@ layout (location = 3) out vec3 g_metallic;
 layout (location = 4) out vec3 g_roughness;
 layout (location = 5) out vec3 g_ao;
 
-uniform sampler2D u_albedo_map;
-uniform sampler2D u_normal_map;
-uniform sampler2D u_metallic_map;
-uniform sampler2D u_roughness_map;
-uniform sampler2D u_ao_map;
+// Same order as MaterialMap
+const uint MAP_ALBEDO = 0u;
+const uint MAP_NORMAL = 1u;
+const uint MAP_METALLIC = 2u;
+const uint MAP_ROUGHNESS = 3u;
+const uint MAP_AO = 4u;
+const uint NUM_MAPS = 5u;
 
-vec3 convert_normal_from_map() {
-  vec3 tangentNormal = texture(u_normal_map, TexCoords).xyz * 2.0 - 1.0;
+// Textures bucketed by size and format, see MaterialTable
+uniform sampler2DArray u_material_arrays[8];
+// (array << 16) | layer for every map of every material
+layout (std430, binding = 5) readonly buffer MaterialLayers { uint material_layers[]; };
 
-  vec3 Q1  = dFdx(WorldPos);
-  vec3 Q2  = dFdy(WorldPos);
-  vec2 st1 = dFdx(TexCoords);
-  vec2 st2 = dFdy(TexCoords);
+vec4 sample_map(uint map, vec2 dx, vec2 dy) {
+  uint slot = material_layers[Material * NUM_MAPS + map];
+  vec3 p = vec3(TexCoords, float(slot & 0xffffu));
+  // Sampler arrays only take constant indices in every GL we run on, and the
+  // gradients have to come from outside the branch
+  switch (slot >> 16) {
+    case 0u: return textureGrad(u_material_arrays[0], p, dx, dy);
+    case 1u: return textureGrad(u_material_arrays[1], p, dx, dy);
+    case 2u: return textureGrad(u_material_arrays[2], p, dx, dy);
+    case 3u: return textureGrad(u_material_arrays[3], p, dx, dy);
+    case 4u: return textureGrad(u_material_arrays[4], p, dx, dy);
+    case 5u: return textureGrad(u_material_arrays[5], p, dx, dy);
+    case 6u: return textureGrad(u_material_arrays[6], p, dx, dy);
+    default: return textureGrad(u_material_arrays[7], p, dx, dy);
+  }
+}
 
-  vec3 N = normalize(Normal);
-  vec3 T = normalize(Q1*st2.t - Q2*st1.t);
-  vec3 B = -normalize(cross(N, T));
-  mat3 TBN = mat3(T, B, N);
+vec3 convert_normal_from_map(vec2 st1, vec2 st2) {
+  vec3 tangentNormal = sample_map(MAP_NORMAL, st1, st2).xyz * 2.0 - 1.0;
 
-  return normalize(TBN * tangentNormal);
+  // The interpolated frame as is, the way MikkTSpace tangents are meant to be used.
+  // The normal maps' green channel points down v, hence the flipped bitangent.
+  vec3 B = -Tangent.w * cross(Normal, Tangent.xyz);
+  return normalize(tangentNormal.x * Tangent.xyz + tangentNormal.y * B + tangentNormal.z * Normal);
 }
 
 void main() {
+  vec2 dx = dFdx(TexCoords);
+  vec2 dy = dFdy(TexCoords);
   g_position = WorldPos;
-  g_normal = convert_normal_from_map();
-  g_albedo = texture(u_albedo_map, TexCoords).rgb;
-  g_metallic = vec3(texture(u_metallic_map, TexCoords).r);
-  g_roughness = vec3(texture(u_roughness_map, TexCoords).r);
-  g_ao = vec3(texture(u_ao_map, TexCoords).r);
-}
\ No newline at end of file
+  g_normal = convert_normal_from_map(dx, dy);
+  g_albedo = sample_map(MAP_ALBEDO, dx, dy).rgb;
+  g_metallic = vec3(sample_map(MAP_METALLIC, dx, dy).r);
+  g_roughness = vec3(sample_map(MAP_ROUGHNESS, dx, dy).r);
+  g_ao = vec3(sample_map(MAP_AO, dx, dy).r);
+}
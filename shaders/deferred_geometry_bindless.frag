@@ -0,0 +1,50 @@
+#version 430
+#extension GL_ARB_bindless_texture : require
+
+in vec3 WorldPos;
+in vec2 TexCoords;
+in vec3 Normal;
+// xyz world space tangent, w the bitangent sign
+in vec4 Tangent;
+flat in uint Material;
+
+layout (location = 0) out vec3 g_position;
+layout (location = 1) out vec3 g_normal;
+layout (location = 2) out vec3 g_albedo;
+layout (location = 3) out vec3 g_metallic;
+layout (location = 4) out vec3 g_roughness;
+layout (location = 5) out vec3 g_ao;
+
+// Same order as MaterialMap
+const uint MAP_ALBEDO = 0u;
+const uint MAP_NORMAL = 1u;
+const uint MAP_METALLIC = 2u;
+const uint MAP_ROUGHNESS = 3u;
+const uint MAP_AO = 4u;
+const uint NUM_MAPS = 5u;
+
+// Resident texture handle for every map of every material
+layout (std430, binding = 5) readonly buffer MaterialHandles { uvec2 material_handles[]; };
+
+vec4 sample_map(uint map) {
+  // NOTE(ray): Material is the same across a draw, which is all the drivers we run on need
+  return texture(sampler2D(material_handles[Material * NUM_MAPS + map]), TexCoords);
+}
+
+vec3 convert_normal_from_map() {
+  vec3 tangentNormal = sample_map(MAP_NORMAL).xyz * 2.0 - 1.0;
+
+  // The interpolated frame as is, the way MikkTSpace tangents are meant to be used.
+  // The normal maps' green channel points down v, hence the flipped bitangent.
+  vec3 B = -Tangent.w * cross(Normal, Tangent.xyz);
+  return normalize(tangentNormal.x * Tangent.xyz + tangentNormal.y * B + tangentNormal.z * Normal);
+}
+
+void main() {
+  g_position = WorldPos;
+  g_normal = convert_normal_from_map();
+  g_albedo = sample_map(MAP_ALBEDO).rgb;
+  g_metallic = vec3(sample_map(MAP_METALLIC).r);
+  g_roughness = vec3(sample_map(MAP_ROUGHNESS).r);
+  g_ao = vec3(sample_map(MAP_AO).r);
+}
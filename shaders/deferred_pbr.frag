@@ -1,4 +1,4 @@
-#version 410
+#version 430
 
 in vec2 TexCoords;
 
@@ -15,11 +15,25 @@ uniform sampler2D g_ao;
 uniform samplerCube u_irradiance_map;
 uniform samplerCube u_prefilter_map;
 uniform sampler2D u_brdf_lut;
-
-uniform vec3 u_light_pos[4];
-uniform vec3 u_light_color[4];
-
-uniform vec3 u_cam_pos;
+uniform sampler2D u_light_accum;
+
+// Sun, black when the scene has none. u_sun_dir is the way the light travels.
+uniform vec3 u_sun_dir;
+uniform vec3 u_sun_color = vec3(0.0);
+uniform sampler2DArrayShadow u_sun_shadow;
+uniform mat4 u_cascade_view_proj[4];
+// View distance each cascade ends at
+uniform vec4 u_cascade_far;
+uniform vec3 u_cam_forward;
+
+// Per-frame data out of the ring buffer, FrameUniforms in main.cpp
+layout (std140, row_major, binding = 0) uniform FrameUniforms {
+  mat4 u_view;
+  mat4 u_projection;
+  vec4 u_cam_pos;
+  // Fraction of the targets rendered to this frame, xy
+  vec4 u_render_scale;
+};
 
 const float PI = 3.14159265359;
 const float MAX_REFLECTION_LOD = 4.0;
@@ -61,45 +75,66 @@ vec3 fresnel_schlick_roughness(float cosTheta, vec3 F0, float roughness) {
   return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(1.0 - cosTheta, 5.0);
 }  
 
+// 1 lit, 0 in shadow. Past the last cascade everything is lit.
+float sun_shadow(vec3 WorldPos, vec3 N) {
+  float view_z = dot(WorldPos - u_cam_pos.xyz, u_cam_forward);
+  int cascade = 0;
+  while (cascade < 4 && view_z > u_cascade_far[cascade]) {
+    cascade++;
+  }
+  if (cascade == 4) {
+    return 1.0;
+  }
+  // Pushed off the surface by about a texel of the cascade, against acne on slopes.
+  // The view is a rotation, so the first row is as long as the ortho x scale.
+  mat4 m = u_cascade_view_proj[cascade];
+  float scale = length(vec3(m[0][0], m[1][0], m[2][0]));
+  float texel = 2.0 / (scale * float(textureSize(u_sun_shadow, 0).x));
+  vec4 p = m * vec4(WorldPos + N * texel, 1.0);
+  vec3 uvz = p.xyz * 0.5 + 0.5;
+  // 3x3 taps of the hardware 2x2 PCF
+  vec2 step = 1.0 / vec2(textureSize(u_sun_shadow, 0).xy);
+  float lit = 0.0;
+  for (int y = -1; y <= 1; y++) {
+    for (int x = -1; x <= 1; x++) {
+      lit += texture(u_sun_shadow, vec4(uvz.xy + vec2(x, y) * step, cascade, min(uvz.z, 1.0)));
+    }
+  }
+  return lit / 9.0;
+}
+
 void main() {
-  vec3 WorldPos = texture(g_pos, TexCoords).rgb;
+  // The G-buffer only covers the bottom-left u_render_scale of its textures
+  vec2 uv = TexCoords * u_render_scale.xy;
+  vec3 WorldPos = texture(g_pos, uv).rgb;
 
-  vec3 albedo = pow(texture(g_albedo, TexCoords).rgb, vec3(2.2));
-  float metallic = texture(g_metallic, TexCoords).r;
-  float roughness = texture(g_roughness, TexCoords).r;
-  float ao = texture(g_ao, TexCoords).r;
+  vec3 albedo = pow(texture(g_albedo, uv).rgb, vec3(2.2));
+  float metallic = texture(g_metallic, uv).r;
+  float roughness = texture(g_roughness, uv).r;
+  float ao = texture(g_ao, uv).r;
 
-  vec3 N = texture(g_normal, TexCoords).rgb;
-  vec3 V = normalize(u_cam_pos - WorldPos);
+  vec3 N = texture(g_normal, uv).rgb;
+  vec3 V = normalize(u_cam_pos.xyz - WorldPos);
   vec3 R = reflect(-V, N);
 
   vec3 F0 = vec3(0.04);
   F0 = mix(F0, albedo, metallic);
 
-  vec3 Lo = vec3(0.0);
-  for (int i = 0; i < 4; ++i) {
-    vec3 L = normalize(u_light_pos[i] - WorldPos);
-    vec3 H = normalize(V + L);
-    float distance = length(u_light_pos[i] - WorldPos);
-    float attenuation = 1.0 / (distance * distance);
-    vec3 radiance = u_light_color[i] * attenuation;
+  // Local lights, summed up by the light volumes
+  vec3 Lo = texture(u_light_accum, uv).rgb;
 
-    // Cook-Torrance BRDF
+  if (u_sun_color != vec3(0.0)) {
+    vec3 L = -u_sun_dir;
+    vec3 H = normalize(V + L);
     float NDF = distribution_ggx(N, H, roughness);
     float G = geometry_smith(N, V, L, roughness);
-    vec3 F = fresnel_schlick(max(dot(H, V), 0.0), F0); 
-
-    vec3 numerinator = NDF * G * F;
-    float denom = 4 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0);
-    vec3 specular = numerinator / max(denom, 0.001);
-
-    vec3 kS = F;
-    vec3 kD = vec3(1.0) - kS;
-    kD *= 1.0 - metallic;
-
+    vec3 F = fresnel_schlick(max(dot(H, V), 0.0), F0);
+    vec3 specular = NDF * G * F / max(4 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0), 0.001);
+    vec3 kD = (vec3(1.0) - F) * (1.0 - metallic);
     float NdL = max(dot(N, L), 0.0);
-
-    Lo += (kD * albedo / PI + specular) * radiance * NdL; 
+    if (NdL > 0.0) {
+      Lo += (kD * albedo / PI + specular) * u_sun_color * NdL * sun_shadow(WorldPos, N);
+    }
   }
 
   vec3 F = fresnel_schlick_roughness(max(dot(N, V), 0.0), F0, roughness); 
@@ -0,0 +1,55 @@
+#version 430
+
+layout (location = 0) in vec3 i_pos;
+layout (location = 1) in vec2 i_tex_coord;
+layout (location = 2) in vec3 i_normal;
+// Instanced, every indirect command's baseInstance is its draw index
+layout (location = 3) in uint i_draw_id;
+// Octahedral tangent in xy, bitangent sign in w
+layout (location = 4) in vec4 i_tangent;
+
+out vec3 WorldPos;
+out vec2 TexCoords;
+out vec3 Normal;
+out vec4 Tangent;
+flat out uint Material;
+
+struct DrawData {
+  mat4 model;
+  // Inverse transpose of the model's 3x3
+  mat3 normal;
+  uint material;
+};
+
+// Row-major like FrameUniforms, the CPU writes its matrices as they are
+layout (std430, row_major, binding = 4) readonly buffer Draws { DrawData draws[]; };
+
+// Per-frame data out of the ring buffer, FrameUniforms in main.cpp
+layout (std140, row_major, binding = 0) uniform FrameUniforms {
+  mat4 u_view;
+  mat4 u_projection;
+  vec4 u_cam_pos;
+  // Fraction of the targets rendered to this frame, xy
+  vec4 u_render_scale;
+};
+
+// Octahedral direction, packed on the CPU by pack_tangent
+vec3 oct_decode(vec2 e) {
+  vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  if (v.z < 0.0) {
+    v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+  }
+  return normalize(v);
+}
+
+void main() {
+  mat4 model = draws[i_draw_id].model;
+  vec4 world_pos = model * vec4(i_pos, 1.0);
+  WorldPos = world_pos.xyz;
+  Normal = normalize(draws[i_draw_id].normal * i_normal);
+  Tangent = vec4(normalize(mat3(model) * oct_decode(i_tangent.xy)), i_tangent.w);
+  TexCoords = i_tex_coord;
+  Material = draws[i_draw_id].material;
+
+  gl_Position = u_projection * u_view * world_pos;
+}
@@ -0,0 +1,5 @@
+#version 430
+
+// Color writes are off, the volume only marks the stencil
+void main() {
+}
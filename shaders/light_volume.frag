@@ -0,0 +1,134 @@
+#version 430
+
+out vec4 frag_color;
+
+// G-buffer textures, fetched at the pixel the volume covers
+uniform sampler2D g_pos;
+uniform sampler2D g_normal;
+uniform sampler2D g_albedo;
+uniform sampler2D g_metallic;
+uniform sampler2D g_roughness;
+
+// Per-frame data out of the ring buffer, FrameUniforms in main.cpp
+layout (std140, row_major, binding = 0) uniform FrameUniforms {
+  mat4 u_view;
+  mat4 u_projection;
+  vec4 u_cam_pos;
+  // Fraction of the targets rendered to this frame, xy
+  vec4 u_render_scale;
+};
+
+uniform vec3 u_light_pos;
+uniform vec3 u_light_color;
+uniform float u_light_range;
+// Spot lights only, u_spot_cos is the cosine of the inner and outer half angle
+uniform vec3 u_light_dir;
+uniform vec2 u_spot_cos = vec2(-1.0);
+// Layer of the light's cube in u_point_shadows, -1 for no shadow
+uniform int u_shadow_cube = -1;
+uniform samplerCubeArrayShadow u_point_shadows;
+// Near plane of the cube faces, the far plane is the range
+uniform float u_shadow_near;
+
+const float PI = 3.14159265359;
+
+float distribution_ggx(vec3 N, vec3 H, float roughness) {
+  float a = roughness*roughness;
+  float a2 = a*a;
+  float NdH = max(dot(N, H), 0.0);
+  float NdH2 = NdH*NdH;
+
+  float numer = a2;
+  float denom = (NdH2 * (a2 - 1.0) + 1.0);
+  denom = PI * denom * denom;
+
+  return numer / denom;
+}
+
+float geometry_schlick_ggx(float NdV, float roughness) {
+  float r = (roughness + 1.0);
+  float k = (r*r) / 8.0;
+  float numer = NdV;
+  float denom = NdV * (1.0 - k) + k;
+  return numer / denom;
+}
+
+float geometry_smith(vec3 N, vec3 V, vec3 L, float roughness) {
+  float NdV = max(dot(N, V), 0.0);
+  float NdL = max(dot(N, L), 0.0);
+  float ggx2 = geometry_schlick_ggx(NdV, roughness);
+  float ggx1 = geometry_schlick_ggx(NdL, roughness);
+  return ggx1 * ggx2;
+}
+
+vec3 fresnel_schlick(float cosTheta, vec3 F0) {
+  return F0 + (1.0 - F0) * pow(1.0 - cosTheta, 5.0);
+}
+
+// Inverse square, windowed so it reaches exactly 0 at the range (Karis, UE4).
+// The +1 keeps it finite right at the light.
+float attenuation(float distance) {
+  float d_r = distance / u_light_range;
+  float window = clamp(1.0 - d_r*d_r*d_r*d_r, 0.0, 1.0);
+  return window * window / (distance * distance + 1.0);
+}
+
+// 1 lit, 0 in shadow
+float point_shadow(vec3 WorldPos, vec3 N, float distance) {
+  // Normal offset grows with the distance, like the cube's texels do
+  vec3 d = WorldPos + N * (0.02 * distance) - u_light_pos;
+  // The face's depth is the distance along its axis, the largest component
+  float z = max(abs(d.x), max(abs(d.y), abs(d.z)));
+  float n = u_shadow_near;
+  float f = u_light_range;
+  float depth = 0.5 * ((f + n) / (f - n) - 2.0 * f * n / ((f - n) * z)) + 0.5;
+  return texture(u_point_shadows, vec4(d, float(u_shadow_cube)), min(depth, 1.0));
+}
+
+void main() {
+  ivec2 texel = ivec2(gl_FragCoord.xy);
+  vec3 WorldPos = texelFetch(g_pos, texel, 0).rgb;
+  vec3 to_light = u_light_pos - WorldPos;
+  float distance = length(to_light);
+  vec3 L = to_light / distance;
+  float falloff = attenuation(distance);
+  if (u_spot_cos.y > -1.0) {
+    falloff *= smoothstep(u_spot_cos.y, u_spot_cos.x, dot(-L, u_light_dir));
+  }
+  // No discard, the fragment still has to clear its stencil
+  if (falloff <= 0.0) {
+    frag_color = vec4(0.0);
+    return;
+  }
+
+  vec3 albedo = pow(texelFetch(g_albedo, texel, 0).rgb, vec3(2.2));
+  float metallic = texelFetch(g_metallic, texel, 0).r;
+  float roughness = texelFetch(g_roughness, texel, 0).r;
+  vec3 N = texelFetch(g_normal, texel, 0).rgb;
+  vec3 V = normalize(u_cam_pos.xyz - WorldPos);
+  vec3 H = normalize(V + L);
+
+  vec3 F0 = mix(vec3(0.04), albedo, metallic);
+  vec3 radiance = u_light_color * falloff;
+
+  // Cook-Torrance BRDF
+  float NDF = distribution_ggx(N, H, roughness);
+  float G = geometry_smith(N, V, L, roughness);
+  vec3 F = fresnel_schlick(max(dot(H, V), 0.0), F0);
+
+  vec3 numerinator = NDF * G * F;
+  float denom = 4 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0);
+  vec3 specular = numerinator / max(denom, 0.001);
+
+  vec3 kS = F;
+  vec3 kD = vec3(1.0) - kS;
+  kD *= 1.0 - metallic;
+
+  float NdL = max(dot(N, L), 0.0);
+  if (u_shadow_cube >= 0 && NdL > 0.0) {
+    radiance *= point_shadow(WorldPos, N, distance);
+  }
+
+  // Added onto the other lights, still linear HDR
+  frag_color = vec4((kD * albedo / PI + specular) * radiance * NdL, 1.0);
+}
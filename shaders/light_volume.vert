@@ -0,0 +1,19 @@
+#version 430
+
+layout (location = 0) in vec3 i_pos;
+
+// Per-frame data out of the ring buffer, FrameUniforms in main.cpp
+layout (std140, row_major, binding = 0) uniform FrameUniforms {
+  mat4 u_view;
+  mat4 u_projection;
+  vec4 u_cam_pos;
+  // Fraction of the targets rendered to this frame, xy
+  vec4 u_render_scale;
+};
+
+// Places the unit sphere or cone around the light
+uniform mat4 u_model;
+
+void main() {
+  gl_Position = u_projection * u_view * u_model * vec4(i_pos, 1.0);
+}
@@ -3,19 +3,32 @@
 layout (location = 0) in vec3 i_pos;
 layout (location = 1) in vec2 i_tex_coord;
 layout (location = 2) in vec3 i_normal;
+// Octahedral tangent in xy, bitangent sign in w
+layout (location = 4) in vec4 i_tangent;
 
 out vec3 WorldPos;
 out vec2 TexCoords;
 out vec3 Normal;
+out vec4 Tangent;
 
 uniform mat4 u_model = mat4(1.0);
 uniform mat4 u_view = mat4(1.0);
 uniform mat4 u_projection;
 
+// Octahedral direction, packed on the CPU by pack_tangent
+vec3 oct_decode(vec2 e) {
+  vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  if (v.z < 0.0) {
+    v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+  }
+  return normalize(v);
+}
+
 void main() {
   vec4 world_pos = u_model * vec4(i_pos, 1.0);
   WorldPos = world_pos.xyz;
-  Normal = (mat4(transpose(inverse(u_model))) * vec4(i_normal, 0.0)).xyz;
+  Normal = normalize((mat4(transpose(inverse(u_model))) * vec4(i_normal, 0.0)).xyz);
+  Tangent = vec4(normalize(mat3(u_model) * oct_decode(i_tangent.xy)), i_tangent.w);
   TexCoords = i_tex_coord;
 
   gl_Position = u_projection * u_view * world_pos;
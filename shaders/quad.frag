@@ -5,8 +5,28 @@ in vec2 TexCoord;
 out vec4 frag_color;
 
 uniform sampler2D screen_tex;
+// Part of screen_tex that was rendered to, stretched over the screen
+uniform vec2 u_uv_scale = vec2(1.0);
+// 0 is a plain bilinear upscale, 1 the strongest sharpening
+uniform float u_sharpness = 0.0;
 
 void main() {
-  frag_color = texture(screen_tex, TexCoord);
-  // frag_color = vec4(1.0, 0.0, 0.0, 1.0);
-}
\ No newline at end of file
+  vec2 texel = 1.0 / vec2(textureSize(screen_tex, 0));
+  // Keep the bilinear footprint inside the rendered part
+  vec2 uv = min(TexCoord * u_uv_scale, u_uv_scale - 0.5 * texel);
+  vec3 c = texture(screen_tex, uv).rgb;
+  if (u_sharpness > 0.0) {
+    // Contrast adaptive sharpening: a negative lobe on the 4 neighbours, weaker
+    // where the neighbourhood already has a lot of contrast so edges don't ring
+    vec3 n = texture(screen_tex, min(uv + vec2(0.0, texel.y), u_uv_scale - 0.5 * texel)).rgb;
+    vec3 s = texture(screen_tex, max(uv - vec2(0.0, texel.y), 0.5 * texel)).rgb;
+    vec3 e = texture(screen_tex, min(uv + vec2(texel.x, 0.0), u_uv_scale - 0.5 * texel)).rgb;
+    vec3 w = texture(screen_tex, max(uv - vec2(texel.x, 0.0), 0.5 * texel)).rgb;
+    vec3 mn = min(c, min(min(n, s), min(e, w)));
+    vec3 mx = max(c, max(max(n, s), max(e, w)));
+    vec3 amp = sqrt(clamp(min(mn, 1.0 - mx) / max(mx, vec3(1e-4)), 0.0, 1.0));
+    vec3 lobe = -amp * mix(0.125, 0.2, u_sharpness);
+    c = clamp((c + (n + s + e + w) * lobe) / (1.0 + 4.0 * lobe), 0.0, 1.0);
+  }
+  frag_color = vec4(c, 1.0);
+}
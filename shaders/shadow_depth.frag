@@ -0,0 +1,5 @@
+#version 430
+
+// Depth only
+void main() {
+}
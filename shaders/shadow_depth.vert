@@ -0,0 +1,19 @@
+#version 430
+
+layout (location = 0) in vec3 i_pos;
+// Instanced like shaders/gpu_driven.vert, every command's baseInstance is its draw index
+layout (location = 3) in uint i_draw_id;
+
+struct DrawData {
+  mat4 model;
+  mat3 normal;
+  uint material;
+};
+
+layout (std430, row_major, binding = 4) readonly buffer Draws { DrawData draws[]; };
+
+uniform mat4 u_light_view_proj;
+
+void main() {
+  gl_Position = u_light_view_proj * (draws[i_draw_id].model * vec4(i_pos, 1.0));
+}
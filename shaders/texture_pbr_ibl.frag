@@ -3,6 +3,8 @@
 in vec3 WorldPos;
 in vec2 TexCoords;
 in vec3 Normal;
+// xyz world space tangent, w the bitangent sign
+in vec4 Tangent;
 
 out vec4 o_frag_color;
 
@@ -25,17 +27,10 @@ const float PI = 3.14159265359;
 vec3 convert_normal_from_map() {
   vec3 tangentNormal = texture(u_normal_map, TexCoords).xyz * 2.0 - 1.0;
 
-  vec3 Q1  = dFdx(WorldPos);
-  vec3 Q2  = dFdy(WorldPos);
-  vec2 st1 = dFdx(TexCoords);
-  vec2 st2 = dFdy(TexCoords);
-
-  vec3 N = normalize(Normal);
-  vec3 T = normalize(Q1*st2.t - Q2*st1.t);
-  vec3 B = -normalize(cross(N, T));
-  mat3 TBN = mat3(T, B, N);
-
-  return normalize(TBN * tangentNormal);
+  // The interpolated frame as is, the way MikkTSpace tangents are meant to be used.
+  // The normal maps' green channel points down v, hence the flipped bitangent.
+  vec3 B = -Tangent.w * cross(Normal, Tangent.xyz);
+  return normalize(tangentNormal.x * Tangent.xyz + tangentNormal.y * B + tangentNormal.z * Normal);
 }
 
 float distribution_ggx(vec3 N, vec3 H, float roughness) {
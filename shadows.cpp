@@ -0,0 +1,302 @@
+#include "shadows.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <glad/glad.h>
+#include "bench.h"
+#include "gl_state.h"
+#include "simd_math.h"
+
+static uint32_t create_depth_array(uint32_t target, int size, int layers) {
+  uint32_t tid;
+  glCreateTextures(target, 1, &tid);
+  glTextureStorage3D(tid, 1, GL_DEPTH_COMPONENT32F, size, size, layers);
+  // Sampled with hardware compare, linear gives 2x2 PCF for free
+  glTextureParameteri(tid, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTextureParameteri(tid, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTextureParameteri(tid, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTextureParameteri(tid, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTextureParameteri(tid, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+  glTextureParameteri(tid, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  return tid;
+}
+
+void shadows_init(Shadows *sh, Shader *depth_s, Scene *scene, GpuScene *gs, const Vec3 *face_dirs, const Vec3 *face_ups) {
+  *sh = {};
+  sh->depth_s = depth_s;
+  glCreateFramebuffers(1, &sh->fbo);
+  glNamedFramebufferDrawBuffer(sh->fbo, GL_NONE);
+  glNamedFramebufferReadBuffer(sh->fbo, GL_NONE);
+
+  std::vector<DrawCommand> commands;
+  std::vector<DrawCommand> dynamic_commands;
+  for (uint32_t i = 0; i < scene->instances.size(); i++) {
+    SceneInstance &inst = scene->instances[i];
+    DrawCommand &cmd = gs->draw_commands[i];
+    if (inst.is_dynamic) {
+      dynamic_commands.push_back(cmd);
+      sh->dynamic_indices += cmd.count;
+    } else {
+      commands.push_back(cmd);
+      sh->static_indices += cmd.count;
+      sh->static_instances.push_back(i);
+      sh->static_world.push_back(scene->graph.world[inst.node]);
+    }
+  }
+  sh->num_static = (uint32_t) commands.size();
+  sh->num_dynamic = (uint32_t) dynamic_commands.size();
+  commands.insert(commands.end(), dynamic_commands.begin(), dynamic_commands.end());
+  if (!commands.empty()) {
+    glCreateBuffers(1, &sh->command_buffer);
+    glNamedBufferStorage(sh->command_buffer, sizeof(DrawCommand) * commands.size(), commands.data(), 0);
+  }
+  sh->static_moved = true;
+
+  sh->sun = scene->sun;
+  if (sh->sun.enabled) {
+    sh->cascade_static_tid = create_depth_array(GL_TEXTURE_2D_ARRAY, SHADOW_CASCADE_SIZE, SHADOW_NUM_CASCADES);
+    if (sh->num_dynamic > 0) {
+      sh->cascade_tid = create_depth_array(GL_TEXTURE_2D_ARRAY, SHADOW_CASCADE_SIZE, SHADOW_NUM_CASCADES);
+    }
+  }
+
+  sh->light_cube.assign(scene->lights.size(), -1);
+  for (uint32_t i = 0; i < scene->lights.size(); i++) {
+    if (!scene->lights[i].casts_shadow) {
+      continue;
+    }
+    if (sh->num_cubes == SHADOW_MAX_CUBES) {
+      printf("ERROR: Only the first %d shadowed lights get a shadow map\n", SHADOW_MAX_CUBES);
+      break;
+    }
+    sh->cube_light[sh->num_cubes] = i;
+    sh->light_cube[i] = (int32_t) sh->num_cubes;
+    sh->num_cubes++;
+  }
+  if (sh->num_cubes > 0) {
+    sh->cube_static_tid = create_depth_array(GL_TEXTURE_CUBE_MAP_ARRAY, SHADOW_CUBE_SIZE, 6 * sh->num_cubes);
+    if (sh->num_dynamic > 0) {
+      sh->cube_tid = create_depth_array(GL_TEXTURE_CUBE_MAP_ARRAY, SHADOW_CUBE_SIZE, 6 * sh->num_cubes);
+    }
+  }
+  memcpy(sh->face_dirs, face_dirs, sizeof(sh->face_dirs));
+  memcpy(sh->face_ups, face_ups, sizeof(sh->face_ups));
+  sh->cascade_sample_tid = sh->cascade_static_tid;
+  sh->cube_sample_tid = sh->cube_static_tid;
+}
+
+void shadows_destroy(Shadows *sh) {
+  uint32_t tids[4] = { sh->cascade_static_tid, sh->cascade_tid, sh->cube_static_tid, sh->cube_tid };
+  gl_delete_textures(4, tids);
+  gl_delete_framebuffers(1, &sh->fbo);
+  glDeleteBuffers(1, &sh->command_buffer);
+  *sh = {};
+}
+
+void shadows_check_static(Shadows *sh, Scene *scene) {
+  for (size_t i = 0; i < sh->static_instances.size(); i++) {
+    Mat4 &world = scene->graph.world[scene->instances[sh->static_instances[i]].node];
+    if (memcmp(&world, &sh->static_world[i], sizeof(Mat4)) != 0) {
+      sh->static_world[i] = world;
+      sh->static_moved = true;
+    }
+  }
+}
+
+// Rotation into light space, looking down the sun
+static Mat4 sun_rotation(Vec3 dir) {
+  Vec3 eye = rwm_v3_zero();
+  Vec3 up = fabsf(dir.y) > 0.99f ? rwm_v3_init(1.0f, 0.0f, 0.0f) : rwm_v3_init(0.0f, 1.0f, 0.0f);
+  return get_view_mat(&eye, &dir, &up);
+}
+
+static void update_scene_depth(Shadows *sh, GpuScene *gs) {
+  Mat4 rot = sun_rotation(sh->sun.dir);
+  float *row = rot.e[2];
+  sh->scene_min_z = 1e30f;
+  sh->scene_max_z = -1e30f;
+  for (uint32_t inst : sh->static_instances) {
+    Aabb &box = gs->draw_boxes[inst];
+    for (int k = 0; k < 8; k++) {
+      Vec3 p = rwm_v3_init(k & 1 ? box.max.x : box.min.x, k & 2 ? box.max.y : box.min.y, k & 4 ? box.max.z : box.min.z);
+      float z = row[0] * p.x + row[1] * p.y + row[2] * p.z;
+      sh->scene_min_z = fminf(sh->scene_min_z, z);
+      sh->scene_max_z = fmaxf(sh->scene_max_z, z);
+    }
+  }
+  if (sh->scene_min_z > sh->scene_max_z) {
+    sh->scene_min_z = -1.0f;
+    sh->scene_max_z = 1.0f;
+  }
+}
+
+// Each cascade is an ortho box around the bounding sphere of its slice of the view.
+// The sphere doesn't change size as the camera turns, and the box is a bit larger and
+// only moves in steps of a whole number of texels, so the cached layer stays valid until
+// the camera has moved a step and the shadows don't shimmer when it does.
+static void fit_cascades(Shadows *sh, Camera *camera, Mat4 *view_proj) {
+  float near_z = camera->near_z;
+  float far_z = fminf(camera->far_z, SHADOW_DISTANCE);
+  float tan_x = 1.0f / camera->persp_mat.e[0][0];
+  float tan_y = 1.0f / camera->persp_mat.e[1][1];
+  float t2 = tan_x * tan_x + tan_y * tan_y;
+  Vec3 forward = rwm_v3_init(-camera->view_mat.e[2][0], -camera->view_mat.e[2][1], -camera->view_mat.e[2][2]);
+  Mat4 rot = sun_rotation(sh->sun.dir);
+  // Light space looks down -z, a little slack so the end caps don't clip casters
+  float n = -sh->scene_max_z - 1.0f;
+  float f = -sh->scene_min_z + 1.0f;
+
+  float prev = near_z;
+  for (int c = 0; c < SHADOW_NUM_CASCADES; c++) {
+    float p = (float) (c + 1) / SHADOW_NUM_CASCADES;
+    float split = SHADOW_SPLIT_LAMBDA * near_z * powf(far_z / near_z, p) + (1.0f - SHADOW_SPLIT_LAMBDA) * (near_z + (far_z - near_z) * p);
+    // Centre equidistant from the slice's near and far corners, or at the far end for wide slices
+    float z = fminf(0.5f * (prev + split) * (1.0f + t2), split);
+    float r = sqrtf((split - z) * (split - z) + split * split * t2);
+    Vec3 centre = camera->render_pos + z * forward;
+
+    // A step is 128 texels. The sphere can move half a step diagonally off the
+    // snapped centre, which the 1.25x box still covers.
+    float half = 1.25f * r;
+    float step = half / 4.0f;
+    float cx = rot.e[0][0] * centre.x + rot.e[0][1] * centre.y + rot.e[0][2] * centre.z;
+    float cy = rot.e[1][0] * centre.x + rot.e[1][1] * centre.y + rot.e[1][2] * centre.z;
+    cx = floorf(cx / step + 0.5f) * step;
+    cy = floorf(cy / step + 0.5f) * step;
+
+    Mat4 ortho = rwm_m4_init_f(
+      1.0f / half, 0, 0, -cx / half,
+      0, 1.0f / half, 0, -cy / half,
+      0, 0, -2.0f / (f - n), -(f + n) / (f - n),
+      0, 0, 0, 1.0f
+    );
+    view_proj[c] = mat4_mult(&ortho, &rot);
+    sh->cascade_far[c] = split;
+    prev = split;
+  }
+}
+
+static void draw_layer(Shadows *sh, uint32_t tid, int layer, int size, Mat4 *view_proj, bool is_static) {
+  glNamedFramebufferTextureLayer(sh->fbo, GL_DEPTH_ATTACHMENT, tid, 0, layer);
+  gl_bind_framebuffer(GL_FRAMEBUFFER, sh->fbo);
+  glViewport(0, 0, size, size);
+  if (is_static) {
+    const float one = 1.0f;
+    glClearBufferfv(GL_DEPTH, 0, &one);
+  }
+  uint32_t count = is_static ? sh->num_static : sh->num_dynamic;
+  if (count == 0) {
+    return;
+  }
+  sh->depth_s->set_unif_mat4("u_light_view_proj", view_proj);
+  size_t offset = is_static ? 0 : sizeof(DrawCommand) * sh->num_static;
+  glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void *) offset, count, sizeof(DrawCommand));
+  stats_count_draw(GL_TRIANGLES, is_static ? sh->static_indices : sh->dynamic_indices);
+}
+
+static Mat4 cube_face_view_proj(Shadows *sh, const SceneLightDesc &l, int face) {
+  Vec3 target = l.pos + sh->face_dirs[face];
+  Vec3 pos = l.pos;
+  Mat4 view = get_view_mat(&pos, &target, &sh->face_ups[face]);
+  Mat4 proj = perspective(90.0f, SHADOW_CUBE_NEAR, l.range, 1.0f);
+  return mat4_mult(&proj, &view);
+}
+
+void shadows_render(Shadows *sh, Scene *scene, GpuScene *gs, Camera *camera) {
+  sh->static_redraws = 0;
+  if ((!sh->sun.enabled && sh->num_cubes == 0) || !sh->command_buffer || !gs->frame_draw_data.ptr) {
+    return;
+  }
+  gl_bind_vertex_array(gs->vao);
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, GPU_SCENE_DRAW_BINDING, gs->frame_draw_data.buffer, gs->frame_draw_data.offset, gs->frame_draw_data.size);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, sh->command_buffer);
+  sh->depth_s->use();
+  uint32_t polygon_mode = g_gl_state.polygon_mode;
+  gl_polygon_mode(GL_FILL);
+  gl_enable(GL_DEPTH_TEST);
+  gl_depth_func(GL_LESS);
+  // Casters in front of a cascade's near plane still cast
+  glEnable(GL_DEPTH_CLAMP);
+  // Slope scaled bias against acne
+  glEnable(GL_POLYGON_OFFSET_FILL);
+  glPolygonOffset(2.0f, 4.0f);
+
+  if (sh->static_moved) {
+    for (int c = 0; c < SHADOW_NUM_CASCADES; c++) {
+      sh->cascade_cached[c] = false;
+    }
+    sh->cubes_cached = false;
+    if (sh->sun.enabled) {
+      update_scene_depth(sh, gs);
+    }
+    sh->static_moved = false;
+  }
+
+  Mat4 cascade_view_proj[SHADOW_NUM_CASCADES];
+  if (sh->sun.enabled) {
+    fit_cascades(sh, camera, cascade_view_proj);
+    for (int c = 0; c < SHADOW_NUM_CASCADES; c++) {
+      if (sh->cascade_cached[c] && memcmp(&cascade_view_proj[c], &sh->cascade_view_proj[c], sizeof(Mat4)) == 0) {
+        continue;
+      }
+      sh->cascade_view_proj[c] = cascade_view_proj[c];
+      draw_layer(sh, sh->cascade_static_tid, c, SHADOW_CASCADE_SIZE, &cascade_view_proj[c], true);
+      sh->cascade_cached[c] = true;
+      sh->static_redraws++;
+    }
+  }
+
+  for (uint32_t i = 0; i < sh->num_cubes; i++) {
+    if (memcmp(&scene->lights[sh->cube_light[i]], &sh->cube_cached_light[i], sizeof(SceneLightDesc)) != 0) {
+      sh->cubes_cached = false;
+    }
+  }
+  if (!sh->cubes_cached) {
+    for (uint32_t i = 0; i < sh->num_cubes; i++) {
+      const SceneLightDesc &l = scene->lights[sh->cube_light[i]];
+      sh->cube_cached_light[i] = l;
+      for (int face = 0; face < 6; face++) {
+        Mat4 view_proj = cube_face_view_proj(sh, l, face);
+        draw_layer(sh, sh->cube_static_tid, 6 * i + face, SHADOW_CUBE_SIZE, &view_proj, true);
+        sh->static_redraws++;
+      }
+    }
+    sh->cubes_cached = true;
+  }
+
+  // Dynamic instances go on top of a copy of the static layers
+  if (sh->num_dynamic > 0) {
+    if (sh->sun.enabled) {
+      glCopyImageSubData(sh->cascade_static_tid, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+                         sh->cascade_tid, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+                         SHADOW_CASCADE_SIZE, SHADOW_CASCADE_SIZE, SHADOW_NUM_CASCADES);
+      for (int c = 0; c < SHADOW_NUM_CASCADES; c++) {
+        draw_layer(sh, sh->cascade_tid, c, SHADOW_CASCADE_SIZE, &sh->cascade_view_proj[c], false);
+      }
+    }
+    if (sh->num_cubes > 0) {
+      glCopyImageSubData(sh->cube_static_tid, GL_TEXTURE_CUBE_MAP_ARRAY, 0, 0, 0, 0,
+                         sh->cube_tid, GL_TEXTURE_CUBE_MAP_ARRAY, 0, 0, 0, 0,
+                         SHADOW_CUBE_SIZE, SHADOW_CUBE_SIZE, 6 * sh->num_cubes);
+      for (uint32_t i = 0; i < sh->num_cubes; i++) {
+        for (int face = 0; face < 6; face++) {
+          Mat4 view_proj = cube_face_view_proj(sh, sh->cube_cached_light[i], face);
+          draw_layer(sh, sh->cube_tid, 6 * i + face, SHADOW_CUBE_SIZE, &view_proj, false);
+        }
+      }
+    }
+    sh->cascade_sample_tid = sh->cascade_tid;
+    sh->cube_sample_tid = sh->cube_tid;
+  } else {
+    sh->cascade_sample_tid = sh->cascade_static_tid;
+    sh->cube_sample_tid = sh->cube_static_tid;
+  }
+
+  glDisable(GL_POLYGON_OFFSET_FILL);
+  glDisable(GL_DEPTH_CLAMP);
+  // The cached mode can be unknown after gl_state_invalidate, only put back wireframe
+  if (polygon_mode == GL_LINE || polygon_mode == GL_POINT) {
+    gl_polygon_mode(polygon_mode);
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <rw_math.h>
+#include "camera.h"
+#include "gpu_scene.h"
+#include "scene.h"
+#include "shader.h"
+
+#define SHADOW_NUM_CASCADES 4
+#define SHADOW_CASCADE_SIZE 1024
+// The cascades cover the view out to here, or the far plane if it's closer
+#define SHADOW_DISTANCE 60.0f
+// Blend between uniform and logarithmic cascade splits
+#define SHADOW_SPLIT_LAMBDA 0.75f
+#define SHADOW_MAX_CUBES 4
+#define SHADOW_CUBE_SIZE 512
+#define SHADOW_CUBE_NEAR 0.1f
+
+// Shadow maps for the sun (cascades) and for the local lights marked "shadow" (a cube
+// each). Static instances go into a cached layer that is only redrawn when something
+// it depends on changes: a static instance or the light moving, or for a cascade its
+// snapped bounds moving with the camera. Dynamic instances are drawn every frame on top
+// of a copy of the cache. With no dynamic instances the caches are sampled directly,
+// and a still camera costs no shadow draws at all.
+struct Shadows {
+  Shader *depth_s;
+  uint32_t fbo;
+  // Indirect commands, the static instances first
+  uint32_t command_buffer;
+  uint32_t num_static;
+  uint32_t num_dynamic;
+  uint32_t static_indices;
+  uint32_t dynamic_indices;
+  // World matrices of the static instances when the caches were drawn
+  std::vector<uint32_t> static_instances;
+  std::vector<Mat4> static_world;
+  bool static_moved;
+  // Light space depth range of the static instances, along the sun
+  float scene_min_z;
+  float scene_max_z;
+
+  // Sun. cascade_far is the view distance each cascade ends at.
+  SceneSunDesc sun;
+  uint32_t cascade_static_tid;
+  uint32_t cascade_tid;
+  Mat4 cascade_view_proj[SHADOW_NUM_CASCADES];
+  float cascade_far[SHADOW_NUM_CASCADES];
+  bool cascade_cached[SHADOW_NUM_CASCADES];
+
+  // Local lights, light_cube is the cube of every scene light or -1
+  uint32_t cube_static_tid;
+  uint32_t cube_tid;
+  uint32_t num_cubes;
+  uint32_t cube_light[SHADOW_MAX_CUBES];
+  SceneLightDesc cube_cached_light[SHADOW_MAX_CUBES];
+  bool cubes_cached;
+  std::vector<int32_t> light_cube;
+  Vec3 face_dirs[6];
+  Vec3 face_ups[6];
+
+  // What the lighting samples this frame, the caches when nothing is dynamic
+  uint32_t cascade_sample_tid;
+  uint32_t cube_sample_tid;
+  // Layers redrawn from scratch this frame
+  uint32_t static_redraws;
+};
+
+// face_dirs/face_ups orient the cube faces like the environment map captures
+void shadows_init(Shadows *sh, Shader *depth_s, Scene *scene, GpuScene *gs, const Vec3 *face_dirs, const Vec3 *face_ups);
+void shadows_destroy(Shadows *sh);
+// Notes static instances that moved, after the scene graph update. No GL calls.
+void shadows_check_static(Shadows *sh, Scene *scene);
+// Redraws the out of date cached layers, then the dynamic instances on top.
+// Uses this frame's draw data, after gpu_scene_write_draws.
+void shadows_render(Shadows *sh, Scene *scene, GpuScene *gs, Camera *camera);
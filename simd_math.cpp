@@ -0,0 +1,110 @@
+#include "simd_math.h"
+#include <math.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Below this the 3x3 is treated as singular
+#define SIMD_MIN_DET 1e-20f
+// How many entries ahead the array versions prefetch
+#define SIMD_PREFETCH_AHEAD 4
+
+// Row r of the result is a[r][0] * b row 0 + ... + a[r][3] * b row 3
+static inline void mult(const Mat4 *a, const Mat4 *b, Mat4 *out) {
+#ifdef __AVX2__
+  // Only with /arch:AVX2 or -mavx2, which toy_renderer.vcxproj doesn't set.
+  // b's rows in both halves, two rows of a at a time
+  __m256 b0 = _mm256_broadcast_ps((const __m128 *) b->e[0]);
+  __m256 b1 = _mm256_broadcast_ps((const __m128 *) b->e[1]);
+  __m256 b2 = _mm256_broadcast_ps((const __m128 *) b->e[2]);
+  __m256 b3 = _mm256_broadcast_ps((const __m128 *) b->e[3]);
+  __m256 a01 = _mm256_loadu_ps(a->e[0]);
+  __m256 a23 = _mm256_loadu_ps(a->e[2]);
+  __m256 r01 = _mm256_add_ps(
+    _mm256_add_ps(_mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0x00), b0), _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0x55), b1)),
+    _mm256_add_ps(_mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0xaa), b2), _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0xff), b3)));
+  __m256 r23 = _mm256_add_ps(
+    _mm256_add_ps(_mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0x00), b0), _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0x55), b1)),
+    _mm256_add_ps(_mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0xaa), b2), _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0xff), b3)));
+  _mm256_storeu_ps(out->e[0], r01);
+  _mm256_storeu_ps(out->e[2], r23);
+#else
+  __m128 b0 = _mm_loadu_ps(b->e[0]);
+  __m128 b1 = _mm_loadu_ps(b->e[1]);
+  __m128 b2 = _mm_loadu_ps(b->e[2]);
+  __m128 b3 = _mm_loadu_ps(b->e[3]);
+  __m128 rows[4];
+  for (int r = 0; r < 4; r++) {
+    __m128 ar = _mm_loadu_ps(a->e[r]);
+    rows[r] = _mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(ar, ar, 0x00), b0), _mm_mul_ps(_mm_shuffle_ps(ar, ar, 0x55), b1)),
+      _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(ar, ar, 0xaa), b2), _mm_mul_ps(_mm_shuffle_ps(ar, ar, 0xff), b3)));
+  }
+  // All of a and b are read before anything is written
+  for (int r = 0; r < 4; r++) {
+    _mm_storeu_ps(out->e[r], rows[r]);
+  }
+#endif
+}
+
+void mat4_mult_simd(const Mat4 *a, const Mat4 *b, Mat4 *out) {
+  mult(a, b, out);
+}
+
+void mat4_mult_indexed(const Mat4 *a, const int32_t *a_index, const Mat4 *b, Mat4 *out, const uint32_t *indices, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    // The gathered matrices are the cache misses, start on them a few ahead
+    if (i + SIMD_PREFETCH_AHEAD < count) {
+      uint32_t next = indices[i + SIMD_PREFETCH_AHEAD];
+      _mm_prefetch((const char *) &a[a_index[next]], _MM_HINT_T0);
+      _mm_prefetch((const char *) &b[next], _MM_HINT_T0);
+    }
+    uint32_t j = indices[i];
+    mult(&a[a_index[j]], &b[j], &out[j]);
+  }
+}
+
+Mat4 mat4_mult(Mat4 *a, Mat4 *b) {
+  Mat4 result;
+  mat4_mult_simd(a, b, &result);
+  return result;
+}
+
+// xyz cross product, w comes out 0
+static inline __m128 cross3(__m128 a, __m128 b) {
+  __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+  __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+  __m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+  return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+void mat4_normal_matrix_simd(const Mat4 *m, float out[3][4]) {
+  // With r0..r2 the rows of the 3x3, the rows of its inverse transpose are
+  // cross(r1, r2), cross(r2, r0) and cross(r0, r1) over the determinant
+  const __m128 xyz = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+  __m128 r0 = _mm_and_ps(_mm_loadu_ps(m->e[0]), xyz);
+  __m128 r1 = _mm_and_ps(_mm_loadu_ps(m->e[1]), xyz);
+  __m128 r2 = _mm_and_ps(_mm_loadu_ps(m->e[2]), xyz);
+  __m128 n0 = cross3(r1, r2);
+  __m128 n1 = cross3(r2, r0);
+  __m128 n2 = cross3(r0, r1);
+  // Horizontal sum of r0 * n0 into every lane
+  __m128 d = _mm_mul_ps(r0, n0);
+  d = _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 3, 0, 1)));
+  d = _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 0, 3, 2)));
+  float det = _mm_cvtss_f32(d);
+  if (fabsf(det) < SIMD_MIN_DET) {
+    for (int r = 0; r < 3; r++) {
+      for (int c = 0; c < 4; c++) {
+        out[r][c] = r == c ? 1.0f : 0.0f;
+      }
+    }
+    return;
+  }
+  __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), d);
+  _mm_storeu_ps(out[0], _mm_mul_ps(n0, inv_det));
+  _mm_storeu_ps(out[1], _mm_mul_ps(n1, inv_det));
+  _mm_storeu_ps(out[2], _mm_mul_ps(n2, inv_det));
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include <rw_math.h>
+
+// SSE versions of the matrix work done per instance or per node. A Mat4 stays
+// rw_math's row-major with one row per register, and it goes to the GPU the same
+// way: the blocks that hold them are declared row_major, so nothing is transposed
+// on either side.
+// NOTE(ray): x86 only, like every platform in toy_renderer.vcxproj. There's no
+// scalar or NEON fallback here or in cull/soft_occlusion/hdr_image.
+#if !defined(__SSE2__) && !defined(_M_X64) && !(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#error "simd_math needs SSE2, ARM and other targets aren't supported"
+#endif
+
+// out = a * b, out may be a or b
+void mat4_mult_simd(const Mat4 *a, const Mat4 *b, Mat4 *out);
+Mat4 mat4_mult(Mat4 *a, Mat4 *b);
+// out[j] = a[a_index[j]] * b[j] for each j in indices, in order. out may be a as
+// long as every a_index[j] is written before j, like parents before children.
+void mat4_mult_indexed(const Mat4 *a, const int32_t *a_index, const Mat4 *b, Mat4 *out, const uint32_t *indices, uint32_t count);
+// Rows of the inverse transpose of the upper 3x3, what normals are transformed by.
+// Padded to vec4 like a row_major mat3 in std430. Identity if m is singular.
+void mat4_normal_matrix_simd(const Mat4 *m, float out[3][4]);
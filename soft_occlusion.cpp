@@ -0,0 +1,288 @@
+#include "soft_occlusion.h"
+#include <math.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Vertices closer than this (clip w) are treated as crossing the near plane
+#define SOFT_OCCLUSION_MIN_W 1e-4f
+
+static void rasterize_tiles(uint32_t start, uint32_t end, uint32_t threadnum, void *args);
+
+void soft_occlusion_init(SoftOcclusion *so, enkiTaskScheduler *ts) {
+  so->depth.assign(SOFT_OCCLUSION_W * SOFT_OCCLUSION_H, 1.0f);
+  for (int i = 0; i < SOFT_OCCLUSION_NUM_TILES; i++) {
+    so->tile_max[i] = 1.0f;
+  }
+  so->view_proj = rwm_m4_identity();
+  so->ts = ts;
+  so->task = enkiCreateTaskSet(ts, rasterize_tiles);
+}
+
+void soft_occlusion_destroy(SoftOcclusion *so) {
+  enkiDeleteTaskSet(so->task);
+}
+
+void soft_occlusion_begin(SoftOcclusion *so, Mat4 *view_proj) {
+  so->view_proj = *view_proj;
+  so->triangles.clear();
+  for (int i = 0; i < SOFT_OCCLUSION_NUM_TILES; i++) {
+    so->bins[i].clear();
+  }
+}
+
+struct ScreenVertex {
+  float x;
+  float y;
+  float z;
+};
+
+static void setup_triangle(SoftOcclusion *so, ScreenVertex *v) {
+  // Counter-clockwise front faces like GL. Back faces are skipped, which for a closed
+  // occluder only loses triangles that are behind the front ones anyway.
+  float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+  if (area <= 0.0f) {
+    return;
+  }
+
+  float min_x = fminf(v[0].x, fminf(v[1].x, v[2].x));
+  float max_x = fmaxf(v[0].x, fmaxf(v[1].x, v[2].x));
+  float min_y = fminf(v[0].y, fminf(v[1].y, v[2].y));
+  float max_y = fmaxf(v[0].y, fmaxf(v[1].y, v[2].y));
+  SoftTriangle tri;
+  tri.x0 = (int) floorf(min_x) > 0 ? (int) floorf(min_x) : 0;
+  tri.y0 = (int) floorf(min_y) > 0 ? (int) floorf(min_y) : 0;
+  tri.x1 = (int) ceilf(max_x) < SOFT_OCCLUSION_W - 1 ? (int) ceilf(max_x) : SOFT_OCCLUSION_W - 1;
+  tri.y1 = (int) ceilf(max_y) < SOFT_OCCLUSION_H - 1 ? (int) ceilf(max_y) : SOFT_OCCLUSION_H - 1;
+  if (tri.x0 > tri.x1 || tri.y0 > tri.y1) {
+    return;
+  }
+
+  for (int e = 0; e < 3; e++) {
+    ScreenVertex &p0 = v[e];
+    ScreenVertex &p1 = v[(e + 1) % 3];
+    float a = -(p1.y - p0.y);
+    float b = p1.x - p0.x;
+    tri.a[e] = a;
+    tri.b[e] = b;
+    tri.c[e] = -(a * p0.x + b * p0.y);
+  }
+  tri.z_max = fmaxf(v[0].z, fmaxf(v[1].z, v[2].z));
+
+  uint32_t index = (uint32_t) so->triangles.size();
+  so->triangles.push_back(tri);
+  int tx0 = tri.x0 / SOFT_OCCLUSION_TILE_W;
+  int tx1 = tri.x1 / SOFT_OCCLUSION_TILE_W;
+  int ty0 = tri.y0 / SOFT_OCCLUSION_TILE_H;
+  int ty1 = tri.y1 / SOFT_OCCLUSION_TILE_H;
+  for (int ty = ty0; ty <= ty1; ty++) {
+    for (int tx = tx0; tx <= tx1; tx++) {
+      so->bins[ty * SOFT_OCCLUSION_TILES_X + tx].push_back(index);
+    }
+  }
+}
+
+void soft_occlusion_add(SoftOcclusion *so, OccluderMesh *occluder, Mat4 *mvp) {
+  // Columns of the row-major matrix, clip = c0*x + c1*y + c2*z + c3
+  __m128 col[4];
+  for (int c = 0; c < 4; c++) {
+    col[c] = _mm_setr_ps(mvp->e[0][c], mvp->e[1][c], mvp->e[2][c], mvp->e[3][c]);
+  }
+  size_t num_vertices = occluder->positions.size() - occluder->positions.size() % 3;
+  for (size_t i = 0; i < num_vertices; i += 3) {
+    ScreenVertex v[3];
+    bool near_clipped = false;
+    for (int k = 0; k < 3; k++) {
+      Vec3 &p = occluder->positions[i + k];
+      __m128 clip = _mm_add_ps(_mm_add_ps(_mm_mul_ps(col[0], _mm_set1_ps(p.x)), _mm_mul_ps(col[1], _mm_set1_ps(p.y))),
+                               _mm_add_ps(_mm_mul_ps(col[2], _mm_set1_ps(p.z)), col[3]));
+      alignas(16) float c[4];
+      _mm_store_ps(c, clip);
+      // Clipping would add depth we can't be sure about, drop the triangle instead
+      if (c[3] < SOFT_OCCLUSION_MIN_W || c[2] < -c[3]) {
+        near_clipped = true;
+        break;
+      }
+      float inv_w = 1.0f / c[3];
+      v[k].x = (c[0] * inv_w * 0.5f + 0.5f) * SOFT_OCCLUSION_W;
+      v[k].y = (c[1] * inv_w * 0.5f + 0.5f) * SOFT_OCCLUSION_H;
+      v[k].z = c[2] * inv_w * 0.5f + 0.5f;
+    }
+    if (!near_clipped) {
+      setup_triangle(so, v);
+    }
+  }
+}
+
+static void rasterize_tile(SoftOcclusion *so, int tile) {
+  int tx = tile % SOFT_OCCLUSION_TILES_X;
+  int ty = tile / SOFT_OCCLUSION_TILES_X;
+  int tile_x0 = tx * SOFT_OCCLUSION_TILE_W;
+  int tile_y0 = ty * SOFT_OCCLUSION_TILE_H;
+  int tile_x1 = tile_x0 + SOFT_OCCLUSION_TILE_W - 1;
+  int tile_y1 = tile_y0 + SOFT_OCCLUSION_TILE_H - 1;
+
+  for (int y = tile_y0; y <= tile_y1; y++) {
+    float *row = &so->depth[y * SOFT_OCCLUSION_W];
+    for (int x = tile_x0; x <= tile_x1; x++) {
+      row[x] = 1.0f;
+    }
+  }
+
+  for (uint32_t index : so->bins[tile]) {
+    SoftTriangle &tri = so->triangles[index];
+    // Rows start on a multiple of the SIMD width, the tile is too, so nothing
+    // outside the tile is ever touched
+    int x0 = (tri.x0 > tile_x0 ? tri.x0 : tile_x0) & ~7;
+    int x1 = tri.x1 < tile_x1 ? tri.x1 : tile_x1;
+    int y0 = tri.y0 > tile_y0 ? tri.y0 : tile_y0;
+    int y1 = tri.y1 < tile_y1 ? tri.y1 : tile_y1;
+
+#ifdef __AVX2__
+    const __m256 lane = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+    __m256 z = _mm256_set1_ps(tri.z_max);
+    __m256 a0 = _mm256_set1_ps(tri.a[0]), a1 = _mm256_set1_ps(tri.a[1]), a2 = _mm256_set1_ps(tri.a[2]);
+    for (int y = y0; y <= y1; y++) {
+      float py = y + 0.5f;
+      __m256 r0 = _mm256_set1_ps(tri.b[0] * py + tri.c[0]);
+      __m256 r1 = _mm256_set1_ps(tri.b[1] * py + tri.c[1]);
+      __m256 r2 = _mm256_set1_ps(tri.b[2] * py + tri.c[2]);
+      float *row = &so->depth[y * SOFT_OCCLUSION_W];
+      for (int x = x0; x <= x1; x += 8) {
+        __m256 px = _mm256_add_ps(_mm256_set1_ps((float) x), lane);
+        __m256 e0 = _mm256_add_ps(_mm256_mul_ps(a0, px), r0);
+        __m256 e1 = _mm256_add_ps(_mm256_mul_ps(a1, px), r1);
+        __m256 e2 = _mm256_add_ps(_mm256_mul_ps(a2, px), r2);
+        // Sign bits of all three edges clear means inside
+        __m256 outside = _mm256_or_ps(_mm256_or_ps(e0, e1), e2);
+        __m256 d = _mm256_loadu_ps(row + x);
+        _mm256_storeu_ps(row + x, _mm256_blendv_ps(_mm256_min_ps(d, z), d, outside));
+      }
+    }
+#else
+    const __m128 lane = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 z = _mm_set1_ps(tri.z_max);
+    __m128 a0 = _mm_set1_ps(tri.a[0]), a1 = _mm_set1_ps(tri.a[1]), a2 = _mm_set1_ps(tri.a[2]);
+    for (int y = y0; y <= y1; y++) {
+      float py = y + 0.5f;
+      __m128 r0 = _mm_set1_ps(tri.b[0] * py + tri.c[0]);
+      __m128 r1 = _mm_set1_ps(tri.b[1] * py + tri.c[1]);
+      __m128 r2 = _mm_set1_ps(tri.b[2] * py + tri.c[2]);
+      float *row = &so->depth[y * SOFT_OCCLUSION_W];
+      for (int x = x0; x <= x1; x += 4) {
+        __m128 px = _mm_add_ps(_mm_set1_ps((float) x), lane);
+        __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), r0);
+        __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), r1);
+        __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), r2);
+        __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+        __m128 d = _mm_loadu_ps(row + x);
+        __m128 nd = _mm_min_ps(d, z);
+        _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nd), _mm_andnot_ps(inside, d)));
+      }
+    }
+#endif
+  }
+
+  __m128 tile_max = _mm_setzero_ps();
+  for (int y = tile_y0; y <= tile_y1; y++) {
+    float *row = &so->depth[y * SOFT_OCCLUSION_W];
+    for (int x = tile_x0; x <= tile_x1; x += 4) {
+      tile_max = _mm_max_ps(tile_max, _mm_loadu_ps(row + x));
+    }
+  }
+  alignas(16) float m[4];
+  _mm_store_ps(m, tile_max);
+  so->tile_max[tile] = fmaxf(fmaxf(m[0], m[1]), fmaxf(m[2], m[3]));
+}
+
+static void rasterize_tiles(uint32_t start, uint32_t end, uint32_t threadnum, void *args) {
+  SoftOcclusion *so = (SoftOcclusion *) args;
+  for (uint32_t tile = start; tile < end; tile++) {
+    rasterize_tile(so, tile);
+  }
+}
+
+void soft_occlusion_rasterize(SoftOcclusion *so) {
+  enkiAddTaskSetToPipe(so->ts, so->task, so, SOFT_OCCLUSION_NUM_TILES);
+  enkiWaitForTaskSet(so->ts, so->task);
+}
+
+bool soft_occlusion_test(SoftOcclusion *so, Aabb *box) {
+  float min_x = 1.0f, min_y = 1.0f, max_x = 0.0f, max_y = 0.0f;
+  float z_min = 1.0f;
+  Mat4 &m = so->view_proj;
+  for (int i = 0; i < 8; i++) {
+    float p[3] = {
+      (i & 1) ? box->max.x : box->min.x,
+      (i & 2) ? box->max.y : box->min.y,
+      (i & 4) ? box->max.z : box->min.z
+    };
+    float c[4];
+    for (int r = 0; r < 4; r++) {
+      c[r] = m.e[r][0] * p[0] + m.e[r][1] * p[1] + m.e[r][2] * p[2] + m.e[r][3];
+    }
+    // Crosses the camera plane, assume it's visible
+    if (c[3] <= SOFT_OCCLUSION_MIN_W) {
+      return true;
+    }
+    float inv_w = 1.0f / c[3];
+    float x = c[0] * inv_w * 0.5f + 0.5f;
+    float y = c[1] * inv_w * 0.5f + 0.5f;
+    min_x = fminf(min_x, x);
+    max_x = fmaxf(max_x, x);
+    min_y = fminf(min_y, y);
+    max_y = fmaxf(max_y, y);
+    z_min = fminf(z_min, c[2] * inv_w * 0.5f + 0.5f);
+  }
+  if (z_min <= 0.0f) {
+    return true;
+  }
+
+  // Every pixel the rectangle touches plus a one pixel border. Occluder pixels are
+  // written when their centre is covered, so one can be partly open at a silhouette;
+  // the pixel across that edge is then open too and the border reaches it.
+  int x0 = (int) floorf(fmaxf(min_x, 0.0f) * SOFT_OCCLUSION_W) - 1;
+  int y0 = (int) floorf(fmaxf(min_y, 0.0f) * SOFT_OCCLUSION_H) - 1;
+  int x1 = (int) floorf(fminf(max_x, 1.0f) * SOFT_OCCLUSION_W) + 1;
+  int y1 = (int) floorf(fminf(max_y, 1.0f) * SOFT_OCCLUSION_H) + 1;
+  x0 = x0 > 0 ? (x0 < SOFT_OCCLUSION_W - 1 ? x0 : SOFT_OCCLUSION_W - 1) : 0;
+  y0 = y0 > 0 ? (y0 < SOFT_OCCLUSION_H - 1 ? y0 : SOFT_OCCLUSION_H - 1) : 0;
+  x1 = x1 < SOFT_OCCLUSION_W - 1 ? x1 : SOFT_OCCLUSION_W - 1;
+  y1 = y1 < SOFT_OCCLUSION_H - 1 ? y1 : SOFT_OCCLUSION_H - 1;
+  if (min_x > 1.0f || min_y > 1.0f || max_x < 0.0f || max_y < 0.0f) {
+    // Off screen, the frustum test should have caught it but it's not our call
+    return true;
+  }
+
+  __m128 z = _mm_set1_ps(z_min);
+  for (int ty = y0 / SOFT_OCCLUSION_TILE_H; ty <= y1 / SOFT_OCCLUSION_TILE_H; ty++) {
+    for (int tx = x0 / SOFT_OCCLUSION_TILE_W; tx <= x1 / SOFT_OCCLUSION_TILE_W; tx++) {
+      if (z_min > so->tile_max[ty * SOFT_OCCLUSION_TILES_X + tx]) {
+        continue;
+      }
+      int rx0 = x0 > tx * SOFT_OCCLUSION_TILE_W ? x0 : tx * SOFT_OCCLUSION_TILE_W;
+      int rx1 = x1 < (tx + 1) * SOFT_OCCLUSION_TILE_W - 1 ? x1 : (tx + 1) * SOFT_OCCLUSION_TILE_W - 1;
+      int ry0 = y0 > ty * SOFT_OCCLUSION_TILE_H ? y0 : ty * SOFT_OCCLUSION_TILE_H;
+      int ry1 = y1 < (ty + 1) * SOFT_OCCLUSION_TILE_H - 1 ? y1 : (ty + 1) * SOFT_OCCLUSION_TILE_H - 1;
+      for (int y = ry0; y <= ry1; y++) {
+        float *row = &so->depth[y * SOFT_OCCLUSION_W];
+        int x = rx0;
+        for (; x + 3 <= rx1; x += 4) {
+          // Any pixel at or behind the box's nearest point means part of it shows
+          if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), z))) {
+            return true;
+          }
+        }
+        for (; x <= rx1; x++) {
+          if (row[x] >= z_min) {
+            return true;
+          }
+        }
+      }
+    }
+  }
+  return false;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <rw_math.h>
+#include <TaskScheduler_c.h>
+#include "cull.h"
+
+// Coarse depth buffer, independent of the window size. Width is a multiple of 8 so
+// rows can be walked 8 (AVX2) or 4 (SSE) pixels at a time.
+#define SOFT_OCCLUSION_W 320
+#define SOFT_OCCLUSION_H 192
+#define SOFT_OCCLUSION_TILE_W 64
+#define SOFT_OCCLUSION_TILE_H 48
+#define SOFT_OCCLUSION_TILES_X (SOFT_OCCLUSION_W / SOFT_OCCLUSION_TILE_W)
+#define SOFT_OCCLUSION_TILES_Y (SOFT_OCCLUSION_H / SOFT_OCCLUSION_TILE_H)
+#define SOFT_OCCLUSION_NUM_TILES (SOFT_OCCLUSION_TILES_X * SOFT_OCCLUSION_TILES_Y)
+
+// Low poly stand-in for a mesh, a plain triangle list. It must sit inside the mesh
+// it stands in for, otherwise it hides things the real mesh doesn't.
+struct OccluderMesh {
+  std::vector<Vec3> positions;
+};
+
+// Triangle in buffer space, edge functions e = a*x + b*y + c are >= 0 inside
+struct SoftTriangle {
+  float a[3];
+  float b[3];
+  float c[3];
+  // Furthest depth of the three vertices, what gets written everywhere it covers
+  float z_max;
+  int x0, y0, x1, y1;
+};
+
+// Conservative in depth: covered pixels get the triangle's furthest depth and triangles
+// that cross the near plane are dropped. Coverage is sampled at pixel centres and the
+// tests look one pixel past the box, so the only thing treated as closed is a crack
+// between occluders thinner than a coarse pixel.
+struct SoftOcclusion {
+  // SOFT_OCCLUSION_W * SOFT_OCCLUSION_H, row 0 at the bottom like GL window coordinates
+  std::vector<float> depth;
+  // Furthest depth in each tile, an object behind it is hidden in the whole tile
+  float tile_max[SOFT_OCCLUSION_NUM_TILES];
+  std::vector<SoftTriangle> triangles;
+  std::vector<uint32_t> bins[SOFT_OCCLUSION_NUM_TILES];
+  Mat4 view_proj;
+  enkiTaskScheduler *ts;
+  enkiTaskSet *task;
+};
+
+void soft_occlusion_init(SoftOcclusion *so, enkiTaskScheduler *ts);
+void soft_occlusion_destroy(SoftOcclusion *so);
+// Clears the buffer and the triangle bins for a new view
+void soft_occlusion_begin(SoftOcclusion *so, Mat4 *view_proj);
+// mvp is view_proj * world of the instance the occluder stands in for
+void soft_occlusion_add(SoftOcclusion *so, OccluderMesh *occluder, Mat4 *mvp);
+// Rasterizes the binned triangles, one task per tile
+void soft_occlusion_rasterize(SoftOcclusion *so);
+// False if the box is entirely behind the occluders
+bool soft_occlusion_test(SoftOcclusion *so, Aabb *box);